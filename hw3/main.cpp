@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "SETTINGS.h"
+#include "image.hpp"
 
 using namespace std;
 
@@ -23,7 +24,7 @@ void partEight(VEC3 eye = VEC3(1, 1, 1), VEC3 lookAt = VEC3(0, 0, 0),
 
 // pipeline routines
 MATRIX4 viewportMatrix(int xRes, int yRes);
-float* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
+Image* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
                              vector<VEC3> colors, int xRes, int yRes,
                              bool interpolateColors = false,
                              bool depthBuffering = false);
@@ -42,77 +43,11 @@ void printVector(vector<T, A> const& vec);
 bool betweenZeroAndOneInclusive(Real num);
 Real degreesToRadians(Real degrees);
 
-// ppm routines
-int indexIntoPPM(int x, int y, int xRes, int yRes,
-                 bool originBottomLeft = false);
-float* allocatePPM(int xRes, int yRes);
-void initPPM(float* values, int xRes, int yRes);
-
 //////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
 VEC3 truncate(const VEC4& v) { return VEC3(v[0], v[1], v[2]); }
 VEC4 extend(const VEC3& v) { return VEC4(v[0], v[1], v[2], 1.0); }
 
-///////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////
-void readPPM(const string& filename, int& xRes, int& yRes, float*& values) {
-    // try to open the file
-    FILE* fp;
-    fp = fopen(filename.c_str(), "rb");
-    if (fp == NULL) {
-        cout << " Could not open file \"" << filename.c_str()
-             << "\" for reading." << endl;
-        cout << " Make sure you're not trying to read from a weird location or "
-                "with a "
-             << endl;
-        cout << " strange filename. Bailing ... " << endl;
-        exit(0);
-    }
-
-    // get the dimensions
-    fscanf(fp, "P6\n%d %d\n255\n", &xRes, &yRes);
-    int totalCells = xRes * yRes;
-
-    // grab the pixel values
-    unsigned char* pixels = new unsigned char[3 * totalCells];
-    fread(pixels, 1, totalCells * 3, fp);
-
-    // copy to a nicer data type
-    values = new float[3 * totalCells];
-    for (int i = 0; i < 3 * totalCells; i++) values[i] = pixels[i];
-
-    // clean up
-    delete[] pixels;
-    fclose(fp);
-    cout << " Read in file " << filename.c_str() << endl;
-}
-
-///////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////
-void writePPM(const string& filename, int& xRes, int& yRes,
-              const float* values) {
-    int totalCells = xRes * yRes;
-    unsigned char* pixels = new unsigned char[3 * totalCells];
-    for (int i = 0; i < 3 * totalCells; i++) pixels[i] = values[i];
-
-    FILE* fp;
-    fp = fopen(filename.c_str(), "wb");
-    if (fp == NULL) {
-        cout << " Could not open file \"" << filename.c_str()
-             << "\" for writing." << endl;
-        cout << " Make sure you're not trying to write from a weird location "
-                "or with a "
-             << endl;
-        cout << " strange filename. Bailing ... " << endl;
-        exit(0);
-    }
-
-    fprintf(fp, "P6\n%d %d\n255\n", xRes, yRes);
-    fwrite(pixels, 1, totalCells * 3, fp);
-    fclose(fp);
-    delete[] pixels;
-}
-
 //////////////////////////////////////////////////////////////////////////////////
 // build out a single square
 //////////////////////////////////////////////////////////////////////////////////
@@ -307,16 +242,13 @@ void partOne() {
     MATRIX4 compose = mvp;
     vector<VEC3> transformedVertices = transformVertices(vertices, compose);
 
-    float* ppm = allocatePPM(xRes, yRes);
+    Image image(xRes, yRes);
+    image.fill(VEC3(0.0, 0.0, 0.0));
     for (int i = 0; i < transformedVertices.size(); i++) {
-        int index = indexIntoPPM(transformedVertices[i][0],
-                                 transformedVertices[i][1], xRes, yRes);
-        ppm[index] = 255;
-        ppm[index + 1] = 255;
-        ppm[index + 2] = 255;
+        image.setPixel(transformedVertices[i][0], transformedVertices[i][1],
+                       VEC3(1.0, 1.0, 1.0));
     }
-    writePPM("1.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image.writePPM("1.ppm");
 }
 
 void partTwo() {
@@ -333,11 +265,11 @@ void partTwo() {
     MATRIX4 compose = mvp;
     vector<VEC3> transformedVertices = transformVertices(vertices, compose);
 
-    float* ppm =
+    Image* image =
         triangleRasterization(transformedVertices, indices, colors, xRes, yRes);
 
-    writePPM("2.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image->writePPM("2.ppm");
+    delete image;
 }
 
 void partThree() {
@@ -363,11 +295,11 @@ void partThree() {
     MATRIX4 compose = mvp * mortho;
     vector<VEC3> transformedVertices = transformVertices(vertices, compose);
 
-    float* ppm =
+    Image* image =
         triangleRasterization(transformedVertices, indices, colors, xRes, yRes);
 
-    writePPM("3.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image->writePPM("3.ppm");
+    delete image;
 }
 
 void partFour() {
@@ -419,11 +351,11 @@ void partFour() {
     //     cout << transformedVertices[i] << endl;
     // }
 
-    float* ppm =
+    Image* image =
         triangleRasterization(transformedVertices, indices, colors, xRes, yRes);
 
-    writePPM("4.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image->writePPM("4.ppm");
+    delete image;
 }
 
 void partFive() {
@@ -484,11 +416,11 @@ void partFive() {
         transformedVertices.push_back(truncate(transformed));
     }
 
-    float* ppm =
+    Image* image =
         triangleRasterization(transformedVertices, indices, colors, xRes, yRes);
 
-    writePPM("5.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image->writePPM("5.ppm");
+    delete image;
 }
 
 void partSix() {
@@ -540,11 +472,11 @@ void partSix() {
         transformedVertices.push_back(truncate(transformed));
     }
 
-    float* ppm =
+    Image* image =
         triangleRasterization(transformedVertices, indices, colors, xRes, yRes);
 
-    writePPM("6.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image->writePPM("6.ppm");
+    delete image;
 }
 
 void partSeven() {
@@ -596,11 +528,11 @@ void partSeven() {
         transformedVertices.push_back(truncate(transformed));
     }
 
-    float* ppm = triangleRasterization(transformedVertices, indices, colors,
-                                       xRes, yRes, false, true);
+    Image* image = triangleRasterization(transformedVertices, indices,
+                                         colors, xRes, yRes, false, true);
 
-    writePPM("7.ppm", xRes, yRes, ppm);
-    delete[] ppm;
+    image->writePPM("7.ppm");
+    delete image;
 }
 
 void partEight(VEC3 eye, VEC3 lookAt, VEC3 up, bool custom) {
@@ -651,16 +583,16 @@ void partEight(VEC3 eye, VEC3 lookAt, VEC3 up, bool custom) {
         transformedVertices.push_back(truncate(transformed));
     }
 
-    float* ppm = triangleRasterization(transformedVertices, indices, colors,
-                                       xRes, yRes, true, true);
+    Image* image = triangleRasterization(transformedVertices, indices,
+                                         colors, xRes, yRes, true, true);
 
     if (custom) {
-        writePPM("custom.ppm", xRes, yRes, ppm);
+        image->writePPM("custom.ppm");
     } else {
-        writePPM("8.ppm", xRes, yRes, ppm);
+        image->writePPM("8.ppm");
     }
 
-    delete[] ppm;
+    delete image;
 }
 
 Real degreesToRadians(Real degrees) { return (degrees)*M_PI / 180.0; }
@@ -761,11 +693,12 @@ MATRIX4 perspectiveProjectionMatrix(Real fovy, Real aspect, Real near, Real far,
 
 // Attribution: Professor Kim's notes and the Tiger textbook (which explains
 // what to do in 3D)
-float* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
+Image* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
                              vector<VEC3> colors, int xRes, int yRes,
                              bool interpolateColors, bool depthBuffering) {
     // first, init an image
-    float* ppm = allocatePPM(xRes, yRes);
+    Image* image = new Image(xRes, yRes);
+    image->fill(VEC3(0.0, 0.0, 0.0));
 
     // calculate areas for each triangle in advance to avoid repeated
     // computation
@@ -830,8 +763,6 @@ float* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
                                          (beta * pointB[2]) +
                                          (gamma * pointC[2]);
 
-                    int index = indexIntoPPM(i, j, xRes, yRes, true);
-
                     if (depthBuffering) {
                         if (interpolatedZ < zBuffer[i][j]) {
                             zBuffer[i][j] = interpolatedZ;
@@ -840,13 +771,9 @@ float* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
                                 VEC3 color = (alpha * colors[triangle[0]]) +
                                              (beta * colors[triangle[1]]) +
                                              (gamma * colors[triangle[2]]);
-                                ppm[index] = color[0] * 255;
-                                ppm[index + 1] = color[1] * 255;
-                                ppm[index + 2] = color[2] * 255;
+                                image->setPixel(i, yRes - 1 - j, color);
                             } else {
-                                ppm[index] = colors[k][0] * 255;
-                                ppm[index + 1] = colors[k][1] * 255;
-                                ppm[index + 2] = colors[k][2] * 255;
+                                image->setPixel(i, yRes - 1 - j, colors[k]);
                             }
                         }
                     } else {
@@ -854,13 +781,9 @@ float* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
                             VEC3 color = (alpha * colors[triangle[0]]) +
                                          (beta * colors[triangle[1]]) +
                                          (gamma * colors[triangle[2]]);
-                            ppm[index] = color[0] * 255;
-                            ppm[index + 1] = color[1] * 255;
-                            ppm[index + 2] = color[2] * 255;
+                            image->setPixel(i, yRes - 1 - j, color);
                         } else {
-                            ppm[index] = colors[k][0] * 255;
-                            ppm[index + 1] = colors[k][1] * 255;
-                            ppm[index + 2] = colors[k][2] * 255;
+                            image->setPixel(i, yRes - 1 - j, colors[k]);
                         }
                     }
                 }
@@ -868,7 +791,7 @@ float* triangleRasterization(vector<VEC3> vertices, vector<VEC3I> indices,
         }
     }
 
-    return ppm;
+    return image;
 }
 
 // debugging routines
@@ -890,39 +813,3 @@ bool betweenZeroAndOneInclusive(Real num) {
     }
     return false;
 }
-
-// PPM routines
-
-int indexIntoPPM(int x, int y, int xRes, int yRes, bool originBottomLeft) {
-    int index = -1;
-
-    if (originBottomLeft) {
-        // bottom left origin
-        int newY = yRes - 1 - y;
-        index = (newY * xRes * 3) + (x * 3);
-
-    } else {
-        // top left origin (default)
-        index = (y * xRes * 3) + (x * 3);
-    }
-
-    return index;
-}
-
-float* allocatePPM(int xRes, int yRes) {
-    float* values = new float[3 * xRes * yRes];
-    if (!values) {
-        cout << "Could not allocate values" << endl;
-        return NULL;
-    }
-    initPPM(values, xRes, yRes);
-    return values;
-}
-
-void initPPM(float* values, int xRes, int yRes) {
-    for (int i = 0; i < xRes * yRes * 3; i += 3) {
-        values[i] = 0;
-        values[i + 1] = 0;
-        values[i + 2] = 0;
-    }
-}
\ No newline at end of file
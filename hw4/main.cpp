@@ -7,6 +7,7 @@
 
 #include "SETTINGS.h"
 #include "animation.hpp"
+#include "image.hpp"
 #include "utilities.hpp"
 
 using namespace std;
@@ -24,6 +25,7 @@ class Light;
 Ray rayGeneration(int pixel_i, int pixel_j, Camera cam);
 
 IntersectResult intersectScene(vector<Shape*> scene, Ray ray, Real tLow);
+Shape* occludeScene(const vector<Shape*>& scene, Ray ray, Real tMax);
 VEC3 rayColor(vector<Shape*> scene, Ray ray, vector<Light*> lights,
               Real phongExponent, bool useLights, bool useMultipleLights,
               bool useSpecular, bool useShadows, bool useMirror,
@@ -31,7 +33,7 @@ VEC3 rayColor(vector<Shape*> scene, Ray ray, vector<Light*> lights,
               bool useFresnel);
 VEC3 lightingEquation(Light* light, IntersectResult intersection,
                       Real phongExponent, Ray ray, bool useSpecular);
-bool isPointInShadow(vector<Shape*> scene, Light* light,
+bool isPointInShadow(const vector<Shape*>& scene, Light* light,
                      IntersectResult intersection);
 
 enum Material { OPAQUE, MIRROR, DIELECTRIC };
@@ -53,6 +55,7 @@ void part_8(Camera cam, vector<Shape*> scene);
 void part_9(Camera cam, vector<Shape*> scene);
 void part_10(Camera cam, vector<Shape*> scene);
 void part_11(Camera cam, vector<Shape*> scene);
+void addWallOfSpheres(vector<Sphere>& wall, vector<Shape*>& scene);
 
 class Camera {
    public:
@@ -222,66 +225,67 @@ class Light {
     VEC3 position;
     VEC3 color;
 
-    Light(VEC3 position, VEC3 color) : position(position), color(color) {}
+    // the shape that blocked the last shadow ray towards this light.
+    // neighbouring pixels are usually blocked by the same one
+    Shape* lastOccluder;
+
+    Light(VEC3 position, VEC3 color)
+        : position(position), color(color), lastOccluder(NULL) {}
 };
 
 // * ray generation maps
 void part_1(Camera cam, vector<Shape*> scene) {
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image xMap(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
             Ray ray = rayGeneration(i, j, cam);
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            writeColorToPPM(VEC3(ray.direction[0], 0.0, 0.0), ppm, index);
+            xMap.setPixel(i, cam.yRes - 1 - j,
+                          VEC3(ray.direction[0], 0.0, 0.0));
         }
     }
     // write out to image
-    writePPM("1x.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    xMap.writePPM("1x.ppm");
 
     // create a ray map
-    ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image xAbsMap(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
             Ray ray = rayGeneration(i, j, cam);
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            writeColorToPPM(VEC3(abs(ray.direction[0]), 0.0, 0.0), ppm, index);
+            xAbsMap.setPixel(i, cam.yRes - 1 - j,
+                             VEC3(abs(ray.direction[0]), 0.0, 0.0));
         }
     }
     // write out to image
-    writePPM("1xabs.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    xAbsMap.writePPM("1xabs.ppm");
 
     // create a ray map
-    ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image yMap(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
             Ray ray = rayGeneration(i, j, cam);
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            writeColorToPPM(VEC3(0.0, ray.direction[1], 0.0), ppm, index);
+            yMap.setPixel(i, cam.yRes - 1 - j,
+                          VEC3(0.0, ray.direction[1], 0.0));
         }
     }
     // write out to image
-    writePPM("1y.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    yMap.writePPM("1y.ppm");
 
     // create a ray map
-    ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image yAbsMap(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
             Ray ray = rayGeneration(i, j, cam);
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            writeColorToPPM(VEC3(0.0, abs(ray.direction[1]), 0.0), ppm, index);
+            yAbsMap.setPixel(i, cam.yRes - 1 - j,
+                             VEC3(0.0, abs(ray.direction[1]), 0.0));
         }
     }
     // write out to image
-    writePPM("1yabs.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    yAbsMap.writePPM("1yabs.ppm");
 }
 
 // * intersection of scene
@@ -289,7 +293,7 @@ void part_2(Camera cam, vector<Shape*> scene) {
     // no lights
     vector<Light*> lights;
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -298,15 +302,11 @@ void part_2(Camera cam, vector<Shape*> scene) {
             VEC3 color = rayColor(scene, ray, lights, 10.0, false, false, false,
                                   false, false, 0, false, false);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("2.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("2.ppm");
 }
 
 // * diffuse shading
@@ -328,7 +328,7 @@ void part_3(Camera cam, vector<Shape*> scene) {
     bool useFresnel = false;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -339,15 +339,11 @@ void part_3(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("3.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("3.ppm");
 }
 
 // * multiple lights
@@ -369,7 +365,7 @@ void part_4(Camera cam, vector<Shape*> scene) {
     bool useFresnel = false;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -380,15 +376,11 @@ void part_4(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("4.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("4.ppm");
 }
 
 // * specular reflections
@@ -410,7 +402,7 @@ void part_5(Camera cam, vector<Shape*> scene) {
     bool useFresnel = false;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -421,15 +413,11 @@ void part_5(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("5.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("5.ppm");
 }
 
 // * shadows
@@ -451,7 +439,7 @@ void part_6(Camera cam, vector<Shape*> scene) {
     bool useFresnel = false;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -462,15 +450,11 @@ void part_6(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("6.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("6.ppm");
 }
 
 // * mirror reflections
@@ -478,17 +462,7 @@ void part_7(Camera cam, vector<Shape*> scene) {
     // modify the scene and add the wall of spheres
     vector<Shape*> sceneCopy = scene;
     vector<Sphere> wallOfSpheres;
-
-    for (int i = -20; i < 20; i += 2) {
-        for (int j = -2; j < 18; j += 2) {
-            wallOfSpheres.push_back(Sphere(1.0, VEC3((Real)i, (Real)j, 20.0),
-                                           VEC3(1.0, 1.0, 1.0), OPAQUE, 0.0));
-        }
-    }
-
-    for (int i = 0; i < wallOfSpheres.size(); i++) {
-        sceneCopy.push_back(&(wallOfSpheres[i]));
-    }
+    addWallOfSpheres(wallOfSpheres, sceneCopy);
 
     // make the first sphere black and a mirror
     sceneCopy[0]->type = MIRROR;
@@ -511,7 +485,7 @@ void part_7(Camera cam, vector<Shape*> scene) {
     bool useFresnel = false;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -524,15 +498,11 @@ void part_7(Camera cam, vector<Shape*> scene) {
                          reflectionRecursionCounter, useRefraction, useFresnel);
 
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("7.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("7.ppm");
 }
 
 // * refractions
@@ -540,17 +510,7 @@ void part_8(Camera cam, vector<Shape*> scene) {
     // modify the scene and add the wall of spheres
     vector<Shape*> sceneCopy = scene;
     vector<Sphere> wallOfSpheres;
-
-    for (int i = -20; i < 20; i += 2) {
-        for (int j = -2; j < 18; j += 2) {
-            wallOfSpheres.push_back(Sphere(1.0, VEC3((Real)i, (Real)j, 20.0),
-                                           VEC3(1.0, 1.0, 1.0), OPAQUE, 0.0));
-        }
-    }
-
-    for (int i = 0; i < wallOfSpheres.size(); i++) {
-        sceneCopy.push_back(&(wallOfSpheres[i]));
-    }
+    addWallOfSpheres(wallOfSpheres, sceneCopy);
 
     // make the first sphere black, and glass
     sceneCopy[0]->color = VEC3(0.0, 0.0, 0.0);
@@ -574,7 +534,7 @@ void part_8(Camera cam, vector<Shape*> scene) {
     bool useFresnel = false;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -585,15 +545,11 @@ void part_8(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("8.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("8.ppm");
 }
 
 // * fresnel effect
@@ -601,17 +557,7 @@ void part_9(Camera cam, vector<Shape*> scene) {
     // modify the scene and add the wall of spheres
     vector<Shape*> sceneCopy = scene;
     vector<Sphere> wallOfSpheres;
-
-    for (int i = -20; i < 20; i += 2) {
-        for (int j = -2; j < 18; j += 2) {
-            wallOfSpheres.push_back(Sphere(1.0, VEC3((Real)i, (Real)j, 20.0),
-                                           VEC3(1.0, 1.0, 1.0), OPAQUE, 0.0));
-        }
-    }
-
-    for (int i = 0; i < wallOfSpheres.size(); i++) {
-        sceneCopy.push_back(&(wallOfSpheres[i]));
-    }
+    addWallOfSpheres(wallOfSpheres, sceneCopy);
 
     // make the first sphere black, and glass
     sceneCopy[0]->color = VEC3(0.0, 0.0, 0.0);
@@ -635,7 +581,7 @@ void part_9(Camera cam, vector<Shape*> scene) {
     bool useFresnel = true;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -646,15 +592,11 @@ void part_9(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("9.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("9.ppm");
 }
 
 // * triangle intersection
@@ -666,17 +608,7 @@ void part_10(Camera cam, vector<Shape*> scene) {
     sceneCopy.erase(sceneCopy.begin() + 1);
 
     vector<Sphere> wallOfSpheres;
-
-    for (int i = -20; i < 20; i += 2) {
-        for (int j = -2; j < 18; j += 2) {
-            wallOfSpheres.push_back(Sphere(1.0, VEC3((Real)i, (Real)j, 20.0),
-                                           VEC3(1.0, 1.0, 1.0), OPAQUE, 0.0));
-        }
-    }
-
-    for (int i = 0; i < wallOfSpheres.size(); i++) {
-        sceneCopy.push_back(&(wallOfSpheres[i]));
-    }
+    addWallOfSpheres(wallOfSpheres, sceneCopy);
 
     // make the first sphere black, and glass
     sceneCopy[0]->color = VEC3(0.0, 0.0, 0.0);
@@ -728,7 +660,7 @@ void part_10(Camera cam, vector<Shape*> scene) {
     bool useFresnel = true;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -739,15 +671,11 @@ void part_10(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("10.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("10.ppm");
 }
 
 // * triangles are mirrors
@@ -759,17 +687,7 @@ void part_11(Camera cam, vector<Shape*> scene) {
     sceneCopy.erase(sceneCopy.begin() + 1);
 
     vector<Sphere> wallOfSpheres;
-
-    for (int i = -20; i < 20; i += 2) {
-        for (int j = -2; j < 18; j += 2) {
-            wallOfSpheres.push_back(Sphere(1.0, VEC3((Real)i, (Real)j, 20.0),
-                                           VEC3(1.0, 1.0, 1.0), OPAQUE, 0.0));
-        }
-    }
-
-    for (int i = 0; i < wallOfSpheres.size(); i++) {
-        sceneCopy.push_back(&(wallOfSpheres[i]));
-    }
+    addWallOfSpheres(wallOfSpheres, sceneCopy);
 
     // make the first sphere black, and glass
     sceneCopy[0]->color = VEC3(0.0, 0.0, 0.0);
@@ -821,7 +739,7 @@ void part_11(Camera cam, vector<Shape*> scene) {
     bool useFresnel = true;
 
     // create a ray map
-    float* ppm = allocatePPM(cam.xRes, cam.yRes);
+    Image image(cam.xRes, cam.yRes);
     for (int i = 0; i < cam.xRes; i++) {
         for (int j = 0; j < cam.yRes; j++) {
             // generate the ray
@@ -832,15 +750,26 @@ void part_11(Camera cam, vector<Shape*> scene) {
                          useMultipleLights, useSpecular, useShadows, useMirror,
                          reflectionRecursionCounter, useRefraction, useFresnel);
             // color the pixel
-            int index = indexIntoPPM(i, j, cam.xRes, cam.yRes, true);
-            ppm[index] = color[0] * 255.0;
-            ppm[index + 1] = color[1] * 255.0;
-            ppm[index + 2] = color[2] * 255.0;
+            image.setPixel(i, cam.yRes - 1 - j, color);
         }
     }
     // write out to image
-    writePPM("11.ppm", cam.xRes, cam.yRes, ppm);
-    delete[] ppm;
+    image.writePPM("11.ppm");
+}
+
+// the wall of 20 x 10 spheres behind the scene. the spheres are added to
+// the scene, but wall owns them
+void addWallOfSpheres(vector<Sphere>& wall, vector<Shape*>& scene) {
+    for (int i = -20; i < 20; i += 2) {
+        for (int j = -2; j < 18; j += 2) {
+            wall.push_back(Sphere(1.0, VEC3((Real)i, (Real)j, 20.0),
+                                  VEC3(1.0, 1.0, 1.0), OPAQUE, 0.0));
+        }
+    }
+
+    for (unsigned int i = 0; i < wall.size(); i++) {
+        scene.push_back(&(wall[i]));
+    }
 }
 
 int main(int argc, char** argv) {
@@ -966,20 +895,31 @@ VEC3 rayColor(vector<Shape*> scene, Ray ray, vector<Light*> lights,
     return clampVec3(color, 0.0, 1.0);
 }
 
-bool isPointInShadow(vector<Shape*> scene, Light* light,
+bool isPointInShadow(const vector<Shape*>& scene, Light* light,
                      IntersectResult intersection) {
     // adjust to avoid shadow acne problem
     VEC3 adjustedIntersectionPoint =
         intersection.intersectionPoint + (CUSTOM_EPSILON * intersection.normal);
     // generate shadow ray towards the light
     VEC3 shadowDirection = (light->position - adjustedIntersectionPoint);
-    shadowDirection /= shadowDirection.norm();
+    Real lightDistance = shadowDirection.norm();
+    shadowDirection /= lightDistance;
     Ray shadowRay(adjustedIntersectionPoint, shadowDirection);
-    // see if it intersects anything
-    IntersectResult shadowIntersect = intersectScene(scene, shadowRay, 0.0);
-    if (shadowIntersect.doesIntersect) {
+    // try whatever blocked this light last time first
+    if (light->lastOccluder != NULL) {
+        IntersectResult result = light->lastOccluder->intersect(shadowRay);
+        if (result.doesIntersect && result.t >= 0.0 &&
+            result.t < lightDistance) {
+            return true;
+        }
+    }
+    // see if anything between here and the light blocks it
+    Shape* occluder = occludeScene(scene, shadowRay, lightDistance);
+    if (occluder != NULL) {
+        light->lastOccluder = occluder;
         return true;
     }
+    return false;
 }
 
 Ray createReflectionRay(IntersectResult intersection, Ray ray) {
@@ -1151,6 +1091,18 @@ IntersectResult intersectScene(vector<Shape*> scene, Ray ray, Real tLow) {
     return closestValidIntersection;
 }
 
+// any-hit version of intersectScene for shadow rays: returns the first
+// shape hit in [0, tMax) without looking for a closer one, or NULL
+Shape* occludeScene(const vector<Shape*>& scene, Ray ray, Real tMax) {
+    for (unsigned int i = 0; i < scene.size(); i++) {
+        IntersectResult result = scene[i]->intersect(ray);
+        if (result.doesIntersect && result.t >= 0.0 && result.t < tMax) {
+            return scene[i];
+        }
+    }
+    return NULL;
+}
+
 Ray rayGeneration(int pixel_i, int pixel_j, Camera cam) {
     // construct an eye coordinate frame
     VEC3 gaze = cam.lookAt - cam.eye;
@@ -2,11 +2,17 @@
 // This is just a nice interface on Andrew Selle's code:
 // http://physbam.stanford.edu/~aselle/code/make_quicktime.cpp
 //
-// To use, call "addLuminanceFrame" for each frame of your movie
-// (it will set dimensions based on the first frame passed in)
-// and "writeMovie" to write the MOV out when you're done.
+// To use, make one with the name of the movie file, call "addFrame"
+// or "addLuminanceFrame" for each frame of your movie (it will set
+// dimensions based on the first frame passed in) and "writeMovie" to
+// finish the MOV off when you're done.
 //
-// Or, to grab a frame from GL, call "addFrameGL"
+// Frames are JPEG compressed on a few worker threads at once, each into
+// its own buffer in memory, and appended to the file in order as soon as
+// all the ones before them are in. Only a handful of frames are ever in
+// flight and only the compressed size of every frame is kept around, so
+// memory doesn't grow with the length of the movie. Past 4GB the chunk
+// offsets switch to 64 bits (co64 instead of stco).
 ///////////////////////////////////////////////////////////////////////
 
 #ifndef QUICKTIME_MOVIE_H
@@ -14,9 +20,18 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <cassert>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include <sys/types.h>
 #include <jpeglib.h>
 
 #ifdef __linux__
@@ -30,27 +45,130 @@ typedef unsigned short ushort;
 class QT_ATOM
 {
     FILE *fp;
-    long start_offset;
+    off_t start_offset;
     //const char* type;
 public:
     QT_ATOM(FILE* fp,const char* type)
         :fp(fp)//,type(type)
     {
-        start_offset=ftell(fp);
-        uint dummy;
+        start_offset=ftello(fp);
+        uint dummy=0;
         fwrite(&dummy,4,1,fp);
         fputs(type,fp);
     }
 
     ~QT_ATOM()
     {
-        uint atom_size=ftell(fp)-start_offset;
+        uint atom_size=ftello(fp)-start_offset;
         uint atom_size_endian=htonl(atom_size);
-        fseek(fp,start_offset,SEEK_SET);
+        fseeko(fp,start_offset,SEEK_SET);
         fwrite(&atom_size_endian,4,1,fp);
-        fseek(fp,0,SEEK_END);
+        fseeko(fp,0,SEEK_END);
+    }
+
+};
+
+//////////////////////////////////////////////////////////////////////////
+// A JPEG compressor that writes into memory instead of a file. It can be
+// used for any number of images, so libjpeg is only set up once rather
+// than once per frame.
+//////////////////////////////////////////////////////////////////////////
+class JPEG_COMPRESSOR
+{
+public:
+  JPEG_COMPRESSOR(int quality = 95)
+  {
+    _quality = quality;
+    _width = -1;
+    _height = -1;
+
+    _cinfo.err = jpeg_std_error(&_jerr);
+    jpeg_create_compress(&_cinfo);
+    _destination.manager.init_destination = initDestination;
+    _destination.manager.empty_output_buffer = emptyOutputBuffer;
+    _destination.manager.term_destination = termDestination;
+    _destination.output = NULL;
+    _cinfo.dest = &_destination.manager;
+  }
+
+  ~JPEG_COMPRESSOR()
+  {
+    jpeg_destroy_compress(&_cinfo);
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // compress rows of RGB from the top down. output is overwritten with
+  // the JPEG, and keeps its capacity from one call to the next
+  ////////////////////////////////////////////////////////////////////////
+  void compress(const unsigned char* image, int width, int height, std::vector<unsigned char>& output)
+  {
+    if (width != _width || height != _height)
+    {
+      _width = width;
+      _height = height;
+
+      _cinfo.image_width=width;
+      _cinfo.image_height=height;
+      _cinfo.input_components=3;
+      _cinfo.in_color_space=JCS_RGB;
+      jpeg_set_defaults(&_cinfo);
+      jpeg_set_quality(&_cinfo,_quality,TRUE);
+    }
+
+    _destination.output = &output;
+    jpeg_start_compress(&_cinfo,TRUE);
+
+    // libjpeg only reads the rows, so they go straight in
+    while (_cinfo.next_scanline < _cinfo.image_height)
+    {
+      JSAMPROW row_pointer[]={(JSAMPLE*)image + _cinfo.next_scanline * (3 * width)};
+      jpeg_write_scanlines(&_cinfo,row_pointer,1);
     }
+    jpeg_finish_compress(&_cinfo);
+    _destination.output = NULL;
+  }
+
+private:
+  int _quality;
+  int _width;
+  int _height;
+
+  struct jpeg_compress_struct _cinfo;
+  struct jpeg_error_mgr _jerr;
+
+  // libjpeg hands the manager back to the callbacks, and the buffer it
+  // should fill sits right behind it
+  struct DESTINATION
+  {
+    struct jpeg_destination_mgr manager;
+    std::vector<unsigned char>* output;
+  };
+  DESTINATION _destination;
+
+  static void initDestination(j_compress_ptr cinfo)
+  {
+    std::vector<unsigned char>& output = *((DESTINATION*)cinfo->dest)->output;
+    output.resize(std::max(output.capacity(), (size_t)65536));
+    cinfo->dest->next_output_byte = &output[0];
+    cinfo->dest->free_in_buffer = output.size();
+  }
 
+  // the buffer is full, so double it and carry on past the old end
+  static boolean emptyOutputBuffer(j_compress_ptr cinfo)
+  {
+    std::vector<unsigned char>& output = *((DESTINATION*)cinfo->dest)->output;
+    size_t used = output.size();
+    output.resize(2 * used);
+    cinfo->dest->next_output_byte = &output[used];
+    cinfo->dest->free_in_buffer = output.size() - used;
+    return TRUE;
+  }
+
+  static void termDestination(j_compress_ptr cinfo)
+  {
+    std::vector<unsigned char>& output = *((DESTINATION*)cinfo->dest)->output;
+    output.resize(output.size() - cinfo->dest->free_in_buffer);
+  }
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -58,34 +176,71 @@ public:
 class QUICKTIME_MOVIE {
 
 public:  
-  QUICKTIME_MOVIE() {
+  ////////////////////////////////////////////////////////////////////////
+  // threads <= 0 means one compressor thread per hardware core
+  ////////////////////////////////////////////////////////////////////////
+  QUICKTIME_MOVIE(const char* filename, int framesPerSecond = 30, int threads = 0) {
     _width = -1;
     _height = -1;
     _totalFrames = 0;
+    _framesPerSecond = framesPerSecond;
+    _filename = filename;
+    _mdatEnd = MDAT_DATA_START;
+    _framesAdded = 0;
+    _framesInFlight = 0;
+    _stopping = false;
+
+    unsigned char EndianTest[2]={0,1};
+    big_endian=*(short*)EndianTest==1;
+
+    _fp = fopen(filename, "wb");
+    if (_fp == NULL)
+    {
+      std::cout << " Couldn't open file " << filename << "! " << std::endl;
+      return;
+    }
+
+    // the frames go into mdat as they come in, and its size is filled in
+    // at the end. it starts out as a 32-bit atom behind an 8-byte "wide"
+    // atom, which it takes over for a 64-bit size if it grows past 4GB
+    Write(_fp,(uint)8);
+    fputs("wide",_fp);
+    Write(_fp,(uint)0);
+    fputs("mdat",_fp);
+
+    // two frames per thread keeps every thread busy while one frame
+    // waits to be written behind a slower one
+    if (threads <= 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    _maxFramesInFlight = 2 * threads;
+    for (int x = 0; x < threads; x++)
+      _workers.push_back(std::thread(&QUICKTIME_MOVIE::compressFrames, this));
   };
 
   ~QUICKTIME_MOVIE() {
-    for (unsigned int x = 0; x < _frameRows.size(); x++)
-      delete[] _frameRows[x];
+    writeMovie();
+    for (unsigned int x = 0; x < _spareFrames.size(); x++)
+      delete _spareFrames[x];
   };
 
+  ////////////////////////////////////////////////////////////////////////
+  // the frames are numbered in the order they're added, so they should
+  // be added from one thread at a time. both calls copy the image and
+  // return as soon as there's room for another frame in flight
+  ////////////////////////////////////////////////////////////////////////
+
   ////////////////////////////////////////////////////////////////////////
   // add a new frame to the movie, assuming it is luminance, [0,1]
   ////////////////////////////////////////////////////////////////////////
   void addLuminanceFrame(const float* image, const int& width, const int& height) 
   {
-    if (_width == -1 && _height == -1)
-    {
-      _width = width;
-      _height = height;
-    }
-    assert(width == _width);
-    assert(height == _height);
+    FRAME* frame = startFrame(width, height);
+    if (frame == NULL)
+      return;
 
     for (int y = 0; y < _height; y++)
     {
-      JSAMPLE* row = new JSAMPLE[3 * _width];
-
+      unsigned char* row = &frame->pixels[3 * y * _width];
       for (int x = 0; x < _width; x++)
       {
         float sample = image[x + y * _width];
@@ -97,108 +252,56 @@ public:
         row[3 * x + 1] = scaled;
         row[3 * x + 2] = scaled;
       }
-
-      _frameRows.push_back(row);
     }
-    _totalFrames++;
+    queueFrame(frame);
   };
 
   ////////////////////////////////////////////////////////////////////////
-  // Add a frame to the movie
+  // Add a frame to the movie, as rows of RGB from the top down
   ////////////////////////////////////////////////////////////////////////
   void addFrame(const unsigned char* image, const int& width, const int& height) 
   {
-    // store the screen dimensions
-    if (_width == -1 && _height == -1)
-    {
-      _width = width;
-      _height = height;
-    }
-    assert(width == _width);
-    assert(height == _height);
-    for (int y = 0; y < _height; y++)
-    {
-      JSAMPLE* row = new JSAMPLE[3 * _width];
-
-      // invert y, because of pixel ordering
-      for (int x = 0; x < _width * 3; x++)
-        //row[x] = image[x + (height - 1 - y) * (3 * _width)];
-        row[x] = image[x + y * (3 * _width)];
+    FRAME* frame = startFrame(width, height);
+    if (frame == NULL)
+      return;
 
-      _frameRows.push_back(row);
-    }
-    _totalFrames++;
+    memcpy(&frame->pixels[0], image, frame->pixels.size());
+    queueFrame(frame);
   }
 
   ////////////////////////////////////////////////////////////////////////
-  // dump out the final movie
+  // finish off the movie: the header goes after the frames, and the
+  // file is closed. the destructor calls this too
   ////////////////////////////////////////////////////////////////////////
-  void writeMovie(const char* filename)
+  void writeMovie()
   {
-    std::cout << " Writing movie " << filename << "..."; flush(std::cout);
-    unsigned char EndianTest[2]={0,1};
-    big_endian=*(short*)EndianTest==1;
-    //std::cout<<"big endian is "<<big_endian<<std::endl;
-
-    FILE *fp=fopen(filename,"w");
-
-    const int frames_per_second=30;
+    if (_fp == NULL)
+      return;
+    finishFrames();
+    std::cout << " Writing movie " << _filename << "..."; flush(std::cout);
 
+    FILE* fp = _fp;
+    const int frames_per_second = _framesPerSecond;
     const int frames = _totalFrames;
     const int width = _width;
     const int height = _height;
 
-    std::vector<int> samplesizes;
-    std::vector<int> offsets;
-
-    // Write the samples (i.e. the mdat part in the quicktime)
-    {long mdat_begin=ftell(fp);
-    QT_ATOM mdat(fp,"mdat");
-
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr jerr;
-     
-        // this is where image data is set
-        int currentFrameRow = 0;
-        for(int i = 0; i < frames; i++){
-          long initial_pos=ftell(fp);
-          offsets.push_back(initial_pos-mdat_begin);
-          cinfo.err=jpeg_std_error(&jerr);
-
-          jpeg_create_compress(&cinfo);
-          jpeg_stdio_dest(&cinfo,fp);
-          
-          cinfo.image_width=width;
-          cinfo.image_height=height;
-          cinfo.input_components=3;
-          cinfo.in_color_space=JCS_RGB;
-          jpeg_set_defaults(&cinfo);
-
-          jpeg_set_quality(&cinfo,95,TRUE);
-          jpeg_start_compress(&cinfo,TRUE);
-          
-          //int row_stride = cinfo.image_width * 3;
-          //JSAMPLE* row = new JSAMPLE[row_stride];
-          //unsigned char rowi=i;
-          while(cinfo.next_scanline < cinfo.image_height)
-          {
-            JSAMPROW row_pointer[]={_frameRows[currentFrameRow]};
-            /*
-            int j;
-            for(j = 0; j < row_stride; j++) 
-              row[j] = rowi;
-            rowi = (rowi+1) % 256;
-            */
-            jpeg_write_scanlines(&cinfo,row_pointer,1);
-            currentFrameRow++;
-          }
-          jpeg_finish_compress(&cinfo);
-          jpeg_destroy_compress(&cinfo);
-          samplesizes.push_back(ftell(fp)-initial_pos);
-        }
+    // now that the size of mdat is known, fill it in
+    if (_mdatEnd - 8 > 0xffffffffLL)
+    {
+      fseeko(fp, 0, SEEK_SET);
+      Write(fp,(uint)1); // the size is in the 64 bits after the type
+      fputs("mdat",fp);
+      Write(fp,(unsigned long long)_mdatEnd);
+    }
+    else
+    {
+      fseeko(fp, 8, SEEK_SET);
+      Write(fp,(uint)(_mdatEnd - 8));
     }
+    fseeko(fp, 0, SEEK_END);
 
-    // Write the header
+    // Write the header after the frames
     {QT_ATOM a(fp,"moov");
         {QT_ATOM a(fp,"mvhd");
             char c=0;
@@ -324,12 +427,24 @@ public:
                       Write(fp,(uint)0); // version and flags
                       Write(fp,(uint)0); // sample size (non-uniform so zero and table follows)
                       Write(fp,(uint)frames); // one entry per frame
-                      for(unsigned int i=0;i<samplesizes.size();i++)  Write(fp,(uint)samplesizes[i]);
+                      for(unsigned int i=0;i<_sampleSizes.size();i++)  Write(fp,(uint)_sampleSizes[i]);
                     }
-                    {QT_ATOM a(fp,"stco");
+                    // the frames follow each other in mdat, so the offsets
+                    // are a running sum of the sizes. past 4GB they need
+                    // 64 bits
+                    const bool wideOffsets = _mdatEnd > 0xffffffffLL;
+                    {QT_ATOM a(fp,wideOffsets ? "co64" : "stco");
                       Write(fp,(uint)0); // version and flags
                       Write(fp,(uint)frames); // one entry per frame
-                      for(unsigned int i=0;i<samplesizes.size();i++)  Write(fp,(uint)offsets[i]); // offset from begin of file
+                      long long offset = MDAT_DATA_START;
+                      for(unsigned int i=0;i<_sampleSizes.size();i++)
+                      {
+                        if (wideOffsets)
+                          Write(fp,(unsigned long long)offset); // offset from begin of file
+                        else
+                          Write(fp,(uint)offset); // offset from begin of file
+                        offset += _sampleSizes[i];
+                      }
                     }
                   }
                 }
@@ -337,18 +452,166 @@ public:
         }
     }
     fclose(fp);
+    _fp = NULL;
     std::cout << " done." << std::endl;
   }
 
 private:
+  // the frames start after the "wide" atom and the mdat header
+  static const long long MDAT_DATA_START = 16;
+
   // video dimensions
   int _width;
   int _height;
-  std::vector<JSAMPLE*> _frameRows;
   int _totalFrames;
+  int _framesPerSecond;
+
+  std::string _filename;
+  FILE* _fp;
+
+  // compressed size of every frame so far, and where the next one goes
+  std::vector<uint> _sampleSizes;
+  long long _mdatEnd;
+
+  // a frame on its way through, first as RGB and then as a JPEG. they
+  // get reused, so the buffers stop being reallocated after a few frames
+  struct FRAME
+  {
+    int index;
+    std::vector<unsigned char> pixels;
+    std::vector<unsigned char> jpeg;
+  };
+
+  // frames waiting for a compressor, compressed frames waiting for the
+  // ones before them, and frames that are done with. _totalFrames is the
+  // index of the next frame to go into the file
+  std::vector<std::thread> _workers;
+  std::mutex _lock;
+  std::condition_variable _frameQueued;
+  std::condition_variable _frameWritten;
+  std::deque<FRAME*> _queued;
+  std::map<int, FRAME*> _compressed;
+  std::vector<FRAME*> _spareFrames;
+  int _framesAdded;
+  int _framesInFlight;
+  int _maxFramesInFlight;
+  bool _stopping;
 
   bool big_endian;
 
+  ////////////////////////////////////////////////////////////////////////
+  // get a frame to fill in, once there's room for one. the first frame
+  // sets the dimensions, and the rest have to match
+  ////////////////////////////////////////////////////////////////////////
+  FRAME* startFrame(const int& width, const int& height)
+  {
+    if (_fp == NULL)
+      return NULL;
+
+    if (_width == -1 && _height == -1)
+    {
+      _width = width;
+      _height = height;
+    }
+    assert(width == _width);
+    assert(height == _height);
+
+    FRAME* frame;
+    {
+      std::unique_lock<std::mutex> lock(_lock);
+      while (_framesInFlight >= _maxFramesInFlight)
+        _frameWritten.wait(lock);
+      _framesInFlight++;
+
+      if (_spareFrames.empty())
+        frame = new FRAME;
+      else
+      {
+        frame = _spareFrames.back();
+        _spareFrames.pop_back();
+      }
+      frame->index = _framesAdded++;
+    }
+    frame->pixels.resize(3 * _width * _height);
+    return frame;
+  }
+
+  void queueFrame(FRAME* frame)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _queued.push_back(frame);
+    _frameQueued.notify_one();
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // what each worker thread runs, with its own compressor for its whole
+  // life. the compressing happens outside the lock, and the writing
+  // inside it, but a frame takes far longer to compress than to append
+  ////////////////////////////////////////////////////////////////////////
+  void compressFrames()
+  {
+    JPEG_COMPRESSOR compressor;
+    std::unique_lock<std::mutex> lock(_lock);
+    while (true)
+    {
+      while (!_stopping && _queued.empty())
+        _frameQueued.wait(lock);
+      if (_queued.empty())
+        return;
+
+      FRAME* frame = _queued.front();
+      _queued.pop_front();
+      lock.unlock();
+      compressor.compress(&frame->pixels[0], _width, _height, frame->jpeg);
+      lock.lock();
+
+      _compressed[frame->index] = frame;
+      writeCompressedFrames();
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // append every compressed frame that's next in line to mdat. called
+  // with the lock held
+  ////////////////////////////////////////////////////////////////////////
+  void writeCompressedFrames()
+  {
+    bool wroteAny = false;
+    while (!_compressed.empty() && _compressed.begin()->first == _totalFrames)
+    {
+      FRAME* frame = _compressed.begin()->second;
+      _compressed.erase(_compressed.begin());
+
+      fwrite(&frame->jpeg[0], 1, frame->jpeg.size(), _fp);
+      _sampleSizes.push_back((uint)frame->jpeg.size());
+      _mdatEnd += frame->jpeg.size();
+      _totalFrames++;
+
+      _spareFrames.push_back(frame);
+      _framesInFlight--;
+      wroteAny = true;
+    }
+    if (wroteAny)
+      _frameWritten.notify_all();
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // wait for every frame to be written, then stop the workers
+  ////////////////////////////////////////////////////////////////////////
+  void finishFrames()
+  {
+    {
+      std::unique_lock<std::mutex> lock(_lock);
+      while (_framesInFlight > 0)
+        _frameWritten.wait(lock);
+      _stopping = true;
+      _frameQueued.notify_all();
+    }
+    for (unsigned int x = 0; x < _workers.size(); x++)
+      _workers[x].join();
+    _workers.clear();
+  }
+
   template<class T>
   inline void Swap_Endianity(T& x)
   { 
@@ -378,6 +641,12 @@ private:
     fwrite(&num,sizeof(num),1,fp);
   }
 
+  void Write(FILE* fp, unsigned long long num)
+  {
+    Swap_Endianity(num);
+    fwrite(&num,sizeof(num),1,fp);
+  }
+
   void Write_Identity_Matrix(FILE* fp)
   {
     Write(fp,(uint)0x10000);Write(fp,(uint)0x00000);Write(fp,(uint)0); // 16.16 fixed pt
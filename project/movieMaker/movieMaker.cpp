@@ -54,7 +54,9 @@ bool readPPM(const char* filename, unsigned char*& pixels, int& width, int& heig
 //////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv)
 {
-  QUICKTIME_MOVIE movie;
+  // frames are compressed on other threads while the next ones are
+  // read, and only a few are ever in memory at once
+  QUICKTIME_MOVIE movie("movie.mov");
 
   bool readSuccess = true;
   int frameNumber = 0;
@@ -77,8 +79,8 @@ int main(int argc, char** argv)
     frameNumber++;
   }
 
-  // write out the compiled movie
-  movie.writeMovie("movie.mov");
+  // finish off the movie
+  movie.writeMovie();
 
   return 0;
 }
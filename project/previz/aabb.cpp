@@ -0,0 +1,43 @@
+#include "aabb.hpp"
+
+using namespace std;
+
+AABB::AABB()
+    : min(VEC3(INFINITY, INFINITY, INFINITY)),
+      max(VEC3(-INFINITY, -INFINITY, -INFINITY)) {}
+
+AABB::AABB(VEC3 min, VEC3 max) : min(min), max(max) {}
+
+void AABB::expand(const VEC3& point) {
+    min = min.cwiseMin(point);
+    max = max.cwiseMax(point);
+}
+
+void AABB::expand(const AABB& box) {
+    min = min.cwiseMin(box.min);
+    max = max.cwiseMax(box.max);
+}
+
+bool AABB::isEmpty() const {
+    return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+}
+
+VEC3 AABB::centroid() const { return (min + max) * 0.5; }
+
+VEC3 AABB::extent() const { return max - min; }
+
+Real AABB::halfArea() const {
+    if (isEmpty()) {
+        return 0.0;
+    }
+    VEC3 e = extent();
+    return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+}
+
+int AABB::largestAxis() const {
+    VEC3 e = extent();
+    if (e[0] > e[1] && e[0] > e[2]) {
+        return 0;
+    }
+    return (e[1] > e[2]) ? 1 : 2;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "SETTINGS.h"
+
+using namespace std;
+
+// axis-aligned bounding box, used by the acceleration structures
+class AABB {
+   public:
+    VEC3 min;
+    VEC3 max;
+
+    // empty box (min > max, so any expand() overwrites it)
+    AABB();
+
+    AABB(VEC3 min, VEC3 max);
+
+    // grow the box to contain a point or another box
+    void expand(const VEC3& point);
+    void expand(const AABB& box);
+
+    bool isEmpty() const;
+
+    VEC3 centroid() const;
+    VEC3 extent() const;
+
+    // half the surface area is all the SAH needs, since only ratios matter
+    Real halfArea() const;
+
+    // index of the longest axis
+    int largestAxis() const;
+
+    // slab test against a ray given as origin and 1/direction. returns the
+    // entry distance in tNear when the ray overlaps [tLow, tHigh]
+    inline bool intersect(const VEC3& origin, const VEC3& invDirection,
+                          Real tLow, Real tHigh, Real& tNear) const {
+        for (int axis = 0; axis < 3; axis++) {
+            Real t0 = (min[axis] - origin[axis]) * invDirection[axis];
+            Real t1 = (max[axis] - origin[axis]) * invDirection[axis];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            // written so that a NaN (0 * inf) leaves the interval untouched
+            tLow = t0 > tLow ? t0 : tLow;
+            tHigh = t1 < tHigh ? t1 : tHigh;
+            if (tLow > tHigh) {
+                return false;
+            }
+        }
+        tNear = tLow;
+        return true;
+    }
+};
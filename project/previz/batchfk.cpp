@@ -0,0 +1,113 @@
+#include "batchfk.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_FK_X86 1
+#endif
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////
+// The kernel is compiled once per instruction set, as in packet.cpp. It's
+// plain loops over the lanes rather than intrinsics, so the baseline copy
+// builds anywhere, and the AVX2 and AVX-512 copies only differ in how wide
+// the compiler is told it can go.
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace baseline {
+static const int LANES = 2;
+#include "batchfk_kernel.inl"
+}  // namespace baseline
+
+#ifdef BATCH_FK_X86
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+static const int LANES = 4;
+#include "batchfk_kernel.inl"
+}  // namespace avx2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,prefer-vector-width=512")
+namespace avx512 {
+static const int LANES = 8;
+#include "batchfk_kernel.inl"
+}  // namespace avx512
+#pragma GCC pop_options
+
+#endif
+
+BatchFK::BatchFK(Skeleton* skeleton) : skeleton(skeleton) {
+    FlattenSkeleton(skeleton, order);
+    bones = skeleton->numBonesInSkel(*skeleton->getRoot());
+
+    totalLanes = baseline::LANES;
+    kernel = baseline::evaluateFrames;
+#ifdef BATCH_FK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        totalLanes = avx512::LANES;
+        kernel = avx512::evaluateFrames;
+    } else if (__builtin_cpu_supports("avx2") &&
+               __builtin_cpu_supports("fma")) {
+        totalLanes = avx2::LANES;
+        kernel = avx2::evaluateFrames;
+    }
+#endif
+}
+
+AFFINE3 BatchFK::worldTransform() const {
+    double translation[3];
+    skeleton->GetTranslation(translation);
+    double rotationAngle[3];
+    skeleton->GetRotationAngle(rotationAngle);
+
+    AFFINE3 world = AFFINE3::Identity();
+    world.translate(MOCAP_SCALE *
+                    VEC3(translation[0], translation[1], translation[2]));
+    world.rotate(AngleAxis<Real>(rotationAngle[0] * M_PI / 180.0,
+                                 VEC3::UnitX()));
+    world.rotate(AngleAxis<Real>(rotationAngle[1] * M_PI / 180.0,
+                                 VEC3::UnitY()));
+    world.rotate(AngleAxis<Real>(rotationAngle[2] * M_PI / 180.0,
+                                 VEC3::UnitZ()));
+    return world;
+}
+
+// the kernel takes a list of frames, so a range is spelled out first
+static vector<int> frameRange(int first, int count) {
+    vector<int> frames(count);
+    for (int i = 0; i < count; i++) {
+        frames[i] = first + i;
+    }
+    return frames;
+}
+
+void BatchFK::evaluate(Motion& motion, int first, int count,
+                       AFFINE3* transforms) const {
+    vector<int> frames = frameRange(first, count);
+    evaluate(motion, frames.data(), count, transforms);
+}
+
+void BatchFK::evaluate(Motion& motion, int first, int count,
+                       AFFINE3* transforms, ThreadPool& pool) const {
+    AFFINE3 world = worldTransform();
+    vector<int> frames = frameRange(first, count);
+    int chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    pool.parallelFor(chunks, [&](int chunk) {
+        int start = chunk * CHUNK_SIZE;
+        kernel(order, world, motion, &frames[start],
+               std::min(CHUNK_SIZE, count - start), bones,
+               transforms + start * bones);
+    });
+}
+
+void BatchFK::evaluate(Motion& motion, const int* frames, int count,
+                       AFFINE3* transforms) const {
+    kernel(order, worldTransform(), motion, frames, count, bones, transforms);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "displaySkeleton.h"
+#include "motion.h"
+#include "skeleton.h"
+#include "threadpool.hpp"
+
+using namespace std;
+
+// forward kinematics for a whole run of motion capture frames at once, for
+// scrubbing, motion analysis and crowds, where posing a Skeleton and walking
+// a DisplaySkeleton one frame at a time would be the bottleneck. frames go
+// down the flattened bone tree side by side, one frame per SIMD lane: 2 wide
+// with SSE2, 4 wide with AVX2 or 8 wide with AVX-512
+class BatchFK {
+   public:
+    // flattens the bone tree. the skeleton has to outlive this, since its
+    // root translation and rotation are read again at every evaluate()
+    BatchFK(Skeleton* skeleton);
+
+    // transforms written per frame, one per bone
+    int totalBones() const { return bones; }
+
+    // how many frames go through at once on this CPU
+    int lanes() const { return totalLanes; }
+
+    // bone transforms for frames [first, first + count) of the motion, which
+    // all have to exist. the transform of bone b in frame f ends up in
+    // transforms[(f - first) * totalBones() + b]: its rotation (including
+    // the aspect scaling) and its origin, the same as DisplaySkeleton's
+    // rotations() and translations() give for that pose. the root gets its
+    // own frame, which DisplaySkeleton leaves out
+    void evaluate(Motion& motion, int first, int count,
+                  AFFINE3* transforms) const;
+
+    // same, with the frames split across the pool in chunks
+    void evaluate(Motion& motion, int first, int count, AFFINE3* transforms,
+                  ThreadPool& pool) const;
+
+    // same, for any list of frames (e.g. one per character of a crowd), with
+    // the transforms of frames[i] starting at transforms[i * totalBones()]
+    void evaluate(Motion& motion, const int* frames, int count,
+                  AFFINE3* transforms) const;
+
+    // frames per task for the pooled evaluate()
+    static const int CHUNK_SIZE = 64;
+
+   protected:
+    typedef void (*Kernel)(const vector<FKBone>& order, const AFFINE3& world,
+                           Motion& motion, const int* frames, int count,
+                           int totalBones, AFFINE3* transforms);
+
+    Skeleton* skeleton;
+    vector<FKBone> order;
+    int bones;
+    int totalLanes;
+    Kernel kernel;
+
+    // where the skeleton is put in the world before the root bone
+    AFFINE3 worldTransform() const;
+};
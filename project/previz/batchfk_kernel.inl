@@ -0,0 +1,191 @@
+// batch forward kinematics kernel. batchfk.cpp includes this once per
+// instruction set, inside a namespace that provides LANES. every loop over
+// the lanes is straight-line arithmetic on independent frames, so each one
+// compiles down to a few vector instructions of that target
+
+// a frame per lane: the 3x3 rotation column by column, then the translation
+typedef Real LaneFrame[12][LANES];
+
+// one channel of the motion at the frame of each lane, 0 if the motion
+// doesn't have that channel
+static inline void loadChannel(const Motion& motion, int boneIndex,
+                               PostureChannel channel, const int* frames,
+                               Real* values) {
+    const double* channelValues = motion.GetChannel(boneIndex, channel);
+    for (int l = 0; l < LANES; l++) {
+        values[l] = (channelValues == NULL) ? 0.0 : channelValues[frames[l]];
+    }
+}
+
+// sin and cos of an angle per lane, for angles up to a few turns. this is
+// the cephes polynomial on [-pi/4, pi/4] after a reduction by multiples of
+// pi/2, but with selects in place of libm's branches so that it vectorizes
+static inline void sinCos(const Real* x, Real* sine, Real* cosine) {
+    // adding and subtracting 1.5 * 2^52 rounds to the nearest integer
+    const Real rounder = 6755399441055744.0;
+    for (int l = 0; l < LANES; l++) {
+        Real q = (x[l] * M_2_PI + rounder) - rounder;
+        int quadrant = (int)q;
+        Real r = ((x[l] - q * 1.57079625129699707031e0) -
+                  q * 7.54978941586159635335e-8) -
+                 q * 5.39030285815811905290e-15;
+        Real z = r * r;
+        Real s = r + r * z *
+                         (((((1.58962301576546568060e-10 * z -
+                              2.50507477628578072866e-8) *
+                                 z +
+                             2.75573136213857245213e-6) *
+                                z -
+                            1.98412698295895385996e-4) *
+                               z +
+                           8.33333333332211858878e-3) *
+                              z -
+                          1.66666666666666307295e-1);
+        Real c = 1.0 - 0.5 * z +
+                 z * z *
+                     (((((-1.13585365213876817300e-11 * z +
+                          2.08757008419747316778e-9) *
+                             z -
+                         2.75573141792967388112e-7) *
+                            z +
+                        2.48015872888517045348e-5) *
+                           z -
+                       1.38888888888730564116e-3) *
+                          z +
+                      4.16666666666665929218e-2);
+
+        // odd quadrants swap sin and cos, and the signs go round the circle
+        Real swap = (Real)(quadrant & 1);
+        Real sineSign = (Real)(1 - (quadrant & 2));
+        Real cosineSign = (Real)(1 - ((quadrant + 1) & 2));
+        sine[l] = sineSign * (s * (1.0 - swap) + c * swap);
+        cosine[l] = cosineSign * (c * (1.0 - swap) + s * swap);
+    }
+}
+
+// frame = frame * (rotation about the given axis). only the other two
+// columns change
+static inline void rotateFrame(LaneFrame& frame, int axis, const Real* sine,
+                               const Real* cosine) {
+    int a = 3 * ((axis + 1) % 3);
+    int b = 3 * ((axis + 2) % 3);
+    for (int row = 0; row < 3; row++)
+        for (int l = 0; l < LANES; l++) {
+            Real columnA = frame[a + row][l];
+            Real columnB = frame[b + row][l];
+            frame[a + row][l] = cosine[l] * columnA + sine[l] * columnB;
+            frame[b + row][l] = cosine[l] * columnB - sine[l] * columnA;
+        }
+}
+
+// frame.translation += frame.rotation * offset, with an offset per lane
+static inline void translateFrame(LaneFrame& frame, const Real* offsetX,
+                                  const Real* offsetY, const Real* offsetZ) {
+    for (int row = 0; row < 3; row++)
+        for (int l = 0; l < LANES; l++) {
+            frame[9 + row][l] += frame[row][l] * offsetX[l] +
+                                 frame[3 + row][l] * offsetY[l] +
+                                 frame[6 + row][l] * offsetZ[l];
+        }
+}
+
+// out.rotation = frame.rotation * matrix, out.translation = frame.translation
+static inline void multiplyFrame(const LaneFrame& frame, const MATRIX3& matrix,
+                                 LaneFrame& out) {
+    for (int column = 0; column < 3; column++)
+        for (int row = 0; row < 3; row++)
+            for (int l = 0; l < LANES; l++) {
+                out[3 * column + row][l] =
+                    frame[row][l] * matrix(0, column) +
+                    frame[3 + row][l] * matrix(1, column) +
+                    frame[6 + row][l] * matrix(2, column);
+            }
+    for (int i = 9; i < 12; i++)
+        for (int l = 0; l < LANES; l++) {
+            out[i][l] = frame[i][l];
+        }
+}
+
+static void evaluateFrames(const vector<FKBone>& order, const AFFINE3& world,
+                           Motion& motion, const int* frameList, int count,
+                           int totalBones, AFFINE3* transforms) {
+    // the frame at the tip of every bone visited so far, in flattened order
+    vector<Real> tipStorage(order.size() * 12 * LANES);
+    LaneFrame* tips = (LaneFrame*)&tipStorage[0];
+    LaneFrame worldFrame;
+    for (int i = 0; i < 12; i++)
+        for (int l = 0; l < LANES; l++) {
+            worldFrame[i][l] = world.matrix().data()[i];
+        }
+
+    int frames[LANES];
+    Real angle[LANES], sine[LANES], cosine[LANES];
+    Real offsetX[LANES], offsetY[LANES], offsetZ[LANES];
+    LaneFrame frame, bone;
+    for (int start = 0; start < count; start += LANES) {
+        // a short last batch repeats its last frame in the spare lanes
+        int lanes = std::min(LANES, count - start);
+        for (int l = 0; l < LANES; l++) {
+            frames[l] = frameList[start + std::min(l, lanes - 1)];
+        }
+
+        for (unsigned int i = 0; i < order.size(); i++) {
+            const FKBone& entry = order[i];
+            const Bone* pBone = entry.bone;
+            const int index = pBone->idx;
+
+            // into this bone's axes, from the end of its parent
+            const LaneFrame& parent =
+                (entry.parent < 0) ? worldFrame : tips[entry.parent];
+            multiplyFrame(parent, entry.toParent, frame);
+
+            // translate AMC (rarely used), in the order DisplaySkeleton
+            // applies them
+            if (pBone->doftx || pBone->dofty || pBone->doftz) {
+                loadChannel(motion, index, CHANNEL_TX, frames, offsetX);
+                loadChannel(motion, index, CHANNEL_TY, frames, offsetY);
+                loadChannel(motion, index, CHANNEL_TZ, frames, offsetZ);
+                for (int l = 0; l < LANES; l++) {
+                    offsetX[l] = pBone->doftx ? offsetX[l] : 0.0;
+                    offsetY[l] = pBone->dofty ? offsetY[l] : 0.0;
+                    offsetZ[l] = pBone->doftz ? offsetZ[l] : 0.0;
+                }
+                translateFrame(frame, offsetX, offsetY, offsetZ);
+            }
+
+            // rotate AMC, z then y then x
+            const int dofs[3] = {pBone->dofrx, pBone->dofry, pBone->dofrz};
+            for (int axis = 2; axis >= 0; axis--) {
+                if (!dofs[axis]) {
+                    continue;
+                }
+                loadChannel(motion, index, (PostureChannel)(CHANNEL_RX + axis),
+                            frames, angle);
+                for (int l = 0; l < LANES; l++) {
+                    angle[l] = angle[l] * M_PI / 180.0;
+                }
+                sinCos(angle, sine, cosine);
+                rotateFrame(frame, axis, sine, cosine);
+            }
+
+            // the bone itself, written out frame by frame
+            multiplyFrame(frame, entry.toCanonical, bone);
+            for (int l = 0; l < lanes; l++) {
+                Real* out =
+                    transforms[(start + l) * totalBones + index].data();
+                for (int k = 0; k < 12; k++) {
+                    out[k] = bone[k][l];
+                }
+            }
+
+            // the children hang off the far end of the bone
+            for (int l = 0; l < LANES; l++) {
+                offsetX[l] = entry.tip[0];
+                offsetY[l] = entry.tip[1];
+                offsetZ[l] = entry.tip[2];
+            }
+            translateFrame(frame, offsetX, offsetY, offsetZ);
+            memcpy(tips[i], frame, sizeof(LaneFrame));
+        }
+    }
+}
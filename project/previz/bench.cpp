@@ -0,0 +1,1111 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "QUICKTIME_MOVIE.h"
+#include "SETTINGS.h"
+#include "batchfk.hpp"
+#include "bvh.hpp"
+#include "compiledscene.hpp"
+#include "compressedmotion.hpp"
+#include "crowd.hpp"
+#include "displaySkeleton.h"
+#include "image.hpp"
+#include "motion.h"
+#include "packet.hpp"
+#include "pcamotion.hpp"
+#include "shapes.hpp"
+#include "skeleton.h"
+#include "threadpool.hpp"
+#include "tracer.hpp"
+#include "utilities.hpp"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Micro-benchmarks for the tracer and the skeleton. Run "make bench" and then
+// "./bench" from the previz folder, next to the mocap files.
+//////////////////////////////////////////////////////////////////////////////////
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start)
+        .count();
+}
+
+static Real randomReal(Real low, Real high) {
+    return low + (high - low) * ((Real)rand() / (Real)RAND_MAX);
+}
+
+static VEC3 randomVec3(Real low, Real high) {
+    return VEC3(randomReal(low, high), randomReal(low, high),
+                randomReal(low, high));
+}
+
+// a soup of spheres, triangles and bones in a 20^3 box. primitive size
+// shrinks with the count, so the box stays about equally full
+static void buildRandomScene(int totalShapes, vector<Shape*>& scene) {
+    Real size = 4.0 / cbrt((Real)totalShapes);
+    for (int i = 0; i < totalShapes; i++) {
+        VEC3 center = randomVec3(-10.0, 10.0);
+        VEC3 color = randomVec3(0.0, 1.0);
+        if (i % 3 == 0) {
+            scene.push_back(new Sphere(size * randomReal(0.2, 0.5), center,
+                                       color, OPAQUE, 0.0, NULL));
+        } else if (i % 3 == 1) {
+            scene.push_back(new Triangle(center + size * randomVec3(-1, 1),
+                                         center + size * randomVec3(-1, 1),
+                                         center + size * randomVec3(-1, 1),
+                                         color, OPAQUE, 0.0, NULL));
+        } else {
+            MATRIX4 rotation = MATRIX4::Identity();
+            rotation.block<3, 3>(0, 0) =
+                AngleAxisd(randomReal(0.0, M_PI),
+                           randomVec3(-1.0, 1.0).normalized())
+                    .toRotationMatrix();
+            VEC4 translation = extend(center);
+            translation[3] = 0.0;
+            Real length = size * randomReal(0.5, 1.5);
+            scene.push_back(new Cylinder(
+                center, center, size * 0.1, translation, rotation,
+                MATRIX4::Identity(), length, color, OPAQUE, 0.0, NULL));
+        }
+    }
+}
+
+static void destroyRandomScene(vector<Shape*>& scene) {
+    for (unsigned int i = 0; i < scene.size(); i++) {
+        delete scene[i];
+    }
+    scene.clear();
+}
+
+// rays from a ring of eyes outside the box, aimed somewhere inside it
+static void buildRandomRays(int totalRays, vector<Ray>& rays) {
+    for (int i = 0; i < totalRays; i++) {
+        Real angle = randomReal(0.0, 2.0 * M_PI);
+        VEC3 eye = VEC3(30.0 * cos(angle), randomReal(-5.0, 5.0),
+                        30.0 * sin(angle));
+        VEC3 target = randomVec3(-10.0, 10.0);
+        rays.push_back(Ray(eye, (target - eye).normalized()));
+    }
+}
+
+static void benchmarkBVH() {
+    cout << "=== BVH vs. linear intersectScene ===" << endl;
+    printf("%10s %10s %12s %8s %14s %14s %10s\n", "shapes", "nodes",
+           "build (ms)", "hit %", "linear Mray/s", "BVH Mray/s", "speedup");
+
+    int sizes[] = {40, 1000, 10000, 100000};
+    for (int s = 0; s < 4; s++) {
+        srand(478);
+        vector<Shape*> scene;
+        buildRandomScene(sizes[s], scene);
+        vector<Ray> rays;
+        buildRandomRays(100000, rays);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        BVH bvh;
+        bvh.build(scene);
+        double buildTime = secondsSince(start);
+
+        // keep the linear scan to roughly the same amount of work per size
+        int linearRays = std::min((int)rays.size(), 4000000 / sizes[s]);
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < linearRays; i++) {
+            intersectScene(scene, rays[i], 0.0);
+        }
+        double linearTime = secondsSince(start);
+
+        int bvhHits = 0;
+        int mismatches = 0;
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            bvhHits += bvh.intersect(rays[i], 0.0).doesIntersect;
+        }
+        double bvhTime = secondsSince(start);
+
+        // both should agree on what got hit
+        for (int i = 0; i < std::min(linearRays, 1000); i++) {
+            IntersectResult a = intersectScene(scene, rays[i], 0.0);
+            IntersectResult b = bvh.intersect(rays[i], 0.0);
+            if (a.doesIntersect != b.doesIntersect ||
+                (a.doesIntersect && fabs(a.t - b.t) > 1e-9)) {
+                mismatches++;
+            }
+        }
+
+        Real linearRate = linearRays / linearTime / 1e6;
+        Real bvhRate = rays.size() / bvhTime / 1e6;
+        printf("%10d %10d %12.2f %8.1f %14.4f %14.4f %9.1fx\n", sizes[s],
+               bvh.totalNodes(), buildTime * 1000.0,
+               100.0 * bvhHits / rays.size(), linearRate, bvhRate,
+               bvhRate / linearRate);
+        if (mismatches > 0) {
+            cout << " WARNING: " << mismatches
+                 << " rays disagree between BVH and linear scan" << endl;
+        }
+        destroyRandomScene(scene);
+    }
+}
+
+// per-frame scene setup: rebuilding one BVH over everything versus
+// refitting just the bones, as the static set dressing grows
+static void benchmarkRefit() {
+    cout << "=== per-frame setup, full rebuild vs. bone refit ===" << endl;
+    printf("%10s %8s %16s %16s\n", "static", "bones", "rebuild (ms)",
+           "refit (ms)");
+
+    int sizes[] = {40, 1000, 10000, 100000};
+    for (int s = 0; s < 4; s++) {
+        srand(478);
+        vector<Shape*> set;
+        buildRandomScene(sizes[s], set);
+        vector<Shape*> bones;
+        buildRandomScene(30, bones);
+        vector<Shape*> everything = set;
+        everything.insert(everything.end(), bones.begin(), bones.end());
+
+        const int frames = 20;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) {
+            BVH bvh;
+            bvh.build(everything);
+        }
+        double rebuildTime = secondsSince(start) / frames;
+
+        SceneBVH sceneBVH;
+        sceneBVH.buildStatic(set);
+        sceneBVH.buildDynamic(bones);
+        start = chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) {
+            // nudge every bone, like a new pose would
+            for (unsigned int i = 0; i < bones.size(); i++) {
+                Cylinder* bone = dynamic_cast<Cylinder*>(bones[i]);
+                if (bone != NULL) {
+                    VEC4 translation = bone->translation;
+                    translation[0] += 0.01;
+                    bone->setTransform(bone->top, bone->bottom, translation,
+                                       bone->rotation, bone->scaling,
+                                       bone->length);
+                }
+            }
+            sceneBVH.refitDynamic();
+        }
+        double refitTime = secondsSince(start) / frames;
+
+        printf("%10d %8d %16.3f %16.3f\n", sizes[s], (int)bones.size(),
+               rebuildTime * 1000.0, refitTime * 1000.0);
+        destroyRandomScene(set);
+        destroyRandomScene(bones);
+    }
+}
+
+// the same flat scan over every shape, through the vtable versus over the
+// compiled structure-of-arrays copy
+static void benchmarkCompiledScene() {
+    cout << "=== vector<Shape*> vs. compiled SoA scene, no BVH ===" << endl;
+    printf("%10s %10s %14s %16s %10s\n", "shapes", "materials",
+           "Shape* Mray/s", "compiled Mray/s", "speedup");
+
+    int sizes[] = {40, 1000, 10000};
+    for (int s = 0; s < 3; s++) {
+        srand(478);
+        vector<Shape*> scene;
+        buildRandomScene(sizes[s], scene);
+        vector<Ray> rays;
+        buildRandomRays(4000000 / sizes[s], rays);
+
+        CompiledScene compiled;
+        compiled.build(scene);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            intersectScene(scene, rays[i], 0.0);
+        }
+        double linearTime = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            compiled.intersect(rays[i], 0.0);
+        }
+        double compiledTime = secondsSince(start);
+
+        int mismatches = 0;
+        for (int i = 0; i < std::min((int)rays.size(), 1000); i++) {
+            IntersectResult a = intersectScene(scene, rays[i], 0.0);
+            IntersectResult b = compiled.intersect(rays[i], 0.0);
+            if (a.intersectingShape != b.intersectingShape) {
+                mismatches++;
+            }
+        }
+
+        Real linearRate = rays.size() / linearTime / 1e6;
+        Real compiledRate = rays.size() / compiledTime / 1e6;
+        printf("%10d %10d %14.4f %16.4f %9.1fx\n", sizes[s],
+               compiled.totalMaterials(), linearRate, compiledRate,
+               compiledRate / linearRate);
+        if (mismatches > 0) {
+            cout << " WARNING: " << mismatches
+                 << " rays disagree between the two scans" << endl;
+        }
+        destroyRandomScene(scene);
+    }
+}
+
+// coherent primary rays from a pinhole camera looking into the box, laid
+// out block by block so that every run of blockWidth * blockHeight rays
+// covers one block of pixels, the way renderTilePackets() groups them
+static void buildCameraRays(int xRes, int yRes, int blockWidth,
+                            int blockHeight, vector<Ray>& rays) {
+    VEC3 eye(0.0, 0.0, -30.0);
+    for (int blockY = 0; blockY < yRes; blockY += blockHeight)
+        for (int blockX = 0; blockX < xRes; blockX += blockWidth)
+            for (int y = blockY; y < blockY + blockHeight; y++)
+                for (int x = blockX; x < blockX + blockWidth; x++) {
+                    VEC3 direction((x - xRes / 2) / (Real)yRes * 0.8,
+                                   (y - yRes / 2) / (Real)yRes * 0.8, 1.0);
+                    rays.push_back(Ray(eye, direction.normalized()));
+                }
+}
+
+static void benchmarkPackets() {
+    cout << "=== primary rays, scalar vs. SIMD packets (Mray/s) ===" << endl;
+    printf("%10s %10s %10s %10s %10s\n", "shapes", "scalar", "4 wide",
+           "8 wide", "16 wide");
+
+    const int xRes = 640;
+    const int yRes = 480;
+    int sizes[] = {1000, 10000, 100000};
+    for (int s = 0; s < 3; s++) {
+        srand(478);
+        vector<Shape*> scene;
+        buildRandomScene(sizes[s], scene);
+        SceneBVH sceneBVH;
+        sceneBVH.buildStatic(scene);
+
+        vector<Ray> rays;
+        buildCameraRays(xRes, yRes, 4, 4, rays);
+        vector<IntersectResult> expected(rays.size());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            expected[i] = sceneBVH.intersect(rays[i], 0.0);
+        }
+        double scalarTime = secondsSince(start);
+        printf("%10d %10.3f", sizes[s], rays.size() / scalarTime / 1e6);
+
+        int mismatches = 0;
+        for (int width = 4; width <= 16; width *= 2) {
+            if (!packetWidthSupported(width)) {
+                printf(" %10s", "n/a");
+                continue;
+            }
+            // same blocks the renderer uses: 2x2, 4x2 and 4x4
+            int blockWidth = (width == 4) ? 2 : 4;
+            vector<Ray> packetRays;
+            buildCameraRays(xRes, yRes, blockWidth, width / blockWidth,
+                            packetRays);
+            vector<IntersectResult> results(packetRays.size());
+            start = chrono::steady_clock::now();
+            for (unsigned int i = 0; i < packetRays.size(); i += width) {
+                intersectPacket(sceneBVH, &packetRays[i], width, width,
+                                &results[i]);
+            }
+            double packetTime = secondsSince(start);
+            printf(" %10.3f", packetRays.size() / packetTime / 1e6);
+
+            for (unsigned int i = 0; i < packetRays.size(); i++) {
+                IntersectResult reference =
+                    sceneBVH.intersect(packetRays[i], 0.0);
+                if (reference.intersectingShape !=
+                    results[i].intersectingShape) {
+                    mismatches++;
+                }
+            }
+        }
+        printf("\n");
+        if (mismatches > 0) {
+            cout << " WARNING: " << mismatches
+                 << " packet rays disagree with the scalar tracer" << endl;
+        }
+        destroyRandomScene(scene);
+    }
+}
+
+// shadow rays from everything the camera sees towards a light above the
+// box: closest hit, any hit, and any hit behind the last-occluder cache
+static void benchmarkShadowRays() {
+    cout << "=== shadow rays (Mray/s) ===" << endl;
+    printf("%10s %10s %12s %10s %14s\n", "shapes", "shadowed", "closest hit",
+           "any hit", "any + cache");
+
+    int sizes[] = {1000, 10000, 100000};
+    for (int s = 0; s < 3; s++) {
+        srand(478);
+        vector<Shape*> scene;
+        buildRandomScene(sizes[s], scene);
+        SceneBVH sceneBVH;
+        sceneBVH.buildStatic(scene);
+
+        vector<Ray> cameraRays;
+        buildCameraRays(640, 480, 4, 4, cameraRays);
+        Light light(VEC3(0.0, 40.0, -10.0), VEC3(1.0, 1.0, 1.0));
+        vector<Ray> shadowRays;
+        vector<Real> lightDistances;
+        for (unsigned int i = 0; i < cameraRays.size(); i++) {
+            IntersectResult hit = sceneBVH.intersect(cameraRays[i], 0.0);
+            if (hit.doesIntersect) {
+                Ray shadowRay =
+                    createShadowRay(hit, cameraRays[i], &light, false);
+                shadowRays.push_back(shadowRay);
+                lightDistances.push_back(
+                    (light.position - shadowRay.origin).norm());
+            }
+        }
+
+        // the cache the way previz keeps it, one per frame. the three
+        // queries take turns a few times and each keeps its best run, so
+        // none of them pays for warming up the caches
+        vector<Light*> lights(1, &light);
+        OccluderCache occluders(0, lights.size());
+        RenderContext context(sceneBVH, lights, 10.0, 0.0, &occluders);
+        int closestShadowed = 0;
+        int anyShadowed = 0;
+        int cachedShadowed = 0;
+        double closestTime = INFINITY;
+        double anyTime = INFINITY;
+        double cachedTime = INFINITY;
+        for (int run = 0; run < 3; run++) {
+            closestShadowed = 0;
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            for (unsigned int i = 0; i < shadowRays.size(); i++) {
+                IntersectResult hit = sceneBVH.intersect(shadowRays[i], 0.0);
+                closestShadowed +=
+                    hit.doesIntersect && hit.t < lightDistances[i];
+            }
+            closestTime = min(closestTime, secondsSince(start));
+
+            anyShadowed = 0;
+            start = chrono::steady_clock::now();
+            for (unsigned int i = 0; i < shadowRays.size(); i++) {
+                Shape* occluder = NULL;
+                anyShadowed += sceneBVH.occluded(shadowRays[i],
+                                                 lightDistances[i], occluder);
+            }
+            anyTime = min(anyTime, secondsSince(start));
+
+            cachedShadowed = 0;
+            start = chrono::steady_clock::now();
+            for (unsigned int i = 0; i < shadowRays.size(); i++) {
+                cachedShadowed += shadowRayOccluded(context, shadowRays[i],
+                                                    lightDistances[i], 0);
+            }
+            cachedTime = min(cachedTime, secondsSince(start));
+        }
+
+        Real total = shadowRays.size() / 1e6;
+        printf("%10d %9.1f%% %12.3f %10.3f %14.3f\n", sizes[s],
+               100.0 * closestShadowed / shadowRays.size(),
+               total / closestTime, total / anyTime, total / cachedTime);
+        if (anyShadowed != closestShadowed ||
+            cachedShadowed != closestShadowed) {
+            cout << " WARNING: the shadow queries disagree" << endl;
+        }
+        destroyRandomScene(scene);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// the tracer as it was before RenderSettings, kept here only to measure
+// against: every effect is a runtime flag, and everything a ray needs is
+// handed down the recursion. Context is FlagContext to copy all of it at
+// every bounce, lights included, the way the old rayColor took its
+// arguments, or const FlagContext& to pass it by reference like
+// RenderContext
+//////////////////////////////////////////////////////////////////////////////////
+
+extern int MAX_RECURSION_DEPTH;
+
+class FlagContext {
+   public:
+    Accelerator* scene;
+    vector<Light*> lights;
+    Real phongExponent;
+    bool useLights;
+    bool useMultipleLights;
+    bool useSpecular;
+    bool useShadows;
+    bool useMirror;
+    bool useRefraction;
+    bool useFresnel;
+    bool softShadows;
+};
+
+// the effects previz renders with, as flags
+static FlagContext previzFlags(Accelerator& scene,
+                               const vector<Light*>& lights) {
+    FlagContext context;
+    context.scene = &scene;
+    context.lights = lights;
+    context.phongExponent = 10.0;
+    context.useLights = true;
+    context.useMultipleLights = true;
+    context.useSpecular = false;
+    context.useShadows = true;
+    context.useMirror = true;
+    context.useRefraction = true;
+    context.useFresnel = true;
+    context.softShadows = false;
+    return context;
+}
+
+template <class Context>
+static VEC3 flagRayColor(Context context, Ray ray, int depth) {
+    IntersectResult intersection = context.scene->intersect(ray, 0.0);
+    if (intersection.intersectingShape == NULL) {
+        return VEC3(1.0, 1.0, 1.0);
+    }
+
+    VEC3 color = VEC3(0.0, 0.0, 0.0);
+    const MaterialInfo* material = intersection.material;
+    if (context.useLights) {
+        for (unsigned int i = 0; i < context.lights.size(); i++) {
+            Light* light = context.lights[i];
+            bool shadowed = false;
+            if (context.useShadows) {
+                Ray shadowRay = createShadowRay(intersection, ray, light,
+                                                context.softShadows);
+                Shape* occluder = NULL;
+                shadowed = context.scene->occluded(
+                    shadowRay, (light->position - shadowRay.origin).norm(),
+                    occluder);
+            }
+            if (!shadowed) {
+                color += lightingEquation(light, intersection,
+                                          context.phongExponent, ray,
+                                          context.useSpecular);
+            }
+            if (!context.useMultipleLights) {
+                break;
+            }
+        }
+    } else {
+        color += material->color;
+    }
+
+    if (context.useMirror && material->type == MIRROR &&
+        depth != MAX_RECURSION_DEPTH) {
+        color += flagRayColor<Context>(
+            context, createReflectionRay(intersection, ray), depth + 1);
+    }
+    if (context.useRefraction && material->type == DIELECTRIC &&
+        depth != MAX_RECURSION_DEPTH) {
+        Ray refractionRay = createRefractionRay(intersection, ray);
+        if (context.useFresnel) {
+            Real kReflectance = fresnel(intersection, ray);
+            VEC3 reflectionColor = flagRayColor<Context>(
+                context, createReflectionRay(intersection, ray), depth + 1);
+            VEC3 refractionColor =
+                flagRayColor<Context>(context, refractionRay, depth + 1);
+            color += kReflectance * reflectionColor +
+                     (1.0 - kReflectance) * refractionColor;
+        } else {
+            color += flagRayColor<Context>(context, refractionRay, depth + 1);
+        }
+    }
+    // the random scene has no textures
+    return clampVec3(color, 0.0, 1.0);
+}
+
+// a few mirrors and glass shapes mixed into the random scene, so the
+// recursion gets exercised too. the same shading three ways: flags with
+// everything copied at each bounce, flags with a context passed by
+// reference, and the compiled-in RenderSettings kernel previz uses
+static void benchmarkRenderSettings() {
+    cout << "=== full shading, runtime flags vs. RenderSettings (Mray/s) ==="
+         << endl;
+    printf("%10s %10s %10s %10s %10s %10s\n", "shapes", "copied", "by ref",
+           "template", "ref gain", "mask gain");
+
+    int sizes[] = {40, 1000, 10000};
+    for (int s = 0; s < 3; s++) {
+        srand(478);
+        vector<Shape*> scene;
+        buildRandomScene(sizes[s], scene);
+        for (unsigned int i = 0; i < scene.size(); i += 10) {
+            scene[i]->material.type = (i % 20 == 0) ? MIRROR : DIELECTRIC;
+            scene[i]->material.refractiveIndex = 1.5;
+        }
+        SceneBVH sceneBVH;
+        sceneBVH.buildStatic(scene);
+
+        Light key(VEC3(0.0, 40.0, -10.0), VEC3(0.6, 0.6, 0.6));
+        Light fill(VEC3(-30.0, 10.0, -30.0), VEC3(0.3, 0.3, 0.3));
+        Light rim(VEC3(30.0, -10.0, 20.0), VEC3(0.2, 0.2, 0.2));
+        vector<Light*> lights;
+        lights.push_back(&key);
+        lights.push_back(&fill);
+        lights.push_back(&rim);
+
+        vector<Ray> rays;
+        buildCameraRays(320, 240, 4, 4, rays);
+
+        // alternate the three a few times and keep the best of each, so
+        // none of them pays for warming up the caches
+        FlagContext flags = previzFlags(sceneBVH, lights);
+        RenderContext context(sceneBVH, lights, 10.0, 0.0);
+        vector<VEC3> copied(rays.size());
+        vector<VEC3> referenced(rays.size());
+        vector<VEC3> colors(rays.size());
+        double copiedTime = INFINITY;
+        double referenceTime = INFINITY;
+        double templateTime = INFINITY;
+        for (int run = 0; run < 5; run++) {
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            for (unsigned int i = 0; i < rays.size(); i++) {
+                copied[i] = flagRayColor<FlagContext>(flags, rays[i], 0);
+            }
+            copiedTime = min(copiedTime, secondsSince(start));
+
+            start = chrono::steady_clock::now();
+            for (unsigned int i = 0; i < rays.size(); i++) {
+                referenced[i] =
+                    flagRayColor<const FlagContext&>(flags, rays[i], 0);
+            }
+            referenceTime = min(referenceTime, secondsSince(start));
+
+            start = chrono::steady_clock::now();
+            for (unsigned int i = 0; i < rays.size(); i++) {
+                colors[i] =
+                    rayColor<PREVIZ_RENDER_SETTINGS>(context, rays[i]);
+            }
+            templateTime = min(templateTime, secondsSince(start));
+        }
+
+        int mismatches = 0;
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            mismatches += (colors[i] - copied[i]).norm() > 1e-9 ||
+                          (colors[i] - referenced[i]).norm() > 1e-9;
+        }
+        printf("%10d %10.3f %10.3f %10.3f %9.2fx %9.2fx\n", sizes[s],
+               rays.size() / copiedTime / 1e6,
+               rays.size() / referenceTime / 1e6,
+               rays.size() / templateTime / 1e6, copiedTime / referenceTime,
+               referenceTime / templateTime);
+        if (mismatches > 0) {
+            cout << " WARNING: " << mismatches
+                 << " rays shade differently" << endl;
+        }
+        destroyRandomScene(scene);
+    }
+}
+
+// a small render of the random scene, shaded the way previz shades it,
+// through the compiled scene in double and in float. the float image is
+// compared against the double one to show what the speed costs
+static void benchmarkSinglePrecision() {
+    cout << "=== compiled scene, double vs. float (Mray/s, full shading) ==="
+         << endl;
+    printf("%10s %10s %10s %10s %12s %8s %10s\n", "shapes", "double",
+           "float", "speedup", "pixels off", "max", "PSNR (dB)");
+
+    const int xRes = 160;
+    const int yRes = 120;
+    int sizes[] = {40, 1000, 10000};
+    for (int s = 0; s < 3; s++) {
+        srand(478);
+        vector<Shape*> scene;
+        buildRandomScene(sizes[s], scene);
+        for (unsigned int i = 0; i < scene.size(); i += 10) {
+            scene[i]->material.type = MIRROR;
+        }
+        CompiledScene compiled;
+        compiled.build(scene);
+        CompiledSceneFloat compiledFloat;
+        compiledFloat.build(scene);
+
+        Light key(VEC3(0.0, 40.0, -10.0), VEC3(0.7, 0.7, 0.7));
+        Light fill(VEC3(-30.0, 10.0, -30.0), VEC3(0.3, 0.3, 0.3));
+        vector<Light*> lights;
+        lights.push_back(&key);
+        lights.push_back(&fill);
+
+        vector<Ray> rays;
+        buildCameraRays(xRes, yRes, 1, 1, rays);
+        Image doubleImage(xRes, yRes);
+        Image floatImage(xRes, yRes);
+
+        RenderContext doubleContext(compiled, lights, 10.0, 0.0);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            VEC3 color =
+                rayColor<PREVIZ_RENDER_SETTINGS>(doubleContext, rays[i]);
+            doubleImage.setPixel(i % xRes, i / xRes, color);
+        }
+        double doubleTime = secondsSince(start);
+
+        RenderContext floatContext(compiledFloat, lights, 10.0, 0.0);
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            VEC3 color =
+                rayColor<PREVIZ_RENDER_SETTINGS>(floatContext, rays[i]);
+            floatImage.setPixel(i % xRes, i / xRes, color);
+        }
+        double floatTime = secondsSince(start);
+
+        ImageDifference difference = compareImages(doubleImage, floatImage);
+        printf("%10d %10.4f %10.4f %9.2fx %11.3f%% %8d %10.1f\n", sizes[s],
+               rays.size() / doubleTime / 1e6, rays.size() / floatTime / 1e6,
+               doubleTime / floatTime,
+               100.0 * difference.differingPixels / (xRes * yRes),
+               difference.maxDifference, difference.psnr);
+
+        destroyRandomScene(scene);
+    }
+}
+
+// bone transforms for every frame of 88_02.amc: posing the skeleton and
+// walking it one frame at a time, against BatchFK on one thread and on the
+// pool. the batch results are checked against the per-frame ones
+static void benchmarkBatchFK() {
+    cout << "=== forward kinematics over 88_02.amc (us per frame) ===" << endl;
+
+    Skeleton* skeleton = new Skeleton("88.asf", MOCAP_SCALE);
+    skeleton->setBasePosture();
+    DisplaySkeleton displayer;
+    displayer.LoadSkeleton(skeleton);
+    Motion* motion = new Motion("88_02.amc", MOCAP_SCALE, skeleton);
+    displayer.LoadMotion(motion);
+
+    BatchFK batch(skeleton);
+    ThreadPool pool;
+    const int totalFrames = motion->GetNumFrames();
+    const int totalBones = batch.totalBones();
+    vector<AFFINE3> perFrame(totalFrames * totalBones, AFFINE3::Identity());
+    vector<AFFINE3> batched(totalFrames * totalBones, AFFINE3::Identity());
+
+    // best of a few runs each, the whole clip is only a few milliseconds
+    double perFrameTime = 1e30, batchTime = 1e30, pooledTime = 1e30;
+    for (int run = 0; run < 5; run++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int frame = 0; frame < totalFrames; frame++) {
+            skeleton->setPosture(motion->GetPosture(frame));
+            displayer.ComputeBonePositions(
+                DisplaySkeleton::BONES_AND_LOCAL_FRAMES);
+            // the root has no bone, so it keeps the identity
+            for (int bone = 1; bone < totalBones; bone++) {
+                AFFINE3& out = perFrame[frame * totalBones + bone];
+                out.linear() = displayer.rotations()[bone].block<3, 3>(0, 0);
+                out.translation() = displayer.translations()[bone].head<3>();
+            }
+        }
+        perFrameTime = std::min(perFrameTime, secondsSince(start));
+
+        start = chrono::steady_clock::now();
+        batch.evaluate(*motion, 0, totalFrames, &batched[0]);
+        batchTime = std::min(batchTime, secondsSince(start));
+
+        start = chrono::steady_clock::now();
+        batch.evaluate(*motion, 0, totalFrames, &batched[0], pool);
+        pooledTime = std::min(pooledTime, secondsSince(start));
+    }
+
+    Real maxRotation = 0.0;
+    Real maxTranslation = 0.0;
+    for (int frame = 0; frame < totalFrames; frame++)
+        for (int bone = 1; bone < totalBones; bone++) {
+            const AFFINE3& a = perFrame[frame * totalBones + bone];
+            const AFFINE3& b = batched[frame * totalBones + bone];
+            maxRotation = std::max(
+                maxRotation, (a.linear() - b.linear()).cwiseAbs().maxCoeff());
+            maxTranslation = std::max(
+                maxTranslation,
+                (a.translation() - b.translation()).cwiseAbs().maxCoeff());
+        }
+
+    printf("%10s %10s %10s %16s %10s %10s\n", "frames", "per-frame",
+           "batch", "batch, threads", "speedup", "lanes");
+    printf("%10d %10.3f %10.3f %10.3f (%2d) %9.2fx %10d\n", totalFrames,
+           1e6 * perFrameTime / totalFrames, 1e6 * batchTime / totalFrames,
+           1e6 * pooledTime / totalFrames, pool.size(),
+           perFrameTime / std::min(batchTime, pooledTime), batch.lanes());
+    printf(" largest difference: %g in rotation, %g in position\n",
+           maxRotation, maxTranslation);
+}
+
+// loading 88_02.amc by parsing the text against mapping the binary cache,
+// which the first cached load writes. the channels have to come out the same
+static void benchmarkMotionCache() {
+    cout << "=== loading 88_02.amc (ms) ===" << endl;
+
+    Skeleton* skeleton = new Skeleton("88.asf", MOCAP_SCALE);
+    delete new Motion("88_02.amc", MOCAP_SCALE, skeleton);
+
+    double parseTime = 1e30, cacheTime = 1e30;
+    Motion* parsed = NULL;
+    Motion* cached = NULL;
+    for (int run = 0; run < 3; run++) {
+        delete parsed;
+        delete cached;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        parsed = new Motion("88_02.amc", MOCAP_SCALE, skeleton, false);
+        parseTime = std::min(parseTime, secondsSince(start));
+
+        start = chrono::steady_clock::now();
+        cached = new Motion("88_02.amc", MOCAP_SCALE, skeleton);
+        cacheTime = std::min(cacheTime, secondsSince(start));
+    }
+
+    bool same = cached->IsCached() &&
+                parsed->GetNumFrames() == cached->GetNumFrames() &&
+                parsed->GetNumChannels() == cached->GetNumChannels();
+    for (int bone = 0; same && bone < MAX_BONES_IN_ASF_FILE; bone++)
+        for (int channel = 0; channel < NUMBER_POSTURE_CHANNELS; channel++) {
+            const double* a = parsed->GetChannel(bone, (PostureChannel)channel);
+            const double* b = cached->GetChannel(bone, (PostureChannel)channel);
+            same = same && (a == NULL) == (b == NULL) &&
+                   (a == NULL || memcmp(a, b, parsed->GetNumFrames() *
+                                                  sizeof(double)) == 0);
+        }
+
+    printf("%10s %10s %10s %10s %10s\n", "frames", "parse", "cache",
+           "speedup", "same");
+    printf("%10d %10.3f %10.3f %9.2fx %10s\n", parsed->GetNumFrames(),
+           1e3 * parseTime, 1e3 * cacheTime, parseTime / cacheTime,
+           same ? "yes" : "NO");
+    delete parsed;
+    delete cached;
+    delete skeleton;
+}
+
+// 88_02.amc compressed at a few tolerances: how small it gets, how long it
+// takes to sample a posture, and how far the joints end up from where the
+// original motion puts them (through BatchFK, in millimetres at MOCAP_SCALE)
+static void benchmarkCompressedMotion() {
+    cout << "=== compressing 88_02.amc ===" << endl;
+
+    Skeleton* skeleton = new Skeleton("88.asf", MOCAP_SCALE);
+    Motion* motion = new Motion("88_02.amc", MOCAP_SCALE, skeleton);
+    const int totalFrames = motion->GetNumFrames();
+    BatchFK batch(skeleton);
+    const int totalBones = batch.totalBones();
+    vector<AFFINE3> original(totalFrames * totalBones);
+    vector<AFFINE3> played(totalFrames * totalBones);
+    batch.evaluate(*motion, 0, totalFrames, &original[0]);
+
+    printf("%10s %10s %10s %10s %10s %12s %12s\n", "tolerance", "bytes",
+           "ratio", "keys", "compress", "sample (us)", "error (mm)");
+    const Real tolerances[] = {0.1, 0.25, 1.0};
+    for (int i = 0; i < 3; i++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        CompressedMotion compressed(*motion, tolerances[i],
+                                    tolerances[i] * MOTION_POSITION_TOLERANCE /
+                                        MOTION_ANGLE_TOLERANCE);
+        double compressTime = secondsSince(start);
+
+        // halfway between frames, where the interpolation does the most
+        Motion sampled(totalFrames, skeleton);
+        start = chrono::steady_clock::now();
+        for (int frame = 0; frame < totalFrames; frame++) {
+            compressed.sample(frame + 0.5, sampled, frame);
+        }
+        double sampleTime = secondsSince(start);
+
+        for (int frame = 0; frame < totalFrames; frame++) {
+            compressed.sample(frame, sampled, frame);
+        }
+        batch.evaluate(sampled, 0, totalFrames, &played[0]);
+        Real maxError = 0.0;
+        for (int j = 0; j < totalFrames * totalBones; j++) {
+            maxError = std::max(maxError, (original[j].translation() -
+                                           played[j].translation())
+                                              .norm());
+        }
+
+        printf("%10.2f %10zu %9.1fx %10d %8.1fms %12.3f %12.3f\n",
+               tolerances[i], compressed.compressedBytes(),
+               (Real)compressed.originalBytes() / compressed.compressedBytes(),
+               compressed.totalKeys(), 1e3 * compressTime,
+               1e6 * sampleTime / totalFrames, 1e3 * maxError);
+    }
+    delete motion;
+    delete skeleton;
+}
+
+// 88_02.amc on a PCA basis at a few error budgets: components kept, size,
+// the joint error after FK (mm), and decoding a frame at a time against all
+// of them in one matrix product. the last column builds the basis from the
+// first half of the take only, and reports the RMS error on the second half,
+// as a stand-in for a library of similar takes
+static void benchmarkPCAMotion() {
+    cout << "=== 88_02.amc on a PCA basis ===" << endl;
+
+    Skeleton* skeleton = new Skeleton("88.asf", MOCAP_SCALE);
+    Motion* motion = new Motion("88_02.amc", MOCAP_SCALE, skeleton);
+    const int totalFrames = motion->GetNumFrames();
+    const int half = totalFrames / 2;
+    BatchFK batch(skeleton);
+    const int totalBones = batch.totalBones();
+    vector<AFFINE3> original(totalFrames * totalBones);
+    vector<AFFINE3> played(totalFrames * totalBones);
+    batch.evaluate(*motion, 0, totalFrames, &original[0]);
+    Motion firstHalf(half, skeleton);
+    for (int frame = 0; frame < half; frame++) {
+        firstHalf.SetPosture(frame, motion->GetPosture(frame));
+    }
+
+    printf("%8s %6s %10s %8s %10s %10s %12s %12s %10s\n", "budget", "kept",
+           "bytes", "ratio", "rms", "error (mm)", "frame (us)", "batch (us)",
+           "unseen");
+    const Real budgets[] = {0.25, 0.5, 1.0, 2.0};
+    for (int i = 0; i < 4; i++) {
+        MotionBasis basis(vector<Motion*>(1, motion), budgets[i]);
+        PCAMotion encoded(basis, *motion);
+
+        Motion decoded(totalFrames, skeleton);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int frame = 0; frame < totalFrames; frame++) {
+            encoded.sample(frame, decoded, frame);
+        }
+        double frameTime = secondsSince(start);
+        start = chrono::steady_clock::now();
+        encoded.reconstruct(0, totalFrames, decoded, 0);
+        double batchTime = secondsSince(start);
+
+        batch.evaluate(decoded, 0, totalFrames, &played[0]);
+        Real maxError = 0.0;
+        for (int j = 0; j < totalFrames * totalBones; j++) {
+            maxError = std::max(maxError, (original[j].translation() -
+                                           played[j].translation())
+                                              .norm());
+        }
+
+        // a basis from the first half, used on the second (the root isn't
+        // part of the basis, so it's left out here)
+        MotionBasis halfBasis(vector<Motion*>(1, &firstHalf), budgets[i]);
+        MATRIXF coefficients =
+            halfBasis.encode(*motion, half, totalFrames - half);
+        Motion unseen(totalFrames - half, skeleton);
+        halfBasis.decode(coefficients, unseen, 0);
+        Real squaredError = 0.0;
+        int values = 0;
+        for (int bone = 1; bone < totalBones; bone++)
+            for (int c = 0; c < NUMBER_POSTURE_CHANNELS; c++) {
+                const double* a = motion->GetChannel(bone, (PostureChannel)c);
+                const double* b = unseen.GetChannel(bone, (PostureChannel)c);
+                if (a == NULL || b == NULL) {
+                    continue;
+                }
+                bool rotational = (c == CHANNEL_RX || c == CHANNEL_RY ||
+                                   c == CHANNEL_RZ);
+                Real weight = rotational ? 1.0
+                                         : MOTION_ANGLE_TOLERANCE /
+                                               MOTION_POSITION_TOLERANCE;
+                for (int frame = 0; frame < totalFrames - half; frame++) {
+                    Real d = weight * (a[half + frame] - b[frame]);
+                    squaredError += d * d;
+                    values++;
+                }
+            }
+
+        size_t originalBytes =
+            (size_t)motion->GetNumChannels() * totalFrames * sizeof(double);
+        printf("%8.2f %6d %10zu %7.1fx %10.3f %10.3f %12.3f %12.3f %10.3f\n",
+               budgets[i], basis.totalComponents(), encoded.bytes(),
+               (Real)originalBytes / (encoded.bytes() + basis.bytes()),
+               basis.rmsError(), 1e3 * maxError, 1e6 * frameTime / totalFrames,
+               1e6 * batchTime / totalFrames,
+               sqrt(squaredError / std::max(values, 1)));
+    }
+    delete motion;
+    delete skeleton;
+}
+
+// posing and tracing a crowd of characters on 88_02.amc, seen from where
+// previz puts the camera. posing stops growing once every pose is in use,
+// and tracing should only grow with the log of the crowd size
+static void benchmarkCrowd() {
+    cout << "=== crowds on 88_02.amc ===" << endl;
+
+    Skeleton* skeleton = new Skeleton("88.asf", MOCAP_SCALE);
+    skeleton->setBasePosture();
+    Motion* motion = new Motion("88_02.amc", MOCAP_SCALE, skeleton);
+
+    const int xRes = 320;
+    const int yRes = 240;
+    VEC3 eye(-6.0, 0.5, 1.0);
+    vector<Ray> rays;
+    for (int y = 0; y < yRes; y++)
+        for (int x = 0; x < xRes; x++) {
+            VEC3 direction(1.0, (yRes / 2 - y) / (Real)yRes * 1.2,
+                           (x - xRes / 2) / (Real)yRes * 1.2);
+            rays.push_back(Ray(eye, direction.normalized()));
+        }
+
+    printf("%10s %8s %16s %16s %10s\n", "members", "poses", "pose (ms)",
+           "trace (Mray/s)", "hits");
+    int sizes[] = {1, 10, 100, 1000};
+    for (int s = 0; s < 4; s++) {
+        Crowd crowd(skeleton, motion, sizes[s], VEC3(0, 0, 1));
+        SceneBVH sceneBVH;
+        sceneBVH.buildStatic(vector<Shape*>());
+        sceneBVH.buildDynamic(vector<Shape*>(1, crowd.shape()));
+
+        const int frames = 20;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) {
+            crowd.setFrame(8 * f);
+            sceneBVH.refitDynamic();
+        }
+        double poseTime = secondsSince(start) / frames;
+
+        int hits = 0;
+        start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < rays.size(); i++) {
+            hits += sceneBVH.intersect(rays[i], 0.0).doesIntersect;
+        }
+        double traceTime = secondsSince(start);
+
+        printf("%10d %8d %16.3f %16.3f %9.1f%%\n", crowd.totalMembers(),
+               crowd.totalPoses(), poseTime * 1000.0,
+               rays.size() / traceTime / 1e6, 100.0 * hits / rays.size());
+    }
+    delete motion;
+    delete skeleton;
+}
+
+static void benchmarkMovieEncoding() {
+    cout << "=== MJPEG movie encoding ===" << endl;
+
+    // smooth gradients with some noise over them, so the compressor has
+    // about as much to do as on a rendered frame
+    const int xRes = 640;
+    const int yRes = 480;
+    vector<unsigned char> image(3 * xRes * yRes);
+    for (int y = 0; y < yRes; y++)
+        for (int x = 0; x < xRes; x++) {
+            unsigned char* pixel = &image[3 * (y * xRes + x)];
+            pixel[0] = (x * 255 / xRes + rand() % 16) & 255;
+            pixel[1] = (y * 255 / yRes + rand() % 16) & 255;
+            pixel[2] = ((x + y) * 127 / yRes + rand() % 16) & 255;
+        }
+    const int frames = 120;
+
+    // one compressor on this thread, nothing overlapped
+    vector<unsigned char> jpeg;
+    JPEG_COMPRESSOR compressor;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) {
+        compressor.compress(&image[0], xRes, yRes, jpeg);
+    }
+    double serialTime = secondsSince(start);
+    printf("%10s %16s %10s %12s\n", "threads", "frames/s", "speedup",
+           "KB/frame");
+    printf("%10s %16.1f %10.2f %12.1f\n", "serial", frames / serialTime, 1.0,
+           jpeg.size() / 1024.0);
+
+    int threads[] = {1, 2, 4, (int)thread::hardware_concurrency()};
+    for (int t = 0; t < 4; t++) {
+        start = chrono::steady_clock::now();
+        long long bytes = 0;
+        {
+            QUICKTIME_MOVIE movie("bench.mov", 30, threads[t]);
+            for (int f = 0; f < frames; f++) {
+                movie.addFrame(&image[0], xRes, yRes);
+            }
+            movie.writeMovie();
+        }
+        double movieTime = secondsSince(start);
+        FILE* file = fopen("bench.mov", "rb");
+        if (file != NULL) {
+            fseeko(file, 0, SEEK_END);
+            bytes = ftello(file);
+            fclose(file);
+        }
+        remove("bench.mov");
+        printf("%10d %16.1f %10.2f %12.1f\n", threads[t], frames / movieTime,
+               serialTime / movieTime, bytes / 1024.0 / frames);
+    }
+}
+
+// the conversion writePPM() used to do, kept out of line so it isn't
+// folded into the timing loop
+static void __attribute__((noinline))
+legacyQuantize(const float* values, unsigned char* pixels, int count) {
+    for (int i = 0; i < count; i++) pixels[i] = values[i];
+}
+
+// turning a 640x480 framebuffer into the 8-bit RGB that gets written out,
+// the way it used to be done (interleaved floats from 0 to 255, truncated
+// one value at a time) against Image in each format and layout
+static void benchmarkImageConversion() {
+    cout << "=== framebuffer to 8-bit RGB, 640x480 ===" << endl;
+    const int xRes = 640;
+    const int yRes = 480;
+    const int totalValues = 3 * xRes * yRes;
+    const int repeats = 200;
+    vector<unsigned char> pixels(totalValues);
+
+    srand(478);
+    vector<VEC3> colors(xRes * yRes);
+    for (unsigned int i = 0; i < colors.size(); i++) {
+        colors[i] = randomVec3(0.0, 1.0);
+    }
+
+    vector<float> legacy(totalValues);
+    for (int i = 0; i < totalValues; i++) {
+        legacy[i] = colors[i / 3][i % 3] * 255.0;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        legacyQuantize(&legacy[0], &pixels[0], totalValues);
+    }
+    double legacyTime = secondsSince(start) / repeats;
+    printf("%10s %8s %12s %12s %10s\n", "format", "layout", "ms/frame",
+           "speedup", "KB");
+    printf("%10s %8s %12.3f %12.2f %10.0f\n", "legacy", "rows",
+           legacyTime * 1000.0, 1.0, legacy.size() * sizeof(float) / 1024.0);
+
+    const char* formatNames[] = {"float32", "half", "uint8"};
+    const char* layoutNames[] = {"rows", "tiles"};
+    for (int f = 0; f < 3; f++)
+        for (int l = 0; l < 2; l++) {
+            Image image(xRes, yRes, (Image::Format)f, (Image::Layout)l);
+            for (int y = 0; y < yRes; y++)
+                for (int x = 0; x < xRes; x++) {
+                    image.setPixel(x, y, colors[y * xRes + x]);
+                }
+            start = chrono::steady_clock::now();
+            for (int r = 0; r < repeats; r++) {
+                image.toRGB8(&pixels[0]);
+            }
+            double imageTime = secondsSince(start) / repeats;
+            printf("%10s %8s %12.3f %12.2f %10.0f\n", formatNames[f],
+                   layoutNames[l], imageTime * 1000.0, legacyTime / imageTime,
+                   image.totalBytes() / 1024.0);
+        }
+}
+
+int main(int argc, char** argv) {
+    benchmarkBVH();
+    benchmarkRefit();
+    benchmarkPackets();
+    benchmarkCompiledScene();
+    benchmarkShadowRays();
+    benchmarkRenderSettings();
+    benchmarkSinglePrecision();
+    benchmarkMotionCache();
+    benchmarkBatchFK();
+    benchmarkCompressedMotion();
+    benchmarkPCAMotion();
+    benchmarkCrowd();
+    benchmarkMovieEncoding();
+    benchmarkImageConversion();
+    return 0;
+}
@@ -0,0 +1,421 @@
+#include "bvh.hpp"
+
+using namespace std;
+
+// number of buckets the centroids are binned into when evaluating splits
+static const int SAH_BINS = 16;
+
+// deepest tree we can traverse without overflowing the stack below
+static const int MAX_TRAVERSAL_DEPTH = 64;
+
+BVH::BVH() : maxLeafSize(4), traversalCost(1.0), intersectionCost(1.0) {}
+
+void BVH::build(const vector<Shape*>& shapes_) {
+    shapes = shapes_;
+    nodes.clear();
+    indices.resize(shapes.size());
+    shapeBounds.resize(shapes.size());
+    shapeCentroids.resize(shapes.size());
+    for (unsigned int i = 0; i < shapes.size(); i++) {
+        indices[i] = i;
+        shapeBounds[i] = shapes[i]->bounds();
+        shapeCentroids[i] = shapeBounds[i].centroid();
+    }
+
+    // a binary tree with n leaves has at most 2n - 1 nodes
+    nodes.reserve(std::max(1, 2 * (int)shapes.size() - 1));
+    BVHNode root;
+    root.leftOrFirst = 0;
+    root.count = shapes.size();
+    nodes.push_back(root);
+    updateNodeBounds(0);
+    if (shapes.size() > 0) {
+        subdivide(0, 1);
+    }
+
+    shapeBounds.clear();
+    shapeCentroids.clear();
+    updatePacketPrimitives();
+}
+
+void BVH::updatePacketPrimitives() {
+    packetPrimitives.resize(indices.size());
+    for (unsigned int i = 0; i < indices.size(); i++) {
+        PacketPrimitive& primitive = packetPrimitives[i];
+        Shape* shape = shapes[indices[i]];
+        Sphere* sphere = dynamic_cast<Sphere*>(shape);
+        Triangle* triangle = dynamic_cast<Triangle*>(shape);
+        if (sphere != NULL) {
+            primitive.type = PACKET_SPHERE;
+            for (int j = 0; j < 3; j++) {
+                primitive.data[j] = sphere->center[j];
+            }
+            primitive.data[3] = sphere->radius;
+        } else if (triangle != NULL) {
+            primitive.type = PACKET_TRIANGLE;
+            for (int j = 0; j < 3; j++) {
+                primitive.data[j] = triangle->a[j];
+                primitive.data[3 + j] = triangle->b[j] - triangle->a[j];
+                primitive.data[6 + j] = triangle->c[j] - triangle->a[j];
+            }
+        } else {
+            primitive.type = PACKET_OTHER;
+        }
+    }
+}
+
+void BVH::updateNodeBounds(int nodeIndex) {
+    BVHNode& node = nodes[nodeIndex];
+    node.bounds = AABB();
+    for (int i = 0; i < node.count; i++) {
+        node.bounds.expand(shapeBounds[indices[node.leftOrFirst + i]]);
+    }
+}
+
+Real BVH::findBestSplit(const BVHNode& node, int& bestAxis,
+                        Real& bestSplit) {
+    Real bestCost = INFINITY;
+
+    // bin over the centroid bounds rather than the node bounds, so that
+    // large shapes don't squeeze all the centroids into a single bin
+    AABB centroidBounds;
+    for (int i = 0; i < node.count; i++) {
+        centroidBounds.expand(shapeCentroids[indices[node.leftOrFirst + i]]);
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        Real low = centroidBounds.min[axis];
+        Real high = centroidBounds.max[axis];
+        if (low == high) {
+            continue;
+        }
+
+        AABB binBounds[SAH_BINS];
+        int binCounts[SAH_BINS] = {0};
+        Real scale = SAH_BINS / (high - low);
+        for (int i = 0; i < node.count; i++) {
+            int index = indices[node.leftOrFirst + i];
+            Real offset = shapeCentroids[index][axis] - low;
+            int bin = std::min(SAH_BINS - 1, (int)(offset * scale));
+            binCounts[bin]++;
+            binBounds[bin].expand(shapeBounds[index]);
+        }
+
+        // sweep from both ends to get the area and count on either side of
+        // every plane between bins
+        Real leftArea[SAH_BINS - 1];
+        Real rightArea[SAH_BINS - 1];
+        int leftCount[SAH_BINS - 1];
+        int rightCount[SAH_BINS - 1];
+        AABB leftBox;
+        AABB rightBox;
+        int leftSum = 0;
+        int rightSum = 0;
+        for (int i = 0; i < SAH_BINS - 1; i++) {
+            leftSum += binCounts[i];
+            leftCount[i] = leftSum;
+            leftBox.expand(binBounds[i]);
+            leftArea[i] = leftBox.halfArea();
+
+            rightSum += binCounts[SAH_BINS - 1 - i];
+            rightCount[SAH_BINS - 2 - i] = rightSum;
+            rightBox.expand(binBounds[SAH_BINS - 1 - i]);
+            rightArea[SAH_BINS - 2 - i] = rightBox.halfArea();
+        }
+
+        Real binWidth = (high - low) / SAH_BINS;
+        for (int i = 0; i < SAH_BINS - 1; i++) {
+            if (leftCount[i] == 0 || rightCount[i] == 0) {
+                continue;
+            }
+            Real cost =
+                leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = low + binWidth * (i + 1);
+            }
+        }
+    }
+    return bestCost;
+}
+
+void BVH::subdivide(int nodeIndex, int depth) {
+    BVHNode node = nodes[nodeIndex];
+    // the traversal stack never holds more than one entry per level
+    if (node.count <= 1 || depth >= MAX_TRAVERSAL_DEPTH) {
+        return;
+    }
+
+    // find the cheapest split, and compare it against just making a leaf
+    int axis = 0;
+    Real split = 0.0;
+    Real splitCost = findBestSplit(node, axis, split);
+    Real parentArea = node.bounds.halfArea();
+    Real leafCost = intersectionCost * node.count;
+    if (parentArea > 0.0) {
+        splitCost = traversalCost + intersectionCost * splitCost / parentArea;
+    }
+    if (splitCost >= leafCost && node.count <= maxLeafSize) {
+        return;
+    }
+
+    // partition the indices in place
+    int first = node.leftOrFirst;
+    int last = first + node.count - 1;
+    int i = first;
+    if (splitCost < INFINITY) {
+        while (i <= last) {
+            if (shapeCentroids[indices[i]][axis] < split) {
+                i++;
+            } else {
+                std::swap(indices[i], indices[last--]);
+            }
+        }
+    }
+
+    // all centroids coincide, so the SAH has nothing to go on. fall back
+    // to splitting the list in half so that oversized leaves still shrink
+    int leftCount = i - first;
+    if (leftCount == 0 || leftCount == node.count) {
+        if (node.count <= maxLeafSize) {
+            return;
+        }
+        leftCount = node.count / 2;
+    }
+
+    int leftIndex = nodes.size();
+    BVHNode left;
+    left.leftOrFirst = first;
+    left.count = leftCount;
+    BVHNode right;
+    right.leftOrFirst = first + leftCount;
+    right.count = node.count - leftCount;
+    nodes.push_back(left);
+    nodes.push_back(right);
+
+    nodes[nodeIndex].leftOrFirst = leftIndex;
+    nodes[nodeIndex].count = 0;
+
+    updateNodeBounds(leftIndex);
+    updateNodeBounds(leftIndex + 1);
+    subdivide(leftIndex, depth + 1);
+    subdivide(leftIndex + 1, depth + 1);
+}
+
+AABB BVH::bounds() const {
+    if (nodes.size() == 0) {
+        return AABB();
+    }
+    return nodes[0].bounds;
+}
+
+void BVH::refit() {
+    // children are always stored after their parent, so a backwards sweep
+    // sees both children before it reaches the parent
+    for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+        BVHNode& node = nodes[i];
+        node.bounds = AABB();
+        if (node.isLeaf()) {
+            for (int j = 0; j < node.count; j++) {
+                Shape* shape = shapes[indices[node.leftOrFirst + j]];
+                node.bounds.expand(shape->bounds());
+            }
+        } else {
+            node.bounds.expand(nodes[node.leftOrFirst].bounds);
+            node.bounds.expand(nodes[node.leftOrFirst + 1].bounds);
+        }
+    }
+    updatePacketPrimitives();
+}
+
+Real BVH::cost() const {
+    if (nodes.size() == 0 || nodes[0].bounds.halfArea() <= 0.0) {
+        return 0.0;
+    }
+    // expected cost of a random ray that hits the root, per the SAH
+    Real total = 0.0;
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        const BVHNode& node = nodes[i];
+        Real area = node.bounds.halfArea();
+        if (node.isLeaf()) {
+            total += intersectionCost * node.count * area;
+        } else {
+            total += traversalCost * area;
+        }
+    }
+    return total / nodes[0].bounds.halfArea();
+}
+
+IntersectResult BVH::intersect(Ray ray, Real tLow) {
+    return intersect(ray, tLow, INFINITY);
+}
+
+IntersectResult BVH::intersect(Ray ray, Real tLow, Real tHigh) {
+    return intersectSubtree(0, ray, tLow, tHigh);
+}
+
+IntersectResult BVH::intersectSubtree(int nodeIndex, Ray ray, Real tLow,
+                                      Real tHigh) {
+    IntersectResult closestValidIntersection = IntersectResult();
+    if (shapes.size() == 0) {
+        return closestValidIntersection;
+    }
+
+    VEC3 invDirection = VEC3(1.0 / ray.direction[0], 1.0 / ray.direction[1],
+                             1.0 / ray.direction[2]);
+    Real closestT = tHigh;
+    Real tNear;
+
+    int stack[MAX_TRAVERSAL_DEPTH];
+    int stackSize = 0;
+    stack[stackSize++] = nodeIndex;
+    while (stackSize > 0) {
+        const BVHNode& node = nodes[stack[--stackSize]];
+
+        // the box may have been hit before a closer shape was found
+        if (!node.bounds.intersect(ray.origin, invDirection, tLow, closestT,
+                                   tNear)) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.count; i++) {
+                IntersectResult result =
+                    shapes[indices[node.leftOrFirst + i]]->intersect(ray);
+                if (result.doesIntersect == true) {
+                    if (result.t >= tLow && result.t < closestT) {
+                        closestT = result.t;
+                        closestValidIntersection = result;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // visit the nearer child first, so closestT shrinks sooner
+        int left = node.leftOrFirst;
+        int right = left + 1;
+        Real tLeft = INFINITY;
+        Real tRight = INFINITY;
+        bool hitLeft = nodes[left].bounds.intersect(ray.origin, invDirection,
+                                                    tLow, closestT, tLeft);
+        bool hitRight = nodes[right].bounds.intersect(
+            ray.origin, invDirection, tLow, closestT, tRight);
+        if (hitLeft && hitRight) {
+            if (tLeft < tRight) {
+                stack[stackSize++] = right;
+                stack[stackSize++] = left;
+            } else {
+                stack[stackSize++] = left;
+                stack[stackSize++] = right;
+            }
+        } else if (hitLeft) {
+            stack[stackSize++] = left;
+        } else if (hitRight) {
+            stack[stackSize++] = right;
+        }
+    }
+    return closestValidIntersection;
+}
+
+bool BVH::occluded(Ray ray, Real tMax, Shape*& occluder) {
+    if (shapes.size() == 0) {
+        return false;
+    }
+
+    VEC3 invDirection = VEC3(1.0 / ray.direction[0], 1.0 / ray.direction[1],
+                             1.0 / ray.direction[2]);
+    Real tNear;
+
+    // any blocker will do, so there's no point sorting the children
+    int stack[MAX_TRAVERSAL_DEPTH];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const BVHNode& node = nodes[stack[--stackSize]];
+        if (!node.bounds.intersect(ray.origin, invDirection, 0.0, tMax,
+                                   tNear)) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.count; i++) {
+                Shape* shape = shapes[indices[node.leftOrFirst + i]];
+                IntersectResult result = shape->intersect(ray);
+                if (result.doesIntersect && result.t >= 0.0 &&
+                    result.t < tMax) {
+                    occluder = shape;
+                    return true;
+                }
+            }
+            continue;
+        }
+        stack[stackSize++] = node.leftOrFirst + 1;
+        stack[stackSize++] = node.leftOrFirst;
+    }
+    return false;
+}
+
+SceneBVH::SceneBVH() : rebuildThreshold(2.0), dynamicBuildCost(0.0) {}
+
+void SceneBVH::buildStatic(const vector<Shape*>& shapes) {
+    staticBVH.build(shapes);
+}
+
+void SceneBVH::buildDynamic(const vector<Shape*>& shapes) {
+    dynamicShapes = shapes;
+    dynamicBVH.build(dynamicShapes);
+    dynamicBuildCost = dynamicBVH.cost();
+}
+
+void SceneBVH::refitDynamic() {
+    dynamicBVH.refit();
+    if (dynamicBVH.cost() > rebuildThreshold * dynamicBuildCost) {
+        buildDynamic(dynamicShapes);
+    }
+}
+
+IntersectResult SceneBVH::intersect(Ray ray, Real tLow) {
+    IntersectResult closest = staticBVH.intersect(ray, tLow);
+    // only look for bones in front of whatever static geometry got hit
+    Real tHigh = closest.doesIntersect ? closest.t : INFINITY;
+    IntersectResult bone = dynamicBVH.intersect(ray, tLow, tHigh);
+    if (bone.doesIntersect) {
+        return bone;
+    }
+    return closest;
+}
+
+bool SceneBVH::occluded(Ray ray, Real tMax, Shape*& occluder) {
+    // the bones are few and sit right on top of the floor, so they are the
+    // likelier blockers
+    return dynamicBVH.occluded(ray, tMax, occluder) ||
+           staticBVH.occluded(ray, tMax, occluder);
+}
+
+ShapeGroup::ShapeGroup(const vector<Shape*>& shapes, VEC3 color,
+                       Material type, Real refractiveIndex, Texture* texture)
+    : Shape(color, type, refractiveIndex, texture),
+      rebuildThreshold(2.0),
+      shapes(shapes) {
+    build();
+}
+
+void ShapeGroup::build() {
+    bvh.build(shapes);
+    buildCost = bvh.cost();
+}
+
+void ShapeGroup::update() {
+    bvh.refit();
+    if (bvh.cost() > rebuildThreshold * buildCost) {
+        build();
+    }
+}
+
+IntersectResult ShapeGroup::intersect(Ray ray) {
+    return bvh.intersect(ray, 0.0);
+}
+
+AABB ShapeGroup::bounds() { return bvh.bounds(); }
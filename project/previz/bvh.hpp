@@ -0,0 +1,158 @@
+#pragma once
+
+#include <assert.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "SETTINGS.h"
+#include "aabb.hpp"
+#include "shapes.hpp"
+#include "tracer.hpp"
+
+using namespace std;
+
+// one node of the flattened tree. interior nodes store the index of their
+// left child (the right child is always left + 1), leaves store a range
+// into the primitive index list
+class BVHNode {
+   public:
+    AABB bounds;
+    int leftOrFirst;
+    int count;
+
+    bool isLeaf() const { return count > 0; }
+};
+
+enum PacketShape { PACKET_SPHERE, PACKET_TRIANGLE, PACKET_OTHER };
+
+// single precision copy of a leaf shape for the packet kernels (packet.hpp).
+// spheres store center and radius, triangles store a, b - a and c - a.
+// everything else is traced one ray at a time
+class PacketPrimitive {
+   public:
+    int type;
+    float data[9];
+};
+
+// bounding volume hierarchy over a list of shapes, built top down with a
+// binned surface area heuristic
+class BVH : public Accelerator {
+   public:
+    BVH();
+
+    // build over the given shapes. the BVH keeps a copy of the pointers,
+    // but does not own the shapes
+    void build(const vector<Shape*>& shapes);
+
+    IntersectResult intersect(Ray ray, Real tLow);
+
+    // only report hits closer than tHigh
+    IntersectResult intersect(Ray ray, Real tLow, Real tHigh);
+
+    // any-hit query, stops at the first shape hit in [0, tMax)
+    bool occluded(Ray ray, Real tMax, Shape*& occluder);
+
+    // same, but starting the traversal at the given node
+    IntersectResult intersectSubtree(int nodeIndex, Ray ray, Real tLow,
+                                     Real tHigh);
+
+    // recompute the node bounds after the shapes have moved, keeping the
+    // tree topology from the last build()
+    void refit();
+
+    // SAH cost of the current tree, used to decide when a refit tree has
+    // degraded enough to be worth rebuilding
+    Real cost() const;
+
+    AABB bounds() const;
+    int totalNodes() const { return nodes.size(); }
+    int totalShapes() const { return shapes.size(); }
+
+    // read-only access for the packet tracer. leaf primitives are numbered
+    // by their position in the leaf ranges, not by their input order
+    const vector<BVHNode>& getNodes() const { return nodes; }
+    const vector<PacketPrimitive>& getPacketPrimitives() const {
+        return packetPrimitives;
+    }
+    Shape* leafShape(int i) const { return shapes[indices[i]]; }
+
+    // SAH tuning
+    int maxLeafSize;
+    Real traversalCost;
+    Real intersectionCost;
+
+   protected:
+    vector<Shape*> shapes;
+    vector<int> indices;
+    vector<BVHNode> nodes;
+    vector<PacketPrimitive> packetPrimitives;
+
+    // per-shape build inputs, only valid during build()
+    vector<AABB> shapeBounds;
+    vector<VEC3> shapeCentroids;
+
+    void subdivide(int nodeIndex, int depth);
+    void updateNodeBounds(int nodeIndex);
+    Real findBestSplit(const BVHNode& node, int& bestAxis, Real& bestSplit);
+    void updatePacketPrimitives();
+};
+
+// two-level acceleration structure for the animated scene: a top-level BVH
+// over the static set dressing that is built once and kept for the whole
+// shot, plus a small bottom-level BVH over the skeleton bones that is only
+// refit when they move
+class SceneBVH : public Accelerator {
+   public:
+    SceneBVH();
+
+    void buildStatic(const vector<Shape*>& shapes);
+    void buildDynamic(const vector<Shape*>& shapes);
+
+    // call after the dynamic shapes have been updated in place. rebuilds
+    // instead when refitting has made the tree too loose
+    void refitDynamic();
+
+    IntersectResult intersect(Ray ray, Real tLow);
+    bool occluded(Ray ray, Real tMax, Shape*& occluder);
+
+    BVH staticBVH;
+    BVH dynamicBVH;
+
+    // rebuild the dynamic BVH once its SAH cost grows past this multiple
+    // of its cost right after the last build
+    Real rebuildThreshold;
+
+   protected:
+    vector<Shape*> dynamicShapes;
+    Real dynamicBuildCost;
+};
+
+// several shapes behind a BVH of their own, traced as a single shape so the
+// whole group can be instanced (e.g. a posed skeleton, or a crowd of them).
+// hits report the member shape, not the group. like the BVH, it doesn't own
+// the shapes
+class ShapeGroup : public Shape {
+   public:
+    ShapeGroup(const vector<Shape*>& shapes, VEC3 color, Material type,
+               Real refractiveIndex, Texture* texture);
+
+    // call after the member shapes have moved. refits, or rebuilds once
+    // refitting has made the tree too loose, like SceneBVH::refitDynamic()
+    void update();
+
+    IntersectResult intersect(Ray ray);
+    AABB bounds();
+
+    BVH bvh;
+    Real rebuildThreshold;
+
+   protected:
+    vector<Shape*> shapes;
+    Real buildCost;
+
+    void build();
+};
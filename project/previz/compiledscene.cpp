@@ -0,0 +1,427 @@
+#include "compiledscene.hpp"
+
+using namespace std;
+
+// primitives are tested this many at a time: one branch-free pass that
+// the compiler can vectorize computes all the distances, then a short
+// scalar pass picks the closest
+static const int BATCH_SIZE = 64;
+
+// how far off a single precision distance or barycentric coordinate may be
+// and still be worth checking in double. zero when the blocks are stored
+// in double, since then the scan is exact
+template <class Scalar>
+static inline Scalar scanSlack() {
+    return (sizeof(Scalar) < sizeof(Real)) ? (Scalar)1e-4 : (Scalar)0.0;
+}
+
+template <class Scalar>
+CompiledSceneT<Scalar>::CompiledSceneT() {}
+
+template <class Scalar>
+int CompiledSceneT<Scalar>::findMaterial(Shape* shape) {
+    for (unsigned int i = 0; i < materials.size(); i++) {
+        if (materials[i] == shape->material) {
+            return i;
+        }
+    }
+    materials.push_back(shape->material);
+    return materials.size() - 1;
+}
+
+template <class Scalar>
+void CompiledSceneT<Scalar>::build(const vector<Shape*>& shapes_) {
+    shapes = shapes_;
+    materials.clear();
+    spheres = SphereBlock();
+    triangles = TriangleBlock();
+    cylinders = CylinderBlock();
+    others.clear();
+
+    for (unsigned int i = 0; i < shapes.size(); i++) {
+        Shape* shape = shapes[i];
+        if (dynamic_cast<Sphere*>(shape) != NULL) {
+            spheres.source.push_back(shape);
+            spheres.material.push_back(findMaterial(shape));
+        } else if (dynamic_cast<Triangle*>(shape) != NULL) {
+            triangles.source.push_back(shape);
+            triangles.material.push_back(findMaterial(shape));
+        } else if (dynamic_cast<Cylinder*>(shape) != NULL) {
+            cylinders.source.push_back(shape);
+            cylinders.material.push_back(findMaterial(shape));
+        } else {
+            others.push_back(shape);
+        }
+    }
+
+    int totalSpheres = spheres.source.size();
+    spheres.centerX.resize(totalSpheres);
+    spheres.centerY.resize(totalSpheres);
+    spheres.centerZ.resize(totalSpheres);
+    spheres.radius.resize(totalSpheres);
+
+    int totalTriangles = triangles.source.size();
+    triangles.aX.resize(totalTriangles);
+    triangles.aY.resize(totalTriangles);
+    triangles.aZ.resize(totalTriangles);
+    triangles.edge1X.resize(totalTriangles);
+    triangles.edge1Y.resize(totalTriangles);
+    triangles.edge1Z.resize(totalTriangles);
+    triangles.edge2X.resize(totalTriangles);
+    triangles.edge2Y.resize(totalTriangles);
+    triangles.edge2Z.resize(totalTriangles);
+
+    int totalCylinders = cylinders.source.size();
+    for (int i = 0; i < 9; i++) {
+        cylinders.toLocal[i].resize(totalCylinders);
+    }
+    cylinders.originX.resize(totalCylinders);
+    cylinders.originY.resize(totalCylinders);
+    cylinders.originZ.resize(totalCylinders);
+    cylinders.radius.resize(totalCylinders);
+    cylinders.length.resize(totalCylinders);
+
+    update();
+}
+
+template <class Scalar>
+void CompiledSceneT<Scalar>::readSphere(int index, Sphere* sphere) {
+    spheres.centerX[index] = sphere->center[0];
+    spheres.centerY[index] = sphere->center[1];
+    spheres.centerZ[index] = sphere->center[2];
+    spheres.radius[index] = sphere->radius;
+}
+
+template <class Scalar>
+void CompiledSceneT<Scalar>::readTriangle(int index, Triangle* triangle) {
+    VEC3 edge1 = triangle->b - triangle->a;
+    VEC3 edge2 = triangle->c - triangle->a;
+    triangles.aX[index] = triangle->a[0];
+    triangles.aY[index] = triangle->a[1];
+    triangles.aZ[index] = triangle->a[2];
+    triangles.edge1X[index] = edge1[0];
+    triangles.edge1Y[index] = edge1[1];
+    triangles.edge1Z[index] = edge1[2];
+    triangles.edge2X[index] = edge2[0];
+    triangles.edge2Y[index] = edge2[1];
+    triangles.edge2Z[index] = edge2[2];
+}
+
+template <class Scalar>
+void CompiledSceneT<Scalar>::readCylinder(int index, Cylinder* cylinder) {
+    // the same transform Cylinder::intersect uses
+    const MATRIX4& modelTransform = cylinder->worldToLocal;
+    for (int row = 0; row < 3; row++)
+        for (int column = 0; column < 3; column++) {
+            cylinders.toLocal[3 * row + column][index] =
+                modelTransform(row, column);
+        }
+    cylinders.originX[index] = cylinder->translation[0];
+    cylinders.originY[index] = cylinder->translation[1];
+    cylinders.originZ[index] = cylinder->translation[2];
+    cylinders.radius[index] = cylinder->radius;
+    cylinders.length[index] = cylinder->length;
+}
+
+template <class Scalar>
+void CompiledSceneT<Scalar>::update() {
+    for (unsigned int i = 0; i < spheres.source.size(); i++) {
+        readSphere(i, (Sphere*)spheres.source[i]);
+    }
+    for (unsigned int i = 0; i < triangles.source.size(); i++) {
+        readTriangle(i, (Triangle*)triangles.source[i]);
+    }
+    for (unsigned int i = 0; i < cylinders.source.size(); i++) {
+        readCylinder(i, (Cylinder*)cylinders.source[i]);
+    }
+}
+
+template <class Scalar>
+void CompiledSceneT<Scalar>::pickClosest(const Scalar* t,
+                                         Shape* const* source,
+                                         const int* material, int count,
+                                         const Ray& ray, Real tLow,
+                                         Real& closestT, Shape*& closest,
+                                         int& closestMaterial) const {
+    const Scalar slack = scanSlack<Scalar>();
+    if (slack == 0.0) {
+        for (int i = 0; i < count; i++) {
+            if (t[i] >= tLow && t[i] < closestT) {
+                closestT = t[i];
+                closest = source[i];
+                closestMaterial = material[i];
+            }
+        }
+        return;
+    }
+
+    // single precision: anything close enough is checked in double
+    for (int i = 0; i < count; i++) {
+        if (t[i] < tLow - slack || t[i] >= closestT * (1.0 + slack) + slack) {
+            continue;
+        }
+        IntersectResult result = source[i]->intersect(ray);
+        if (result.doesIntersect && result.t >= tLow && result.t < closestT) {
+            closestT = result.t;
+            closest = source[i];
+            closestMaterial = material[i];
+        }
+    }
+}
+
+// same arithmetic as Sphere::intersect
+template <class Scalar>
+void CompiledSceneT<Scalar>::intersectSpheres(const Ray& ray, Real tLow,
+                                              Real& closestT, Shape*& closest,
+                                              int& closestMaterial) const {
+    const Scalar originX = ray.origin[0];
+    const Scalar originY = ray.origin[1];
+    const Scalar originZ = ray.origin[2];
+    const Scalar directionX = ray.direction[0];
+    const Scalar directionY = ray.direction[1];
+    const Scalar directionZ = ray.direction[2];
+    const Scalar A = ray.direction.dot(ray.direction);
+
+    const Scalar* centerX = spheres.centerX.data();
+    const Scalar* centerY = spheres.centerY.data();
+    const Scalar* centerZ = spheres.centerZ.data();
+    const Scalar* radius = spheres.radius.data();
+    const Scalar slack = scanSlack<Scalar>();
+    const Scalar zero = 0.0;
+    const Scalar two = 2.0;
+    const Scalar four = 4.0;
+
+    Scalar t[BATCH_SIZE];
+    int total = spheres.radius.size();
+    for (int start = 0; start < total; start += BATCH_SIZE) {
+        int count = std::min(BATCH_SIZE, total - start);
+        for (int i = 0; i < count; i++) {
+            int j = start + i;
+            Scalar ocX = originX - centerX[j];
+            Scalar ocY = originY - centerY[j];
+            Scalar ocZ = originZ - centerZ[j];
+            Scalar B = two * (directionX * ocX + directionY * ocY +
+                              directionZ * ocZ);
+            Scalar C =
+                (ocX * ocX + ocY * ocY + ocZ * ocZ) - radius[j] * radius[j];
+            Scalar discriminant = (B * B) - (four * A * C);
+            Scalar root = sqrt(std::max(discriminant, zero));
+            Scalar t1 = (-B + root) / (two * A);
+            Scalar t2 = (-B - root) / (two * A);
+            Scalar hit = (t2 < zero) ? t1 : t2;
+            // in float B * B and 4AC nearly cancel for small, far away
+            // spheres, so grazing rays get some room and a check in double
+            t[i] = (discriminant < -slack * B * B) ? INFINITY : hit;
+        }
+        pickClosest(t, &spheres.source[start], &spheres.material[start],
+                    count, ray, tLow, closestT, closest, closestMaterial);
+    }
+}
+
+// same arithmetic as Triangle::intersect (Moller-Trumbore)
+template <class Scalar>
+void CompiledSceneT<Scalar>::intersectTriangles(const Ray& ray, Real tLow,
+                                                Real& closestT, Shape*& closest,
+                                                int& closestMaterial) const {
+    const Scalar originX = ray.origin[0];
+    const Scalar originY = ray.origin[1];
+    const Scalar originZ = ray.origin[2];
+    const Scalar directionX = ray.direction[0];
+    const Scalar directionY = ray.direction[1];
+    const Scalar directionZ = ray.direction[2];
+
+    const Scalar* aX = triangles.aX.data();
+    const Scalar* aY = triangles.aY.data();
+    const Scalar* aZ = triangles.aZ.data();
+    const Scalar* edge1X = triangles.edge1X.data();
+    const Scalar* edge1Y = triangles.edge1Y.data();
+    const Scalar* edge1Z = triangles.edge1Z.data();
+    const Scalar* edge2X = triangles.edge2X.data();
+    const Scalar* edge2Y = triangles.edge2Y.data();
+    const Scalar* edge2Z = triangles.edge2Z.data();
+    const Scalar epsilon = CUSTOM_EPSILON;
+    const Scalar low = -scanSlack<Scalar>();
+    const Scalar high = 1.0 + scanSlack<Scalar>();
+    const Scalar one = 1.0;
+
+    Scalar t[BATCH_SIZE];
+    int total = triangles.aX.size();
+    for (int start = 0; start < total; start += BATCH_SIZE) {
+        int count = std::min(BATCH_SIZE, total - start);
+        for (int i = 0; i < count; i++) {
+            int j = start + i;
+            // h = direction x edge2
+            Scalar hX = directionY * edge2Z[j] - directionZ * edge2Y[j];
+            Scalar hY = directionZ * edge2X[j] - directionX * edge2Z[j];
+            Scalar hZ = directionX * edge2Y[j] - directionY * edge2X[j];
+            Scalar v_a = edge1X[j] * hX + edge1Y[j] * hY + edge1Z[j] * hZ;
+            Scalar v_f = one / v_a;
+
+            Scalar sX = originX - aX[j];
+            Scalar sY = originY - aY[j];
+            Scalar sZ = originZ - aZ[j];
+            Scalar v_u = v_f * (sX * hX + sY * hY + sZ * hZ);
+
+            // q = s x edge1
+            Scalar qX = sY * edge1Z[j] - sZ * edge1Y[j];
+            Scalar qY = sZ * edge1X[j] - sX * edge1Z[j];
+            Scalar qZ = sX * edge1Y[j] - sY * edge1X[j];
+            Scalar v_v =
+                v_f * (directionX * qX + directionY * qY + directionZ * qZ);
+            Scalar hit =
+                v_f * (edge2X[j] * qX + edge2Y[j] * qY + edge2Z[j] * qZ);
+
+            // | rather than ||, so there are no branches to vectorize around
+            bool parallel = (v_a > -epsilon) & (v_a < epsilon);
+            bool outside = (v_u < low) | (v_u > high) | (v_v < low) |
+                           (v_u + v_v > high);
+            t[i] = (parallel || outside) ? INFINITY : hit;
+        }
+        pickClosest(t, &triangles.source[start], &triangles.material[start],
+                    count, ray, tLow, closestT, closest, closestMaterial);
+    }
+}
+
+// same arithmetic as Cylinder::intersect
+template <class Scalar>
+void CompiledSceneT<Scalar>::intersectCylinders(const Ray& ray, Real tLow,
+                                                Real& closestT, Shape*& closest,
+                                                int& closestMaterial) const {
+    const Scalar originX = ray.origin[0];
+    const Scalar originY = ray.origin[1];
+    const Scalar originZ = ray.origin[2];
+    const Scalar directionX = ray.direction[0];
+    const Scalar directionY = ray.direction[1];
+    const Scalar directionZ = ray.direction[2];
+
+    const Scalar* m[9];
+    for (int i = 0; i < 9; i++) {
+        m[i] = cylinders.toLocal[i].data();
+    }
+    const Scalar* boneX = cylinders.originX.data();
+    const Scalar* boneY = cylinders.originY.data();
+    const Scalar* boneZ = cylinders.originZ.data();
+    const Scalar* radius = cylinders.radius.data();
+    const Scalar* length = cylinders.length.data();
+    const Scalar epsilon = CUSTOM_EPSILON;
+    const Scalar slack = scanSlack<Scalar>();
+    const Scalar rootSlack = sqrt(slack);
+    const Scalar zero = 0.0;
+    const Scalar two = 2.0;
+    const Scalar four = 4.0;
+
+    Scalar t[BATCH_SIZE];
+    int total = cylinders.radius.size();
+    for (int start = 0; start < total; start += BATCH_SIZE) {
+        int count = std::min(BATCH_SIZE, total - start);
+        for (int i = 0; i < count; i++) {
+            int j = start + i;
+            // the ray in the bone's frame
+            Scalar pX = originX - boneX[j];
+            Scalar pY = originY - boneY[j];
+            Scalar pZ = originZ - boneZ[j];
+            Scalar localOriginX = m[0][j] * pX + m[1][j] * pY + m[2][j] * pZ;
+            Scalar localOriginY = m[3][j] * pX + m[4][j] * pY + m[5][j] * pZ;
+            Scalar localOriginZ = m[6][j] * pX + m[7][j] * pY + m[8][j] * pZ;
+            Scalar localDirectionX = m[0][j] * directionX +
+                                     m[1][j] * directionY +
+                                     m[2][j] * directionZ;
+            Scalar localDirectionY = m[3][j] * directionX +
+                                     m[4][j] * directionY +
+                                     m[5][j] * directionZ;
+            Scalar localDirectionZ = m[6][j] * directionX +
+                                     m[7][j] * directionY +
+                                     m[8][j] * directionZ;
+
+            // canonical cylinder around the local z axis
+            Scalar a = (localDirectionX * localDirectionX) +
+                       (localDirectionY * localDirectionY);
+            Scalar b = (two * localOriginX * localDirectionX) +
+                       (two * localOriginY * localDirectionY);
+            Scalar c = (localOriginX * localOriginX) +
+                       (localOriginY * localOriginY) - (radius[j] * radius[j]);
+            Scalar discriminant = (b * b) - (four * a * c);
+            Scalar root = sqrt(std::max(discriminant, zero));
+            Scalar t1 = (-b + root) / (two * a);
+            Scalar t2 = (-b - root) / (two * a);
+            Scalar hit = (t2 < zero + epsilon) ? t1 : t2;
+
+            // thin, far away bones cancel in float like the spheres do, so
+            // the discriminant gets the same room. the root of a grazing
+            // ray is then only good to about sqrt(slack * b * b), which
+            // widens the caps and pulls the distance in by as much; the
+            // double check in pickClosest settles it
+            Scalar spread = zero;
+            if (slack != zero) {
+                spread = slack * b * b /
+                         ((rootSlack * fabs(b) + root) * two * a);
+            }
+            Scalar zSlack = slack + fabs(localDirectionZ) * spread;
+
+            // and capped at either end
+            Scalar z = localOriginZ + localDirectionZ * hit;
+            bool miss = (discriminant < epsilon - slack * b * b) |
+                        (z < -zSlack) | (z > length[j] + zSlack);
+            t[i] = miss ? INFINITY : hit - spread;
+        }
+        pickClosest(t, &cylinders.source[start], &cylinders.material[start],
+                    count, ray, tLow, closestT, closest, closestMaterial);
+    }
+}
+
+template <class Scalar>
+IntersectResult CompiledSceneT<Scalar>::intersect(Ray ray, Real tLow) {
+    Real closestT = INFINITY;
+    Shape* closest = NULL;
+    int closestMaterial = -1;
+    intersectSpheres(ray, tLow, closestT, closest, closestMaterial);
+    intersectTriangles(ray, tLow, closestT, closest, closestMaterial);
+    intersectCylinders(ray, tLow, closestT, closest, closestMaterial);
+    for (unsigned int i = 0; i < others.size(); i++) {
+        IntersectResult result = others[i]->intersect(ray);
+        if (result.doesIntersect && result.t >= tLow && result.t < closestT) {
+            closestT = result.t;
+            closest = others[i];
+            closestMaterial = -1;
+        }
+    }
+
+    // only now go back to the real shape, for the point and normal. the
+    // material comes from the table, except for the other shapes
+    if (closest == NULL) {
+        return IntersectResult();
+    }
+    IntersectResult result = closest->intersect(ray);
+    if (closestMaterial >= 0) {
+        result.material = &materials[closestMaterial];
+    }
+    return result;
+}
+
+template <class Scalar>
+bool CompiledSceneT<Scalar>::occluded(Ray ray, Real tMax, Shape*& occluder) {
+    Real closestT = tMax;
+    Shape* closest = NULL;
+    int closestMaterial = -1;
+    intersectSpheres(ray, 0.0, closestT, closest, closestMaterial);
+    if (closest == NULL) {
+        intersectTriangles(ray, 0.0, closestT, closest, closestMaterial);
+    }
+    if (closest == NULL) {
+        intersectCylinders(ray, 0.0, closestT, closest, closestMaterial);
+    }
+    for (unsigned int i = 0; closest == NULL && i < others.size(); i++) {
+        IntersectResult result = others[i]->intersect(ray);
+        if (result.doesIntersect && result.t >= 0.0 && result.t < tMax) {
+            closest = others[i];
+        }
+    }
+    if (closest == NULL) {
+        return false;
+    }
+    occluder = closest;
+    return true;
+}
+
+template class CompiledSceneT<double>;
+template class CompiledSceneT<float>;
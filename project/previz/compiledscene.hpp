@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "shapes.hpp"
+#include "tracer.hpp"
+
+using namespace std;
+
+// flattened copy of a list of shapes for tracing. spheres, triangles and
+// bones each live in their own structure-of-arrays block, and the hot loop
+// runs over one block at a time with no virtual calls and no strings,
+// colors or textures in the way. each primitive only carries the index of
+// its entry in a shared material table, and the closest hit is shaded from
+// that entry.
+//
+// the original shapes are only touched once per ray, to fill in the point
+// and normal of the closest hit.
+//
+// Scalar is what the blocks are stored and scanned in. in double the scan
+// gives exactly the same hits as the shapes themselves. in float the blocks
+// take half the memory and twice as many primitives fit in a SIMD
+// register, but the distances are only good enough to pick candidates:
+// each candidate is checked against its shape in double before it counts,
+// so hits can only go missing (at silhouettes), never appear from nowhere
+template <class Scalar>
+class CompiledSceneT : public Accelerator {
+   public:
+    CompiledSceneT();
+
+    // compile the given shapes. keeps pointers to them, but doesn't own them
+    void build(const vector<Shape*>& shapes);
+
+    // re-read the geometry after the shapes moved (e.g. the bones), keeping
+    // the layout and material table from build()
+    void update();
+
+    IntersectResult intersect(Ray ray, Real tLow);
+
+    // scans one block at a time, and stops after the first block with a hit
+    bool occluded(Ray ray, Real tMax, Shape*& occluder);
+
+    int totalShapes() const { return shapes.size(); }
+    int totalMaterials() const { return materials.size(); }
+
+    vector<MaterialInfo> materials;
+
+   protected:
+    class SphereBlock {
+       public:
+        vector<Scalar> centerX, centerY, centerZ;
+        vector<Scalar> radius;
+        vector<int> material;
+        vector<Shape*> source;
+    };
+
+    // vertex a plus the two edges leaving it, as Moller-Trumbore wants them
+    class TriangleBlock {
+       public:
+        vector<Scalar> aX, aY, aZ;
+        vector<Scalar> edge1X, edge1Y, edge1Z;
+        vector<Scalar> edge2X, edge2Y, edge2Z;
+        vector<int> material;
+        vector<Shape*> source;
+    };
+
+    // bones keep the world-to-bone transform (the inverse of rotation *
+    // scaling, row by row) and the bone origin, so the canonical test along
+    // the local z axis needs no matrix inverse per ray
+    class CylinderBlock {
+       public:
+        vector<Scalar> toLocal[9];
+        vector<Scalar> originX, originY, originZ;
+        vector<Scalar> radius;
+        vector<Scalar> length;
+        vector<int> material;
+        vector<Shape*> source;
+    };
+
+    vector<Shape*> shapes;
+    SphereBlock spheres;
+    TriangleBlock triangles;
+    CylinderBlock cylinders;
+
+    // anything that isn't one of the above still goes through its vtable
+    vector<Shape*> others;
+
+    int findMaterial(Shape* shape);
+    void readSphere(int index, Sphere* sphere);
+    void readTriangle(int index, Triangle* triangle);
+    void readCylinder(int index, Cylinder* cylinder);
+
+    // each keeps closest, and the material table index of the closest,
+    // up to date
+    void intersectSpheres(const Ray& ray, Real tLow, Real& closestT,
+                          Shape*& closest, int& closestMaterial) const;
+    void intersectTriangles(const Ray& ray, Real tLow, Real& closestT,
+                            Shape*& closest, int& closestMaterial) const;
+    void intersectCylinders(const Ray& ray, Real tLow, Real& closestT,
+                            Shape*& closest, int& closestMaterial) const;
+
+    // the scalar pass over one batch of distances
+    void pickClosest(const Scalar* t, Shape* const* source,
+                     const int* material, int count, const Ray& ray,
+                     Real tLow, Real& closestT, Shape*& closest,
+                     int& closestMaterial) const;
+};
+
+typedef CompiledSceneT<Real> CompiledScene;
+typedef CompiledSceneT<float> CompiledSceneFloat;
@@ -0,0 +1,256 @@
+#include "compressedmotion.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+typedef Quaternion<Real> QUATERNION;
+
+// greedy key reduction over frames [0, frames): every key reaches as far
+// ahead as fits(key, next) allows the frames in between to be interpolated.
+// the reach is found by doubling and then bisecting, so long flat stretches
+// take a handful of checks instead of one per frame
+template <typename Fits>
+static void reduceKeys(int frames, const Fits& fits, vector<int>& keys) {
+    keys.clear();
+    keys.push_back(0);
+    int start = 0;
+    while (start < frames - 1) {
+        // neighbouring frames need nothing interpolated between them
+        int good = start + 1;
+        int bad = frames;
+        while (good < frames - 1 && bad == frames) {
+            int next = std::min(start + 2 * (good - start), frames - 1);
+            if (fits(start, next)) {
+                good = next;
+            } else {
+                bad = next;
+            }
+        }
+        while (bad < frames && bad - good > 1) {
+            int middle = (good + bad) / 2;
+            if (fits(start, middle)) {
+                good = middle;
+            } else {
+                bad = middle;
+            }
+        }
+        keys.push_back(good);
+        start = good;
+    }
+}
+
+// rotations are Rz * Ry * Rx, the order DisplaySkeleton applies them in
+static QUATERNION eulerToQuaternion(Real rx, Real ry, Real rz) {
+    const Real toRadians = M_PI / 180.0;
+    return QUATERNION(AngleAxis<Real>(rz * toRadians, VEC3::UnitZ()) *
+                      AngleAxis<Real>(ry * toRadians, VEC3::UnitY()) *
+                      AngleAxis<Real>(rx * toRadians, VEC3::UnitX()));
+}
+
+static void quaternionToEuler(const QUATERNION& q, Real& rx, Real& ry,
+                              Real& rz) {
+    const Real toDegrees = 180.0 / M_PI;
+    MATRIX3 R = q.toRotationMatrix();
+    rx = atan2(R(2, 1), R(2, 2)) * toDegrees;
+    ry = asin(std::max<Real>(-1.0, std::min<Real>(1.0, -R(2, 0)))) * toDegrees;
+    rz = atan2(R(1, 0), R(0, 0)) * toDegrees;
+}
+
+static inline void quantize(const QUATERNION& q, short* values) {
+    const Real* c = q.coeffs().data();
+    for (int i = 0; i < 4; i++) {
+        values[i] = (short)lround(c[i] * 32767.0);
+    }
+}
+
+static inline QUATERNION dequantize(const short* values) {
+    QUATERNION q;
+    for (int i = 0; i < 4; i++) {
+        q.coeffs()[i] = values[i] / 32767.0;
+    }
+    return q.normalized();
+}
+
+CompressedMotion::CompressedMotion(Motion& motion, Real angleTolerance,
+                                   Real positionTolerance)
+    : frames(motion.GetNumFrames()),
+      originalSize((size_t)motion.GetNumChannels() * frames *
+                   sizeof(double)) {
+    Skeleton* skeleton = motion.GetSkeleton();
+    Bone* bone = skeleton->getRoot();
+    int totalBones = skeleton->numBonesInSkel(bone[0]);
+    if (frames == 0) {
+        return;
+    }
+
+    for (int b = 0; b < totalBones; b++) {
+        bool rotation = bone[b].dofrx && bone[b].dofry && bone[b].dofrz &&
+                        motion.GetChannel(b, CHANNEL_RX) != NULL;
+        if (rotation) {
+            compressRotations(motion, b, angleTolerance);
+        }
+        for (int channel = 0; channel < NUMBER_POSTURE_CHANNELS; channel++) {
+            bool rotational = (channel == CHANNEL_RX || channel == CHANNEL_RY ||
+                               channel == CHANNEL_RZ);
+            if (motion.GetChannel(b, (PostureChannel)channel) == NULL ||
+                (rotation && rotational)) {
+                continue;
+            }
+            compressScalars(motion, b, channel,
+                            rotational ? angleTolerance : positionTolerance);
+        }
+    }
+}
+
+void CompressedMotion::compressScalars(Motion& motion, int bone, int channel,
+                                       Real tolerance) {
+    const double* values = motion.GetChannel(bone, (PostureChannel)channel);
+
+    Track track;
+    track.bone = bone;
+    track.channel = channel;
+    track.minimum = *std::min_element(values, values + frames);
+    track.step = (*std::max_element(values, values + frames) - track.minimum) /
+                 65535.0;
+
+    // the keys are checked as they'll be played back, after quantization
+    vector<unsigned short> quantized(frames);
+    vector<Real> played(frames);
+    for (int f = 0; f < frames; f++) {
+        Real q = (track.step > 0.0) ? (values[f] - track.minimum) / track.step
+                                    : 0.0;
+        quantized[f] = (unsigned short)std::min(65535L, std::max(0L, lround(q)));
+        played[f] = track.minimum + track.step * quantized[f];
+    }
+
+    vector<int> keys;
+    reduceKeys(
+        frames,
+        [&](int start, int end) {
+            for (int f = start + 1; f < end; f++) {
+                Real t = (Real)(f - start) / (end - start);
+                Real value = played[start] + t * (played[end] - played[start]);
+                if (fabs(value - values[f]) > tolerance) {
+                    return false;
+                }
+            }
+            return true;
+        },
+        keys);
+
+    track.firstKey = keyFrames.size();
+    track.keys = keys.size();
+    track.firstValue = scalarValues.size();
+    for (unsigned int k = 0; k < keys.size(); k++) {
+        keyFrames.push_back(keys[k]);
+        scalarValues.push_back(quantized[keys[k]]);
+    }
+    tracks.push_back(track);
+}
+
+void CompressedMotion::compressRotations(Motion& motion, int bone,
+                                         Real tolerance) {
+    const double* rx = motion.GetChannel(bone, CHANNEL_RX);
+    const double* ry = motion.GetChannel(bone, CHANNEL_RY);
+    const double* rz = motion.GetChannel(bone, CHANNEL_RZ);
+
+    Track track;
+    track.bone = bone;
+    track.channel = -1;
+    track.minimum = 0.0;
+    track.step = 0.0;
+
+    // q and -q are the same rotation, so keep every frame in the same
+    // hemisphere as the one before it, or the slerps would go the long way
+    vector<QUATERNION> exact(frames);
+    vector<short> quantized(4 * frames);
+    vector<QUATERNION> played(frames);
+    for (int f = 0; f < frames; f++) {
+        exact[f] = eulerToQuaternion(rx[f], ry[f], rz[f]);
+        if (f > 0 && exact[f].dot(exact[f - 1]) < 0.0) {
+            exact[f].coeffs() = -exact[f].coeffs();
+        }
+        quantize(exact[f], &quantized[4 * f]);
+        played[f] = dequantize(&quantized[4 * f]);
+    }
+
+    // within the tolerance means the angle between the two rotations,
+    // 2 acos |q1 . q2|, is at most the tolerance
+    const Real minimumDot = cos(0.5 * tolerance * M_PI / 180.0);
+    vector<int> keys;
+    reduceKeys(
+        frames,
+        [&](int start, int end) {
+            for (int f = start + 1; f < end; f++) {
+                Real t = (Real)(f - start) / (end - start);
+                QUATERNION q = played[start].slerp(t, played[end]);
+                if (fabs(q.dot(exact[f])) < minimumDot) {
+                    return false;
+                }
+            }
+            return true;
+        },
+        keys);
+
+    track.firstKey = keyFrames.size();
+    track.keys = keys.size();
+    track.firstValue = rotationValues.size();
+    for (unsigned int k = 0; k < keys.size(); k++) {
+        keyFrames.push_back(keys[k]);
+        rotationValues.insert(rotationValues.end(), &quantized[4 * keys[k]],
+                              &quantized[4 * keys[k]] + 4);
+    }
+    tracks.push_back(track);
+}
+
+void CompressedMotion::sample(Real time, Motion& out, int outFrame) const {
+    if (frames == 0) {
+        return;
+    }
+    time = std::max<Real>(0.0, std::min<Real>(time, frames - 1));
+
+    for (unsigned int i = 0; i < tracks.size(); i++) {
+        const Track& track = tracks[i];
+
+        // the last key at or before the time, and how far it is to the next
+        const unsigned int* keys = &keyFrames[track.firstKey];
+        int key = std::upper_bound(keys, keys + track.keys, time) - keys - 1;
+        key = std::max(0, std::min(key, track.keys - 1));
+        int next = std::min(key + 1, track.keys - 1);
+        Real t = (next == key) ? 0.0
+                               : (time - keys[key]) / (keys[next] - keys[key]);
+
+        if (track.channel >= 0) {
+            const unsigned short* values = &scalarValues[track.firstValue];
+            Real value = values[key] + t * ((Real)values[next] - values[key]);
+            out.SetChannel(outFrame, track.bone, track.channel,
+                           track.minimum + track.step * value);
+        } else {
+            const short* values = &rotationValues[track.firstValue];
+            QUATERNION q = dequantize(values + 4 * key);
+            if (next != key) {
+                q = q.slerp(t, dequantize(values + 4 * next));
+            }
+            Real rx, ry, rz;
+            quaternionToEuler(q, rx, ry, rz);
+            out.SetChannel(outFrame, track.bone, CHANNEL_RX, rx);
+            out.SetChannel(outFrame, track.bone, CHANNEL_RY, ry);
+            out.SetChannel(outFrame, track.bone, CHANNEL_RZ, rz);
+        }
+    }
+}
+
+PostureView CompressedMotion::getPosture(Real time, Motion& scratch,
+                                         int scratchFrame) const {
+    sample(time, scratch, scratchFrame);
+    return scratch.GetPosture(scratchFrame);
+}
+
+size_t CompressedMotion::compressedBytes() const {
+    return tracks.size() * sizeof(Track) +
+           keyFrames.size() * sizeof(unsigned int) +
+           scalarValues.size() * sizeof(unsigned short) +
+           rotationValues.size() * sizeof(short);
+}
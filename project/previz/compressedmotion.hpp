@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "motion.h"
+#include "skeleton.h"
+
+using namespace std;
+
+// default tolerances: a quarter of a degree, and a millimetre at MOCAP_SCALE
+const Real MOTION_ANGLE_TOLERANCE = 0.25;
+const Real MOTION_POSITION_TOLERANCE = 0.001;
+
+// a Motion squeezed down for big mocap libraries. a bone with all three
+// rotational DOFs keeps its rotation as a track of quaternions, and every
+// other channel is a track of scalars. each track only keeps the frames
+// that its neighbours can't be interpolated into within the tolerance, and
+// keeps those as 16-bit values. any time can be sampled, including between
+// frames: quaternions are slerped and scalars interpolated linearly
+class CompressedMotion {
+   public:
+    // angleTolerance is in degrees, positionTolerance in skeleton units
+    // (translations are already multiplied by MOCAP_SCALE in a Motion)
+    CompressedMotion(Motion& motion,
+                     Real angleTolerance = MOTION_ANGLE_TOLERANCE,
+                     Real positionTolerance = MOTION_POSITION_TOLERANCE);
+
+    // length of the original motion. times run from 0 to totalFrames() - 1
+    int totalFrames() const { return frames; }
+
+    // the posture at a time, in frames of the original motion, written into
+    // a frame of another motion of the same skeleton. times outside the
+    // motion are clamped to its ends
+    void sample(Real time, Motion& out, int outFrame) const;
+
+    // the same, but handed back as a view for Skeleton::setPosture(). the
+    // scratch motion is where it's decoded to, so every thread needs its own
+    PostureView getPosture(Real time, Motion& scratch,
+                           int scratchFrame = 0) const;
+
+    // what the tracks take, against the channels of the original motion
+    size_t compressedBytes() const;
+    size_t originalBytes() const { return originalSize; }
+
+    // frames kept over all the tracks
+    int totalKeys() const { return keyFrames.size(); }
+
+   protected:
+    struct Track {
+        int bone;
+
+        // the PostureChannel of a scalar track, or -1 for a rotation track
+        int channel;
+
+        // this track's keys are keyFrames[firstKey, firstKey + keys), with
+        // the values from firstValue in scalarValues, or 4 per key from
+        // firstValue in rotationValues
+        int firstKey;
+        int keys;
+        int firstValue;
+
+        // scalar values are minimum + step * the 16-bit value
+        Real minimum;
+        Real step;
+    };
+
+    int frames;
+    size_t originalSize;
+    vector<Track> tracks;
+    vector<unsigned int> keyFrames;
+    vector<unsigned short> scalarValues;
+    vector<short> rotationValues;
+
+    void compressScalars(Motion& motion, int bone, int channel,
+                         Real tolerance);
+    void compressRotations(Motion& motion, int bone, Real tolerance);
+};
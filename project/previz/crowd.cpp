@@ -0,0 +1,126 @@
+#include "crowd.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+Crowd::Crowd(Skeleton* skeleton, Motion* motion, int totalMembers, VEC3 color,
+             int totalPoses)
+    : motion(motion), batch(skeleton), everyone(NULL), currentFrame(-1) {
+    totalMembers = std::max(totalMembers, 1);
+    totalPoses = std::max(1, std::min(totalPoses, totalMembers));
+    const int totalBones = batch.totalBones();
+
+    scalings.resize(totalBones, MATRIX4::Identity());
+    lengths.resize(totalBones, 0.0);
+    for (int x = 0; x < totalBones; x++) {
+        Bone& bone = skeleton->getBone(x);
+        scalings[x](0, 0) = bone.aspx;
+        scalings[x](1, 1) = bone.aspy;
+        lengths[x] = bone.length;
+    }
+
+    // the time offsets are spread evenly over the clip, and each pose
+    // starts out at its own until the first setFrame()
+    poses.resize(totalPoses);
+    frames.resize(totalPoses);
+    transforms.resize(totalPoses * totalBones, AFFINE3::Identity());
+    for (int p = 0; p < totalPoses; p++) {
+        Pose& pose = poses[p];
+        pose.timeOffset =
+            (int)((long)p * motion->GetNumFrames() / totalPoses);
+        frames[p] = pose.timeOffset;
+    }
+    batch.evaluate(*motion, &frames[0], totalPoses, &transforms[0]);
+
+    // the bone cylinders are made at the origin and then put in place,
+    // skipping the first bone, it's just the origin
+    for (int p = 0; p < totalPoses; p++) {
+        Pose& pose = poses[p];
+        for (int x = 1; x < totalBones; x++) {
+            pose.bones.push_back(new Cylinder(
+                VEC3(0, 0, 0), VEC3(0, 0, lengths[x]), 0.25, VEC4(0, 0, 0, 0),
+                MATRIX4::Identity(), scalings[x], lengths[x], color, OPAQUE,
+                0.0, NULL));
+        }
+        placeBones(p);
+        pose.group = new ShapeGroup(pose.bones, color, OPAQUE, 0.0, NULL);
+    }
+
+    // rows of members going away from the camera, centered across
+    const int columns = (int)ceil(sqrt((Real)totalMembers));
+    vector<Shape*> instances;
+    members.resize(totalMembers);
+    for (int i = 0; i < totalMembers; i++) {
+        Member& member = members[i];
+        int row = i / columns;
+        int column = i % columns;
+        Real across = column - 0.5 * (columns - 1);
+        member.rootOffset =
+            VEC3((row + 1) * CROWD_SPACING, 0.0, across * CROWD_SPACING);
+        member.pose = i % totalPoses;
+
+        MATRIX4 objectToWorld = MATRIX4::Identity();
+        objectToWorld.block<3, 1>(0, 3) = member.rootOffset;
+        member.instance =
+            new Instance(poses[member.pose].group, objectToWorld);
+        instances.push_back(member.instance);
+    }
+    everyone = new ShapeGroup(instances, color, OPAQUE, 0.0, NULL);
+}
+
+Crowd::~Crowd() {
+    delete everyone;
+    for (unsigned int i = 0; i < members.size(); i++) {
+        delete members[i].instance;
+    }
+    for (unsigned int p = 0; p < poses.size(); p++) {
+        delete poses[p].group;
+        for (unsigned int x = 0; x < poses[p].bones.size(); x++) {
+            delete poses[p].bones[x];
+        }
+    }
+}
+
+bool Crowd::setFrame(int frame) {
+    if (frame == currentFrame) {
+        return false;
+    }
+    currentFrame = frame;
+
+    // all the poses go through forward kinematics together, one per lane
+    const int totalFrames = motion->GetNumFrames();
+    for (unsigned int p = 0; p < poses.size(); p++) {
+        frames[p] = (frame + poses[p].timeOffset) % totalFrames;
+    }
+    batch.evaluate(*motion, &frames[0], poses.size(), &transforms[0]);
+    for (unsigned int p = 0; p < poses.size(); p++) {
+        placeBones(p);
+        poses[p].group->update();
+    }
+
+    // the members only moved because their pose did
+    for (unsigned int i = 0; i < members.size(); i++) {
+        members[i].instance->updateBounds();
+    }
+    everyone->update();
+    return true;
+}
+
+void Crowd::placeBones(int p) {
+    const int totalBones = batch.totalBones();
+    Pose& pose = poses[p];
+    for (int x = 1; x < totalBones; x++) {
+        const AFFINE3& transform = transforms[p * totalBones + x];
+        MATRIX4 rotation = MATRIX4::Identity();
+        rotation.block<3, 3>(0, 0) = transform.linear();
+        VEC4 translation;
+        translation << transform.translation(), 0.0;
+        VEC3 leftVertex = transform.translation();
+        VEC3 rightVertex = leftVertex + transform.linear().col(2) * lengths[x];
+        ((Cylinder*)pose.bones[x - 1])
+            ->setTransform(leftVertex, rightVertex, translation, rotation,
+                           scalings[x], lengths[x]);
+    }
+}
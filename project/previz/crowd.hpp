@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "batchfk.hpp"
+#include "bvh.hpp"
+#include "motion.h"
+#include "shapes.hpp"
+#include "skeleton.h"
+
+using namespace std;
+
+// at most this many different poses are computed per frame. members past
+// that share the pose (and the bone geometry) of an earlier member, so the
+// cost of posing a crowd stops growing with its size
+const int CROWD_MAX_POSES = 16;
+
+// distance between neighbouring places in the crowd's grid
+const Real CROWD_SPACING = 1.0;
+
+// a crowd of characters that all play one motion on one skeleton, each from
+// its own place and its own point in the clip. every pose gets its own bone
+// transforms and bone cylinders under a small BVH, and the members are
+// instances of those poses, translated to their place. the instances sit
+// under one more BVH, so a ray only looks inside the characters whose
+// bounds it passes through, and tracing cost grows with the log of the
+// crowd size rather than with the size
+class Crowd {
+   public:
+    // the members stand in rows behind the origin, and their time offsets
+    // are spread evenly over the clip. the skeleton and the motion have to
+    // outlive the crowd
+    Crowd(Skeleton* skeleton, Motion* motion, int members, VEC3 color,
+          int poses = CROWD_MAX_POSES);
+    ~Crowd();
+
+    // pose every member at this frame of the motion plus its time offset,
+    // wrapping around at the end of the clip. returns false if the crowd
+    // was already posed at this frame, and nothing moved
+    bool setFrame(int frame);
+
+    // the whole crowd as a single shape, to add to the scene
+    Shape* shape() { return everyone; }
+
+    int totalMembers() const { return members.size(); }
+    int totalPoses() const { return poses.size(); }
+
+   protected:
+    class Pose {
+       public:
+        int timeOffset;
+        vector<Shape*> bones;
+        ShapeGroup* group;
+    };
+
+    class Member {
+       public:
+        VEC3 rootOffset;
+        int pose;
+        Instance* instance;
+    };
+
+    Motion* motion;
+    BatchFK batch;
+    vector<Pose> poses;
+    vector<Member> members;
+    ShapeGroup* everyone;
+    int currentFrame;
+
+    // the bone transforms of every pose, totalBones() of them per pose, and
+    // the frame each pose is at
+    vector<AFFINE3> transforms;
+    vector<int> frames;
+
+    // per bone, what doesn't change with the pose
+    vector<MATRIX4> scalings;
+    vector<Real> lengths;
+
+    // move the bone cylinders of a pose to its transforms
+    void placeBones(int pose);
+};
@@ -13,68 +13,6 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 #include "motion.h"
 #include "displaySkeleton.h"
 
-////////////////SOFTWARE GL BEGIN///////////////////////
-#include <stack>
-stack<MATRIX4> matrixStack;
-static MATRIX4 currentMatrix = MATRIX4::Identity();
-
-static MATRIX4 toMatrix4(const MATRIX3& A)
-{
-  MATRIX4 result = MATRIX4::Identity();
-  for (int y = 0; y < 3; y++)
-    for (int x = 0; x < 3; x++)
-      result(x,y) = A(x,y);
-  return result;
-}
-
-static void myPushMatrix()
-{
-  matrixStack.push(currentMatrix);  
-}
-static void myPopMatrix()
-{
-  assert(matrixStack.size() != 0);
-  currentMatrix = matrixStack.top();
-  matrixStack.pop();
-}
-
-static void myTranslatef(const float x, const float y, const float z)
-{
-  MATRIX4 translation = MATRIX4::Identity();
-  translation(3,0) = x;
-  translation(3,1) = y;
-  translation(3,2) = z;
-
-  currentMatrix = translation * currentMatrix;
-}
-static void myRotatef(const float degrees, const float x, const float y, const float z)
-{
-  VEC3 axis(x,y,z);
-  axis.normalize();
-  MATRIX3 rotation;
-
-  float radians = (degrees / 360.0) * 2.0 * M_PI;
-  rotation = AngleAxisd(radians, axis);
-  rotation.transposeInPlace();
-  
-  currentMatrix = toMatrix4(rotation) * currentMatrix;
-}
-static void myMultMatrixd(const double* matrix)
-{
-  MATRIX4 A;
-  int i = 0;
-  for (int x = 0; x < 4; x++)
-    for (int y = 0; y < 4; y++, i++)
-      A(x,y) = matrix[i];
-
-  currentMatrix = A * currentMatrix;
-}
-static void myLoadIdentity()
-{
-  currentMatrix = MATRIX4::Identity();
-}
-////////////////SOFTWARE GL END///////////////////////
-
 float DisplaySkeleton::jointColors[NUMBER_JOINT_COLORS][3] =
 {
   {0.0f, 1.0f, 0.0f},  // GREEN
@@ -99,174 +37,143 @@ DisplaySkeleton::~DisplaySkeleton(void)
 }
 
 /*
-  Define M_k = Modelview matrix at the kth node (bone) in the heirarchy
-  M_k stores the transformation matrix of the kth bone in world coordinates
-  Our goal is to draw the (k+1)th bone, using its local information and M_k
+  Forward kinematics, with column vectors. Let G_k be the transform from
+  the local frame at the tip of the kth bone's parent to world coordinates.
+  The frame of the kth bone itself is
+
+    F_k = G_k * (rot_parent_current) * T_k * R_k
 
-  In the k+1th node, compute the following matrices:
-  rot_parent_current: this is the rotation matrix that 
-  takes us from k+1 to the kth local coordinate system 
-  R_k+1 : Rotation matrix for the k+1 th node (bone)
-  using angles specified by the AMC file in local coordinates
-  T_k+1 : Translation matrix for the k+1th node
-  
-  The update relation is given by:
-  M_k+1 = M_k * (rot_parent_current) * R_k+1 + T_k+1
+  where T_k and R_k are the translation and rotation from the AMC file, and
+  its children start from F_k translated along dir by the bone's length.
+  Everything but T_k and R_k is fixed by the skeleton, so FlattenSkeleton
+  works it out once, and the bones are visited parents first in one loop.
 */
-// TODO: Replace GL calls here with Eigen matrices
-void DisplaySkeleton::DrawBone(Bone *pBone,int skelNum)
+void FlattenSkeleton(Skeleton * pSkeleton, vector<FKBone> & order)
 {
-  static double z_dir[3] = {0.0, 0.0, 1.0};
-  double r_axis[3], theta;
-
-  //currentMatrix = getCurrentModelview();
-
-  //Transform (rotate) from the local coordinate system of this bone to it's parent
-  //This step corresponds to doing: ModelviewMatrix = M_k * (rot_parent_current)
-  myMultMatrixd((double*)&pBone->rot_parent_current);     
-
-  //translate AMC (rarely used)
-  if(pBone->doftz)
-    myTranslatef(0.0f, 0.0f, float(pBone->tz));
-  if(pBone->dofty) 
-    myTranslatef(0.0f, float(pBone->ty), 0.0f);
-  if(pBone->doftx)
-    myTranslatef(float(pBone->tx), 0.0f, 0.0f);
-
-  //rotate AMC 
-  if(pBone->dofrz)
-    myRotatef(float(pBone->rz), 0.0f, 0.0f, 1.0f);
-  if(pBone->dofry) 
-    myRotatef(float(pBone->ry), 0.0f, 1.0f, 0.0f);
-  if(pBone->dofrx) 
-    myRotatef(float(pBone->rx), 1.0f, 0.0f, 0.0f);
+  static const VEC3 zDir(0.0, 0.0, 1.0);
 
-  //Store the current ModelviewMatrix (before adding the translation part)
-  myPushMatrix();
+  order.resize(1);
+  order[0].bone = pSkeleton->getRoot();
+  order[0].parent = -1;
 
-  //Compute tx, ty, tz : translation from pBone to its child (in local coordinate system of pBone)
-  double tx = pBone->dir[0] * pBone->length;
-  double ty = pBone->dir[1] * pBone->length;
-  double tz = pBone->dir[2] * pBone->length;
-
-  // Use the current ModelviewMatrix to display the current bone
-  // Rotate the bone from its canonical position (elongated sphere 
-  // with its major axis parallel to X axis) to its correct orientation
-  if(pBone->idx == Skeleton::getRootIndex())
+  // breadth first, so the children are appended after their parent
+  for (unsigned int i = 0; i < order.size(); i++)
   {
-    // do nothing
+    for (Bone * child = order[i].bone->child; child != NULL; child = child->sibling)
+    {
+      order.resize(order.size() + 1);
+      order.back().bone = child;
+      order.back().parent = i;
+    }
   }
-  else
-  { 
-    //MATRIX4 currentTransform = getCurrentModelview();
-    MATRIX4 currentTransform = currentMatrix;
-
-    //Compute the angle between the canonical pose and the correct orientation 
-    //(specified in pBone->dir) using cross product.
-    //Using the formula: r_axis = z_dir x pBone->dir
-    r_axis[0] = z_dir[1]*pBone->dir[2]-z_dir[2]*pBone->dir[1];
-    r_axis[1] = z_dir[2]*pBone->dir[0]-z_dir[0]*pBone->dir[2];
-    r_axis[2] = z_dir[0]*pBone->dir[1]-z_dir[1]*pBone->dir[0];
-
-    double dot_prod = z_dir[0] * pBone->dir[0] + z_dir[1] * pBone->dir[1] + z_dir[2] * pBone->dir[2] ;
-    double r_axis_len = sqrt(r_axis[0] * r_axis[0] + r_axis[1] * r_axis[1] + r_axis[2] * r_axis[2]);
-    theta = atan2(r_axis_len, dot_prod);
-    VEC3 axis(r_axis[0], r_axis[1], r_axis[2]);
-    axis.normalize();
-    MATRIX3 rotation;
-    rotation = AngleAxisd(theta, axis);
-    rotation.transposeInPlace();
-
-    MATRIX4 scaling = MATRIX4::Identity();
-    scaling(0,0) = pBone->aspx;
-    scaling(1,1) = pBone->aspy;
-    boneScalings[pBone->idx] = scaling;
-    
-    currentTransform = scaling * toMatrix4(rotation) * currentTransform;
-
-    VEC4 currentTranslation;
-    currentTranslation[0] = currentTransform(3,0);
-    currentTranslation[1] = currentTransform(3,1);
-    currentTranslation[2] = currentTransform(3,2);
-    currentTransform(3,0) = 0;
-    currentTransform(3,1) = 0;
-    currentTransform(3,2) = 0;
 
-    boneRotations[pBone->idx] = currentTransform.transpose();
-    boneTranslations[pBone->idx] = currentTranslation;
+  for (unsigned int i = 0; i < order.size(); i++)
+  {
+    FKBone & entry = order[i];
+    Bone * pBone = entry.bone;
+
+    // rot_parent_current is stored transposed, for the GL matrix stack
+    for (int row = 0; row < 3; row++)
+      for (int col = 0; col < 3; col++)
+        entry.toParent(row, col) = pBone->rot_parent_current[col][row];
+
+    VEC3 dir(pBone->dir[0], pBone->dir[1], pBone->dir[2]);
+    entry.tip = dir * pBone->length;
+
+    // the bone geometry points down the z axis, so rotate z onto dir
+    // (about z x dir) and then scale x and y by the aspect ratio. the root
+    // has no direction, and any axis will do for a bone along z already
+    VEC3 axis = zDir.cross(dir);
+    Real theta = atan2(axis.norm(), zDir.dot(dir));
+    if (axis.norm() > 0.0)
+      axis.normalize();
+    else
+      axis = VEC3::UnitX();
+    entry.scaling = MATRIX4::Identity();
+    entry.scaling(0,0) = pBone->aspx;
+    entry.scaling(1,1) = pBone->aspy;
+    entry.toCanonical = AngleAxis<Real>(theta, axis).toRotationMatrix() *
+                        entry.scaling.block<3,3>(0,0);
   }
-
-  myPopMatrix();
-
-  // Finally, translate the bone, depending on its length and direction
-  // This step corresponds to doing: M_k+1 = ModelviewMatrix += T_k+1
-  myTranslatef(float(tx), float(ty), float(tz));
 }
 
-//Traverse the hierarchy starting from the root 
-//Every node in the data structure has just one child pointer. 
-//If there are more than one children for any node, they are stored as sibling pointers
-//The algorithm draws the current node (bone), visits its child and then visits siblings
-// TODO: Replace GL calls here with Eigen matrices
-void DisplaySkeleton::Traverse(Bone *ptr,int skelNum)
+void DisplaySkeleton::ComputeForwardKinematics(int skelNum)
 {
-  if(ptr != NULL)
-  {
-    myPushMatrix();
+  const vector<FKBone> & order = fkOrder[skelNum];
+  fkFrames.resize(order.size());
+
+  // the root's position and orientation in the world
+  double translation[3];
+  m_pSkeleton[skelNum]->GetTranslation(translation);
+  double rotationAngle[3];
+  m_pSkeleton[skelNum]->GetRotationAngle(rotationAngle);
 
-    DrawBone(ptr,skelNum);
-    Traverse(ptr->child,skelNum);
+  AFFINE3 world = AFFINE3::Identity();
+  world.translate(MOCAP_SCALE * VEC3(translation[0], translation[1], translation[2]));
+  world.rotate(AngleAxis<Real>(rotationAngle[0] * M_PI / 180.0, VEC3::UnitX()));
+  world.rotate(AngleAxis<Real>(rotationAngle[1] * M_PI / 180.0, VEC3::UnitY()));
+  world.rotate(AngleAxis<Real>(rotationAngle[2] * M_PI / 180.0, VEC3::UnitZ()));
 
-    myPopMatrix();
+  for (unsigned int i = 0; i < order.size(); i++)
+  {
+    const FKBone & entry = order[i];
+    const Bone * pBone = entry.bone;
+
+    AFFINE3 frame = (entry.parent < 0) ? world : fkFrames[entry.parent];
+    frame.rotate(entry.toParent);
+
+    //translate AMC (rarely used)
+    if(pBone->doftz)
+      frame.translate(VEC3(0.0, 0.0, pBone->tz));
+    if(pBone->dofty)
+      frame.translate(VEC3(0.0, pBone->ty, 0.0));
+    if(pBone->doftx)
+      frame.translate(VEC3(pBone->tx, 0.0, 0.0));
+
+    //rotate AMC
+    if(pBone->dofrz)
+      frame.rotate(AngleAxis<Real>(pBone->rz * M_PI / 180.0, VEC3::UnitZ()));
+    if(pBone->dofry)
+      frame.rotate(AngleAxis<Real>(pBone->ry * M_PI / 180.0, VEC3::UnitY()));
+    if(pBone->dofrx)
+      frame.rotate(AngleAxis<Real>(pBone->rx * M_PI / 180.0, VEC3::UnitX()));
+
+    // the root is just the origin, there's no bone to place
+    if(pBone->idx != Skeleton::getRootIndex())
+    {
+      MATRIX4 & rotation = boneRotations[skelNum][pBone->idx];
+      rotation = MATRIX4::Identity();
+      rotation.block<3,3>(0,0) = frame.linear() * entry.toCanonical;
+      boneScalings[skelNum][pBone->idx] = entry.scaling;
+      boneTranslations[skelNum][pBone->idx] << frame.translation(), 0.0;
+    }
 
-    Traverse(ptr->sibling,skelNum);
+    // the children hang off the far end of the bone
+    frame.translate(entry.tip);
+    fkFrames[i] = frame;
   }
 }
 
-//Draw the skeleton
-// TODO: Replace GL calls here with Eigen matrices
+//Compute the bone transforms of the skeleton's current posture
 void DisplaySkeleton::ComputeBonePositions(RenderMode renderMode_)
 {
-  unsigned int numbones = m_pSkeleton[0]->numBonesInSkel(*m_pSkeleton[0]->getRoot());
-  if (boneRotations.size() != numbones)
-  {
-    boneRotations.resize(numbones); 
-    boneTranslations.resize(numbones); 
-    boneScalings.resize(numbones); 
-    boneLengths.resize(numbones); 
-    for (unsigned int x = 0; x < numbones; x++)
-      boneLengths[x] = m_pSkeleton[0]->getBone(x).length;
-  }
-
   // Set render mode
   renderMode = renderMode_;
 
-  myPushMatrix();
-
-  // load up identity so we just get the pure transforms out at the end,
-  // not the modelview as well
-  myLoadIdentity();
-
-  //draw the skeleton starting from the root
   for (int i = 0; i < numSkeletons; i++)
   {
-    myPushMatrix();
-
-    double translation[3];
-    m_pSkeleton[i]->GetTranslation(translation);
-    double rotationAngle[3];
-    m_pSkeleton[i]->GetRotationAngle(rotationAngle);
-
-    myTranslatef(float(MOCAP_SCALE * translation[0]), float(MOCAP_SCALE * translation[1]), float(MOCAP_SCALE * translation[2]));
-    myRotatef(float(rotationAngle[0]), 1.0f, 0.0f, 0.0f);
-    myRotatef(float(rotationAngle[1]), 0.0f, 1.0f, 0.0f);
-    myRotatef(float(rotationAngle[2]), 0.0f, 0.0f, 1.0f);
-
-    Traverse(m_pSkeleton[i]->getRoot(),i);
-
-    myPopMatrix();
+    unsigned int numbones = m_pSkeleton[i]->numBonesInSkel(*m_pSkeleton[i]->getRoot());
+    if (boneRotations[i].size() != numbones)
+    {
+      boneRotations[i].resize(numbones); 
+      boneTranslations[i].resize(numbones); 
+      boneScalings[i].resize(numbones); 
+      boneLengths[i].resize(numbones); 
+      for (unsigned int x = 0; x < numbones; x++)
+        boneLengths[i][x] = m_pSkeleton[i]->getBone(x).length;
+    }
+    ComputeForwardKinematics(i);
   }
-  myPopMatrix();
 }
 
 void DisplaySkeleton::LoadMotion(Motion * pMotion)
@@ -284,6 +191,7 @@ void DisplaySkeleton::LoadSkeleton(Skeleton *pSkeleton)
     return;
 
   m_pSkeleton[numSkeletons] = pSkeleton;
+  FlattenSkeleton(pSkeleton, fkOrder[numSkeletons]);
 
   //Create the display list for the skeleton
   //All the bones are the elongated spheres centered at (0,0,0).
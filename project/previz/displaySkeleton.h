@@ -19,6 +19,24 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 
 using namespace std;
 
+// rigid transform stored as the 3x4 matrix [rotation | translation]
+typedef Transform<Real, 3, AffineCompact> AFFINE3;
+
+// a bone, along with everything about it that doesn't depend on the pose
+struct FKBone
+{
+  Bone * bone;
+  int parent;           // position of the parent in the order, -1 for the root
+  MATRIX3 toParent;     // rot_parent_current, acting on column vectors
+  MATRIX3 toCanonical;  // turns z along dir, then scales by the aspect ratio
+  MATRIX4 scaling;
+  VEC3 tip;             // dir * length, where the children are attached
+};
+
+// flatten the bone tree of a skeleton so that every bone comes after its
+// parent, and forward kinematics is a single loop with no recursion or stack
+void FlattenSkeleton(Skeleton * pSkeleton, vector<FKBone> & order);
+
 class DisplaySkeleton 
 {
 
@@ -52,17 +70,19 @@ public:
 
   void Reset(void);
 
-  vector<MATRIX4>& rotations()  { return boneRotations; };
-  vector<MATRIX4>& scalings()   { return boneScalings; };
-  vector<VEC4>& translations() { return boneTranslations; };
-  vector<float>& lengths()      { return boneLengths; };
+  // the bones of one skeleton, as of the last ComputeBonePositions()
+  vector<MATRIX4>& rotations(int skelNum = 0)  { return boneRotations[skelNum]; };
+  vector<MATRIX4>& scalings(int skelNum = 0)   { return boneScalings[skelNum]; };
+  vector<VEC4>& translations(int skelNum = 0) { return boneTranslations[skelNum]; };
+  vector<float>& lengths(int skelNum = 0)      { return boneLengths[skelNum]; };
 
 protected:
   RenderMode renderMode;
-  // Draw a particular bone
-  void DrawBone(Bone *ptr, int skelNum);
-  // Draw the skeleton hierarchy
-  void Traverse(Bone *ptr, int skelNum);
+
+  // walk the flattened bones of one skeleton and fill in the bone arrays.
+  // all the state lives in this object, so separate DisplaySkeletons can
+  // be posed at the same time
+  void ComputeForwardKinematics(int skelNum);
   
   int m_SpotJoint;		//joint whose local coordinate framework is drawn
   int numSkeletons;
@@ -71,10 +91,15 @@ protected:
 
   static float jointColors[NUMBER_JOINT_COLORS][3];
 
-  vector<MATRIX4> boneRotations;
-  vector<MATRIX4> boneScalings;
-  vector<VEC4> boneTranslations;
-  vector<float> boneLengths;
+  // one set of bones per skeleton, each sized for its own skeleton
+  vector<MATRIX4> boneRotations[MAX_SKELS];
+  vector<MATRIX4> boneScalings[MAX_SKELS];
+  vector<VEC4> boneTranslations[MAX_SKELS];
+  vector<float> boneLengths[MAX_SKELS];
+
+  vector<FKBone> fkOrder[MAX_SKELS];
+  // the frame at the tip of each bone, in the same order
+  vector<AFFINE3> fkFrames;
 };
 
 #endif
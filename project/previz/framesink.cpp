@@ -0,0 +1,190 @@
+#include "framesink.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+#include "QUICKTIME_MOVIE.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////
+// PPM files
+//////////////////////////////////////////////////////////////////////////////////
+
+PPMSequenceSink::PPMSequenceSink(const string& pattern) : pattern(pattern) {}
+
+void PPMSequenceSink::addFrame(int frame, const Image& image) {
+    char filename[256];
+    snprintf(filename, sizeof(filename), pattern.c_str(), frame);
+    string partial = string(filename) + ".partial";
+    image.writePPM(partial);
+    rename(partial.c_str(), filename);
+}
+
+// progressive passes overwrite the same file, which is already safe to do
+void PPMSequenceSink::previewFrame(int frame, const Image& image) {
+    addFrame(frame, image);
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Putting the frames back in order
+//////////////////////////////////////////////////////////////////////////////////
+
+OrderedFrameSink::OrderedFrameSink()
+    : nextFrame(0), nextRun(0), writtenRuns(0) {}
+
+void OrderedFrameSink::addFrame(int frame, const Image& image) {
+    // convert outside the lock, the other frames don't need to wait for it
+    PendingFrame converted;
+    converted.xRes = image.xRes();
+    converted.yRes = image.yRes();
+    converted.pixels.resize(3 * image.xRes() * image.yRes());
+    image.toRGB8(&converted.pixels[0]);
+
+    // take out whatever this frame makes ready, and number the run so that
+    // it gets written after the runs taken out before it
+    vector<PendingFrame> ready;
+    int run;
+    {
+        lock_guard<mutex> guard(lock);
+        if (frame < nextFrame) {
+            return;
+        }
+        pending[frame] = std::move(converted);
+        while (!pending.empty() && pending.begin()->first == nextFrame) {
+            ready.push_back(std::move(pending.begin()->second));
+            pending.erase(pending.begin());
+            nextFrame++;
+        }
+        if (ready.empty()) {
+            return;
+        }
+        run = nextRun++;
+    }
+    writeRun(run, ready);
+}
+
+void OrderedFrameSink::finish() {
+    vector<PendingFrame> ready;
+    int run;
+    {
+        lock_guard<mutex> guard(lock);
+        for (map<int, PendingFrame>::iterator i = pending.begin();
+             i != pending.end(); i++) {
+            ready.push_back(std::move(i->second));
+            nextFrame = i->first + 1;
+        }
+        pending.clear();
+        run = nextRun++;
+    }
+    writeRun(run, ready);
+}
+
+void OrderedFrameSink::writeRun(int run, vector<PendingFrame>& frames) {
+    unique_lock<mutex> writer(writerLock);
+    writerTurn.wait(writer, [&] { return writtenRuns == run; });
+    for (unsigned int i = 0; i < frames.size(); i++) {
+        writeFrame(&frames[i].pixels[0], frames[i].xRes, frames[i].yRes);
+    }
+    writtenRuns++;
+    writerTurn.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// QuickTime movie
+//////////////////////////////////////////////////////////////////////////////////
+
+MovieSink::MovieSink(const string& filename, Real frameRate)
+    : movie(new QUICKTIME_MOVIE(filename.c_str(),
+                                std::max(1, (int)lround(frameRate)))) {}
+
+MovieSink::~MovieSink() {}
+
+void MovieSink::writeFrame(const unsigned char* pixels, int xRes, int yRes) {
+    movie->addFrame(pixels, xRes, yRes);
+}
+
+void MovieSink::finish() {
+    OrderedFrameSink::finish();
+    movie->writeMovie();
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Raw video on stdout
+//////////////////////////////////////////////////////////////////////////////////
+
+StdoutSink::StdoutSink(Format format, Real frameRate)
+    : format(format), frameRate(frameRate), out(NULL), wroteHeader(false) {
+    // keep the real stdout for the frames, and send everything else that
+    // would have gone there to stderr
+    cout.flush();
+    fflush(stdout);
+    int frames = dup(STDOUT_FILENO);
+    if (frames >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0) {
+        out = fdopen(frames, "wb");
+    }
+    if (out == NULL) {
+        cerr << " Couldn't take over stdout for the frames. Bailing ... "
+             << endl;
+        exit(1);
+    }
+}
+
+StdoutSink::~StdoutSink() {
+    if (out != NULL) {
+        fclose(out);
+    }
+}
+
+static long greatestCommonDivisor(long a, long b) {
+    while (b != 0) {
+        long remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+
+void StdoutSink::writeFrame(const unsigned char* pixels, int xRes, int yRes) {
+    const int totalPixels = xRes * yRes;
+    if (format == RGB) {
+        fwrite(pixels, 1, 3 * totalPixels, out);
+        return;
+    }
+
+    if (!wroteHeader) {
+        // the frame rate as a fraction, to the nearest thousandth
+        long numerator = lround(frameRate * 1000.0);
+        long denominator = 1000;
+        long divisor = greatestCommonDivisor(numerator, denominator);
+        fprintf(out, "YUV4MPEG2 W%d H%d F%ld:%ld Ip A1:1 C444\n", xRes, yRes,
+                numerator / divisor, denominator / divisor);
+        wroteHeader = true;
+    }
+
+    // BT.601 in video range, the integer approximation
+    planes.resize(3 * totalPixels);
+    unsigned char* luma = &planes[0];
+    unsigned char* blue = luma + totalPixels;
+    unsigned char* red = blue + totalPixels;
+    for (int i = 0; i < totalPixels; i++) {
+        int r = pixels[3 * i];
+        int g = pixels[3 * i + 1];
+        int b = pixels[3 * i + 2];
+        luma[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        blue[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        red[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+    fputs("FRAME\n", out);
+    fwrite(&planes[0], 1, planes.size(), out);
+}
+
+void StdoutSink::finish() {
+    OrderedFrameSink::finish();
+    fflush(out);
+}
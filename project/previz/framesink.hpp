@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SETTINGS.h"
+#include "image.hpp"
+
+using namespace std;
+
+class QUICKTIME_MOVIE;
+
+// where the rendered frames go. frames in flight finish in any order, and
+// addFrame() may be called from several render threads at once
+class FrameSink {
+   public:
+    virtual ~FrameSink() {}
+
+    // a finished frame
+    virtual void addFrame(int frame, const Image& image) = 0;
+
+    // a rough version of a frame that's still being refined, for sinks that
+    // can show one. the default drops it
+    virtual void previewFrame(int frame, const Image& image) {}
+
+    // after the last frame has been added
+    virtual void finish() {}
+
+    // true if the sink writes to stdout, so nothing else can
+    virtual bool usesStdout() const { return false; }
+};
+
+// one PPM file per frame, e.g. "./frames/frame.%04i.ppm". every file is
+// written next to its final name and then renamed, so whatever is watching
+// the folder never sees half of one
+class PPMSequenceSink : public FrameSink {
+   public:
+    PPMSequenceSink(const string& pattern);
+
+    void addFrame(int frame, const Image& image);
+    void previewFrame(int frame, const Image& image);
+
+   protected:
+    string pattern;
+};
+
+// base for the sinks that are one stream, and need the frames in order.
+// each frame is converted to 8-bit RGB as it comes in, then held until all
+// the ones before it have been handed on, so at most about one frame per
+// frame in flight is waiting at any time. the frames are written outside
+// the lock that guards the waiting ones, so a slow write (e.g. a movie
+// waiting for its compressors) doesn't hold up threads that only come to
+// drop off a frame
+class OrderedFrameSink : public FrameSink {
+   public:
+    OrderedFrameSink();
+
+    void addFrame(int frame, const Image& image);
+
+    // writes whatever is still waiting, skipping over missing frames
+    void finish();
+
+   protected:
+    // called in frame order, one frame at a time, on whichever thread added
+    // the frame that completed the run
+    virtual void writeFrame(const unsigned char* pixels, int xRes,
+                            int yRes) = 0;
+
+   private:
+    class PendingFrame {
+       public:
+        int xRes;
+        int yRes;
+        vector<unsigned char> pixels;
+    };
+
+    // a run of frames in order, taken out of pending all at once. runs are
+    // numbered as they're taken, and written strictly in that order
+    void writeRun(int run, vector<PendingFrame>& frames);
+
+    // guards nextFrame, pending and nextRun
+    mutex lock;
+    int nextFrame;
+    map<int, PendingFrame> pending;
+    int nextRun;
+
+    // guards writtenRuns, and is held while a run is written
+    mutex writerLock;
+    condition_variable writerTurn;
+    int writtenRuns;
+};
+
+// JPEG frames in a QuickTime movie (see movieMaker/QUICKTIME_MOVIE.h).
+// the frames go to the movie in order, it compresses several at once on
+// its own threads and appends them as they're done, and finish() writes
+// the header after them
+class MovieSink : public OrderedFrameSink {
+   public:
+    // the movie plays at the nearest whole number of frames per second
+    MovieSink(const string& filename, Real frameRate);
+    ~MovieSink();
+
+    void finish();
+
+   protected:
+    void writeFrame(const unsigned char* pixels, int xRes, int yRes);
+
+    unique_ptr<QUICKTIME_MOVIE> movie;
+};
+
+// an uncompressed stream on stdout for piping into an encoder, either
+// YUV4MPEG2 (4:4:4, BT.601 video range), which carries its own size and
+// frame rate:
+//
+//   ./previz --y4m | ffmpeg -i - -c:v libx264 movie.mp4
+//
+// or bare RGB frames, which don't:
+//
+//   ./previz --rgb |
+//       ffmpeg -f rawvideo -pix_fmt rgb24 -s 640x480 -r 15 -i - movie.mp4
+//
+// stdout is taken over when the sink is made: anything else printed there
+// from then on goes to stderr instead
+class StdoutSink : public OrderedFrameSink {
+   public:
+    enum Format { Y4M, RGB };
+
+    StdoutSink(Format format, Real frameRate);
+    ~StdoutSink();
+
+    void finish();
+    bool usesStdout() const { return true; }
+
+   protected:
+    void writeFrame(const unsigned char* pixels, int xRes, int yRes);
+
+    Format format;
+    Real frameRate;
+    FILE* out;
+    bool wroteHeader;
+    vector<unsigned char> planes;
+};
@@ -0,0 +1,364 @@
+#include "image.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_X86 1
+#endif
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////
+// The conversion kernels are compiled once per instruction set, as in
+// batchfk.cpp, and the widest one the CPU supports is picked the first time
+// an image is converted.
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace baseline {
+#include "image_kernel.inl"
+}  // namespace baseline
+
+#ifdef IMAGE_X86
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+#include "image_kernel.inl"
+}  // namespace avx2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,prefer-vector-width=512")
+namespace avx512 {
+#include "image_kernel.inl"
+}  // namespace avx512
+#pragma GCC pop_options
+
+#endif
+
+class ImageKernels {
+   public:
+    ImageKernels();
+
+    void (*quantizeFloats)(const float* values, unsigned char* pixels,
+                           int count);
+    void (*quantizeHalves)(const unsigned short* values,
+                           unsigned char* pixels, int count);
+    void (*quantizeFloatTile)(const float* values, unsigned char* pixels,
+                              size_t rowBytes, int rows, int columns);
+    void (*quantizeHalfTile)(const unsigned short* values,
+                             unsigned char* pixels, size_t rowBytes,
+                             int rows, int columns);
+};
+
+ImageKernels::ImageKernels() {
+    quantizeFloats = baseline::quantizeFloats;
+    quantizeHalves = baseline::quantizeHalves;
+    quantizeFloatTile = baseline::quantizeTile<float>;
+    quantizeHalfTile = baseline::quantizeTile<unsigned short>;
+#ifdef IMAGE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw")) {
+        quantizeFloats = avx512::quantizeFloats;
+        quantizeHalves = avx512::quantizeHalves;
+        quantizeFloatTile = avx512::quantizeTile<float>;
+        quantizeHalfTile = avx512::quantizeTile<unsigned short>;
+    } else if (__builtin_cpu_supports("avx2")) {
+        quantizeFloats = avx2::quantizeFloats;
+        quantizeHalves = avx2::quantizeHalves;
+        quantizeFloatTile = avx2::quantizeTile<float>;
+        quantizeHalfTile = avx2::quantizeTile<unsigned short>;
+    }
+#endif
+}
+
+static const ImageKernels& kernels() {
+    static ImageKernels picked;
+    return picked;
+}
+
+// rounds to the nearest half, ties to even. the tiny values that only fit
+// as denormals are added to 0.5, which lines their bits up with the bottom
+// of a half's mantissa and leaves the rounding to the FPU
+static unsigned short floatToHalf(float value) {
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned int sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    // too big for a half, or infinite, or NaN
+    if (bits >= 0x47800000) {
+        return sign | ((bits > 0x7f800000) ? 0x7e00 : 0x7c00);
+    }
+    if (bits < 0x38800000) {
+        float shifted;
+        memcpy(&shifted, &bits, sizeof(shifted));
+        shifted += 0.5f;
+        unsigned int shiftedBits;
+        memcpy(&shiftedBits, &shifted, sizeof(shiftedBits));
+        return sign | (shiftedBits - 0x3f000000);
+    }
+    unsigned int mantissaOdd = (bits >> 13) & 1;
+    bits += ((unsigned int)(15 - 127) << 23) + 0xfff + mantissaOdd;
+    return sign | (bits >> 13);
+}
+
+static size_t roundUp(size_t bytes, size_t multiple) {
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Image
+//////////////////////////////////////////////////////////////////////////////////
+
+Image::Image(int xRes, int yRes, Format format, Layout layout)
+    : xResolution(xRes),
+      yResolution(yRes),
+      pixelFormat(format),
+      pixelLayout(layout),
+      data(NULL) {
+    size_t channelSize = (format == FLOAT32) ? sizeof(float)
+                         : (format == HALF)  ? sizeof(unsigned short)
+                                             : 1;
+    pixelSize = 3 * channelSize;
+
+    if (layout == TILES) {
+        tilesAcross = (xRes + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+        int tilesDown = (yRes + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+        stride = IMAGE_TILE_SIZE * pixelSize;
+        tileBytes = roundUp(IMAGE_TILE_SIZE * stride, IMAGE_ALIGNMENT);
+        bytes = tileBytes * tilesAcross * tilesDown;
+    } else {
+        tilesAcross = 0;
+        tileBytes = 0;
+        stride = roundUp(xRes * pixelSize, IMAGE_ALIGNMENT);
+        bytes = stride * yRes;
+    }
+    bytes = std::max(bytes, (size_t)IMAGE_ALIGNMENT);
+
+    if (posix_memalign((void**)&data, IMAGE_ALIGNMENT, bytes) != 0) {
+        cout << " Could not allocate a " << xRes << "x" << yRes
+             << " image. Bailing ... " << endl;
+        exit(1);
+    }
+    // the padding gets converted along with the tiles, so it's cleared
+    memset(data, 0, bytes);
+    fill(VEC3(1, 1, 1));
+}
+
+Image::~Image() { free(data); }
+
+unsigned char* Image::pixelAddress(int x, int y) const {
+    if (pixelLayout == TILES) {
+        int tile = (y / IMAGE_TILE_SIZE) * tilesAcross + x / IMAGE_TILE_SIZE;
+        return data + tile * tileBytes + (y % IMAGE_TILE_SIZE) * stride +
+               (x % IMAGE_TILE_SIZE) * pixelSize;
+    }
+    return data + y * stride + x * pixelSize;
+}
+
+void Image::encodePixel(const VEC3& color, unsigned char* pixel) const {
+    if (pixelFormat == FLOAT32) {
+        float channels[3] = {(float)color[0], (float)color[1],
+                             (float)color[2]};
+        memcpy(pixel, channels, sizeof(channels));
+    } else if (pixelFormat == HALF) {
+        unsigned short channels[3] = {floatToHalf(color[0]),
+                                      floatToHalf(color[1]),
+                                      floatToHalf(color[2])};
+        memcpy(pixel, channels, sizeof(channels));
+    } else {
+        for (int i = 0; i < 3; i++) {
+            pixel[i] = baseline::quantize(color[i]);
+        }
+    }
+}
+
+void Image::fill(const VEC3& color) {
+    unsigned char pixel[3 * sizeof(float)];
+    encodePixel(color, pixel);
+    for (int y = 0; y < yResolution; y++)
+        for (int x = 0; x < xResolution; x++) {
+            memcpy(pixelAddress(x, y), pixel, pixelSize);
+        }
+}
+
+void Image::setPixel(int x, int y, const VEC3& color) {
+    encodePixel(color, pixelAddress(x, y));
+}
+
+VEC3 Image::getPixel(int x, int y) const {
+    const unsigned char* pixel = pixelAddress(x, y);
+    VEC3 color;
+    for (int i = 0; i < 3; i++) {
+        if (pixelFormat == FLOAT32) {
+            float channel;
+            memcpy(&channel, pixel + i * sizeof(float), sizeof(channel));
+            color[i] = channel;
+        } else if (pixelFormat == HALF) {
+            unsigned short channel;
+            memcpy(&channel, pixel + i * sizeof(channel), sizeof(channel));
+            color[i] = baseline::halfToFloat(channel);
+        } else {
+            color[i] = pixel[i] / 255.0;
+        }
+    }
+    return color;
+}
+
+void Image::quantizeRun(const unsigned char* source, unsigned char* pixels,
+                        int count) const {
+    if (pixelFormat == FLOAT32) {
+        kernels().quantizeFloats((const float*)source, pixels, count);
+    } else if (pixelFormat == HALF) {
+        kernels().quantizeHalves((const unsigned short*)source, pixels,
+                                 count);
+    } else {
+        memcpy(pixels, source, count);
+    }
+}
+
+void Image::quantizeTile(const unsigned char* source, unsigned char* pixels,
+                         size_t rowBytes, int rows, int columns) const {
+    if (pixelFormat == FLOAT32) {
+        kernels().quantizeFloatTile((const float*)source, pixels, rowBytes,
+                                    rows, columns);
+    } else if (pixelFormat == HALF) {
+        kernels().quantizeHalfTile((const unsigned short*)source, pixels,
+                                   rowBytes, rows, columns);
+    } else if (columns == IMAGE_TILE_SIZE) {
+        // a whole tile row is a constant 48 bytes, a few plain moves
+        for (int y = 0; y < rows; y++) {
+            memcpy(pixels + y * rowBytes, source + y * stride,
+                   3 * IMAGE_TILE_SIZE);
+        }
+    } else {
+        for (int y = 0; y < rows; y++) {
+            memcpy(pixels + y * rowBytes, source + y * stride, 3 * columns);
+        }
+    }
+}
+
+void Image::toRGB8(unsigned char* pixels) const {
+    const size_t rowBytes = 3 * xResolution;
+    if (pixelLayout == ROWS) {
+        for (int y = 0; y < yResolution; y++) {
+            quantizeRun(pixelAddress(0, y), pixels + y * rowBytes,
+                        3 * xResolution);
+        }
+        return;
+    }
+
+    // every tile converts straight into place, a row at a time
+    for (int tileY = 0; tileY < yResolution; tileY += IMAGE_TILE_SIZE)
+        for (int tileX = 0; tileX < xResolution; tileX += IMAGE_TILE_SIZE) {
+            quantizeTile(pixelAddress(tileX, tileY),
+                         pixels + tileY * rowBytes + 3 * tileX, rowBytes,
+                         std::min(IMAGE_TILE_SIZE, yResolution - tileY),
+                         std::min(IMAGE_TILE_SIZE, xResolution - tileX));
+        }
+}
+
+void Image::writePPM(const string& filename) const {
+    vector<unsigned char> pixels(3 * xResolution * yResolution);
+    toRGB8(&pixels[0]);
+
+    FILE* fp;
+    fp = fopen(filename.c_str(), "wb");
+    if (fp == NULL) {
+        cout << " Could not open file \"" << filename.c_str()
+             << "\" for writing." << endl;
+        cout << " Make sure you're not trying to write from a weird "
+                "location "
+                "or with a "
+             << endl;
+        cout << " strange filename. Bailing ... " << endl;
+        exit(0);
+    }
+
+    fprintf(fp, "P6\n%d %d\n255\n", xResolution, yResolution);
+    fwrite(&pixels[0], 1, pixels.size(), fp);
+    fclose(fp);
+}
+
+Image* Image::readPPM(const string& filename, Format format) {
+    // try to open the file
+    FILE* fp;
+    fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL) {
+        cout << " Could not open file \"" << filename.c_str()
+             << "\" for reading." << endl;
+        cout << " Make sure you're not trying to read from a weird "
+                "location or "
+                "with a "
+             << endl;
+        cout << " strange filename. Bailing ... " << endl;
+        exit(0);
+    }
+
+    // get the dimensions
+    int xRes = 0;
+    int yRes = 0;
+    fscanf(fp, "P6\n%d %d\n255\n", &xRes, &yRes);
+
+    // grab the pixel values
+    vector<unsigned char> pixels(3 * xRes * yRes);
+    fread(&pixels[0], 1, pixels.size(), fp);
+    fclose(fp);
+
+    Image* image = new Image(xRes, yRes, format);
+    for (int y = 0; y < yRes; y++)
+        for (int x = 0; x < xRes; x++) {
+            const unsigned char* pixel = &pixels[3 * (y * xRes + x)];
+            image->setPixel(x, y,
+                            VEC3(pixel[0], pixel[1], pixel[2]) / 255.0);
+        }
+    cout << " Read in file " << filename.c_str() << endl;
+    return image;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Comparing images
+//////////////////////////////////////////////////////////////////////////////////
+
+ImageDifference compareImages(const Image& a, const Image& b) {
+    const int totalValues = 3 * a.xRes() * a.yRes();
+    vector<unsigned char> aPixels(totalValues);
+    vector<unsigned char> bPixels(totalValues);
+    a.toRGB8(&aPixels[0]);
+    b.toRGB8(&bPixels[0]);
+
+    ImageDifference difference;
+    difference.differingPixels = 0;
+    difference.maxDifference = 0;
+    Real sum = 0.0;
+    Real squaredSum = 0.0;
+    for (int i = 0; i < totalValues; i += 3) {
+        bool differs = false;
+        for (int j = i; j < i + 3; j++) {
+            int delta = abs((int)aPixels[j] - (int)bPixels[j]);
+            differs = differs || delta > 0;
+            difference.maxDifference = max(difference.maxDifference, delta);
+            sum += delta;
+            squaredSum += delta * delta;
+        }
+        difference.differingPixels += differs;
+    }
+    difference.meanDifference = sum / totalValues;
+    difference.psnr = (squaredSum == 0.0)
+                          ? INFINITY
+                          : 10.0 * log10(255.0 * 255.0 * totalValues /
+                                         squaredSum);
+    return difference;
+}
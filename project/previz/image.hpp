@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "SETTINGS.h"
+
+using namespace std;
+
+// side of the square blocks a tile-major image is stored in. a block is a
+// few whole cache lines, so the render threads filling neighbouring tiles
+// never write to the same line
+const int IMAGE_TILE_SIZE = 16;
+
+// every row, or every tile, starts on a cache line
+const int IMAGE_ALIGNMENT = 64;
+
+// an RGB framebuffer, 0 to 1 per channel, with the channels of a pixel next
+// to each other. the format picks how they're stored: FLOAT32 as the
+// renderer computed them, HALF in half the memory with 11 bits of precision
+// (far more than an 8-bit frame needs), and UINT8 as they'll be written.
+// rows are padded out to a cache line, or with the TILES layout the image
+// is stored block by block instead of row by row. either way the 8-bit RGB
+// comes back out in one clamp, round and convert pass per run of pixels,
+// compiled for the widest instruction set the CPU has
+class Image {
+   public:
+    enum Format { FLOAT32, HALF, UINT8 };
+    enum Layout { ROWS, TILES };
+
+    // starts out white
+    Image(int xRes, int yRes, Format format = FLOAT32, Layout layout = ROWS);
+    ~Image();
+
+    // owns its pixels
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
+    int xRes() const { return xResolution; }
+    int yRes() const { return yResolution; }
+    Format format() const { return pixelFormat; }
+    Layout layout() const { return pixelLayout; }
+
+    // bytes from one row of pixels to the next. with the TILES layout this
+    // is within a tile, and a tile is IMAGE_TILE_SIZE rows
+    size_t rowStride() const { return stride; }
+
+    // memory taken by the pixels, padding included
+    size_t totalBytes() const { return bytes; }
+
+    void fill(const VEC3& color);
+
+    // (0, 0) is the top left corner
+    void setPixel(int x, int y, const VEC3& color);
+    VEC3 getPixel(int x, int y) const;
+
+    // 8-bit RGB rows from the top down, 3 * xRes() bytes each, with every
+    // channel clamped and rounded to the nearest of 0 to 255
+    void toRGB8(unsigned char* pixels) const;
+
+    void writePPM(const string& filename) const;
+
+    // a binary (P6) PPM file as an image of the given format
+    static Image* readPPM(const string& filename, Format format = FLOAT32);
+
+   protected:
+    int xResolution;
+    int yResolution;
+    Format pixelFormat;
+    Layout pixelLayout;
+
+    unsigned char* data;
+    size_t bytes;
+    size_t pixelSize;
+    size_t stride;
+    size_t tileBytes;
+    int tilesAcross;
+
+    unsigned char* pixelAddress(int x, int y) const;
+
+    // one pixel in this image's format
+    void encodePixel(const VEC3& color, unsigned char* pixel) const;
+
+    // count channels starting at source, in this image's format, to 8 bits
+    void quantizeRun(const unsigned char* source, unsigned char* pixels,
+                     int count) const;
+
+    // the top left rows by columns pixels of the tile at source, to 8 bits
+    // in a frame rowBytes wide
+    void quantizeTile(const unsigned char* source, unsigned char* pixels,
+                      size_t rowBytes, int rows, int columns) const;
+};
+
+// how far apart two images of the same size are, compared the way
+// toRGB8() would write them out (0 to 255 per channel)
+class ImageDifference {
+   public:
+    int differingPixels;
+    int maxDifference;
+    Real meanDifference;
+    // in dB, infinite if the images are the same
+    Real psnr;
+};
+
+ImageDifference compareImages(const Image& a, const Image& b);
@@ -0,0 +1,119 @@
+// framebuffer to 8-bit conversion kernels. image.cpp includes this once per
+// instruction set, the same way as batchfk_kernel.inl. the loops have no
+// branches, so each compiles down to vector clamps, rounds and packs of
+// that target
+
+// 0 to 1 to the nearest of 0 to 255. out of range values are clamped, and
+// NaNs come out as 0
+static inline unsigned char quantize(float value) {
+    float scaled = value * 255.0f + 0.5f;
+    scaled = (scaled > 0.0f) ? scaled : 0.0f;
+    scaled = (scaled < 255.0f) ? scaled : 255.0f;
+    return (unsigned char)(int)scaled;
+}
+
+// moves the exponent and mantissa into place and rebiases the exponent with
+// a multiply by 2^112, which gets the denormals right too. infinities and
+// NaNs come out as 65536, which clamps to 255 anyway
+static inline float halfToFloat(unsigned short half) {
+    unsigned int bits = ((unsigned int)(half & 0x7fff) << 13) |
+                        ((unsigned int)(half & 0x8000) << 16);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value * 5.192296858534828e33f;
+}
+
+static void quantizeFloats(const float* values, unsigned char* pixels,
+                           int count) {
+    for (int i = 0; i < count; i++) {
+        pixels[i] = quantize(values[i]);
+    }
+}
+
+static void quantizeHalves(const unsigned short* values,
+                           unsigned char* pixels, int count) {
+    for (int i = 0; i < count; i++) {
+        pixels[i] = quantize(halfToFloat(values[i]));
+    }
+}
+
+#ifdef __SSE2__
+// the rest of quantize() on four values already scaled to 0 to 255. max()
+// hands back its second operand when the first is a NaN, so NaNs still
+// come out as 0
+static inline __m128i roundScaled4(__m128 scaled) {
+    scaled = _mm_add_ps(scaled, _mm_set1_ps(0.5f));
+    scaled = _mm_max_ps(scaled, _mm_setzero_ps());
+    scaled = _mm_min_ps(scaled, _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(scaled);
+}
+
+static inline __m128i quantize4(const float* values) {
+    return roundScaled4(
+        _mm_mul_ps(_mm_loadu_ps(values), _mm_set1_ps(255.0f)));
+}
+
+// halfToFloat() on four halves, each in the top of a 32-bit lane. the sign
+// is already in place, and shifting it down along with the rest only makes
+// the negatives huge and negative, which clamp to 0 all the same.
+// multiplying by 255 * 2^112 in one go rounds the same as one multiply
+// after the other, since 2^112 alone is exact
+static inline __m128i quantizeHalves4(__m128i halves) {
+    __m128 values = _mm_castsi128_ps(_mm_srai_epi32(halves, 3));
+    return roundScaled4(
+        _mm_mul_ps(values, _mm_set1_ps(255.0f * 5.192296858534828e33f)));
+}
+
+// sixteen values to sixteen bytes
+static inline void quantize16(const float* values, unsigned char* pixels) {
+    __m128i low = _mm_packs_epi32(quantize4(values), quantize4(values + 4));
+    __m128i high =
+        _mm_packs_epi32(quantize4(values + 8), quantize4(values + 12));
+    _mm_storeu_si128((__m128i*)pixels, _mm_packus_epi16(low, high));
+}
+
+static inline void quantize16(const unsigned short* values,
+                              unsigned char* pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i first = _mm_loadu_si128((const __m128i*)values);
+    __m128i second = _mm_loadu_si128((const __m128i*)(values + 8));
+    __m128i low =
+        _mm_packs_epi32(quantizeHalves4(_mm_unpacklo_epi16(zero, first)),
+                        quantizeHalves4(_mm_unpackhi_epi16(zero, first)));
+    __m128i high =
+        _mm_packs_epi32(quantizeHalves4(_mm_unpacklo_epi16(zero, second)),
+                        quantizeHalves4(_mm_unpackhi_epi16(zero, second)));
+    _mm_storeu_si128((__m128i*)pixels, _mm_packus_epi16(low, high));
+}
+#endif
+
+static inline float toFloat(float value) { return value; }
+static inline float toFloat(unsigned short half) { return halfToFloat(half); }
+
+// the top left rows by columns pixels of a tile, each row converted
+// straight to its place in a frame rowBytes wide. a tile row is only 48
+// values, too short for the loops above to get out of their scalar tails,
+// so a whole one goes sixteen values at a time by hand. only the tiles on
+// the right edge, cut short, take the plain loop
+template <class Value>
+static void quantizeTile(const Value* values, unsigned char* pixels,
+                         size_t rowBytes, int rows, int columns) {
+    const int tileValues = 3 * IMAGE_TILE_SIZE;
+#ifdef __SSE2__
+    if (columns == IMAGE_TILE_SIZE) {
+        for (int y = 0; y < rows; y++) {
+            for (int i = 0; i < tileValues; i += 16) {
+                quantize16(values + y * tileValues + i,
+                           pixels + y * rowBytes + i);
+            }
+        }
+        return;
+    }
+#endif
+    for (int y = 0; y < rows; y++) {
+        for (int i = 0; i < 3 * columns; i++) {
+            pixels[y * rowBytes + i] =
+                quantize(toFloat(values[y * tileValues + i]));
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#include "mappedfile.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define MAPPED_FILE_READ_ONLY 1
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(const string& filename)
+    : bytes(NULL), length(0), opened(false), mapped(false) {
+#ifndef MAPPED_FILE_READ_ONLY
+    int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        void* address = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE,
+                             descriptor, 0);
+        if (address != MAP_FAILED) {
+            // the parsers go front to back, so ask for readahead
+            madvise(address, status.st_size, MADV_SEQUENTIAL);
+            bytes = (const char*)address;
+            length = status.st_size;
+            opened = mapped = true;
+        }
+    }
+    close(descriptor);
+    if (opened) {
+        return;
+    }
+#endif
+
+    // no mapping, so read it into memory
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        return;
+    }
+    size_t capacity = 1 << 16;
+    char* buffer = (char*)malloc(capacity);
+    size_t got;
+    while (buffer != NULL &&
+           (got = fread(buffer + length, 1, capacity - length, file)) > 0) {
+        length += got;
+        if (length == capacity) {
+            capacity *= 2;
+            char* grown = (char*)realloc(buffer, capacity);
+            if (grown == NULL) {
+                free(buffer);
+            }
+            buffer = grown;
+        }
+    }
+    opened = (buffer != NULL) && !ferror(file);
+    fclose(file);
+    if (!opened) {
+        free(buffer);
+        length = 0;
+        return;
+    }
+    bytes = buffer;
+}
+
+MappedFile::~MappedFile() {
+#ifndef MAPPED_FILE_READ_ONLY
+    if (mapped) {
+        munmap((void*)bytes, length);
+        return;
+    }
+#endif
+    free((void*)bytes);
+}
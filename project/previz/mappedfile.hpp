@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+// a whole file mapped read-only into memory, for parsers that want to walk
+// the bytes in place instead of copying them through a stream. where the
+// file can't be mapped (an empty file, say) the bytes are read into a
+// buffer instead, so callers never have to care which one they got
+class MappedFile {
+   public:
+    MappedFile(const string& filename);
+    ~MappedFile();
+
+    // false if the file couldn't be opened or read
+    bool isOpen() const { return opened; }
+
+    const char* begin() const { return bytes; }
+    const char* end() const { return bytes + length; }
+    size_t size() const { return length; }
+
+   protected:
+    const char* bytes;
+    size_t length;
+    bool opened;
+    bool mapped;
+
+    // mapped files can't be copied
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
@@ -10,71 +10,155 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 #include <fstream>
 #include <math.h>
 #include <stdlib.h>
+#include <string>
+#include <vector>
 
 #include "skeleton.h"
 #include "motion.h"
 #include "bonevector.h"
+#include "mappedfile.hpp"
 
 Motion::Motion(int numFrames_, Skeleton * pSkeleton_)
 {
   pSkeleton = pSkeleton_;
   m_NumFrames = numFrames_;
+  m_pChannels = NULL;
+  m_pCache = NULL;
+  m_ForceAllJointsBe3DOF = 0;
 
-  //allocate postures array
-  m_pPostures = new Posture[m_NumFrames];
+  //allocate the channels
+  AllocateChannels();
 
   //Set all postures to default posture
   SetPosturesToDefault();
 }
 
-Motion::Motion(const char *amc_filename, double scale, Skeleton * pSkeleton_)
+Motion::Motion(const char *amc_filename, double scale, Skeleton * pSkeleton_, bool useCache)
 {
   pSkeleton = pSkeleton_;
   m_NumFrames = 0;
-  m_pPostures = NULL;
+  m_NumChannels = 0;
+  m_pChannels = NULL;
+  m_pCache = NULL;
+  m_ForceAllJointsBe3DOF = 0;
 
-  int code = readAMCfile(amc_filename, scale);	
+  MappedFile file(amc_filename);
+  if (!file.isOpen())
+    throw 1;
+
+  //use the cached copy if it still matches, otherwise parse and cache
+  std::string cacheFilename = std::string(amc_filename) + ".cache";
+  unsigned long long hash = 0;
+  if (useCache)
+  {
+    hash = SourceHash(file, scale);
+    if (ReadCache(cacheFilename.c_str(), hash) == 0)
+      return;
+  }
+
+  int code = readAMCfile(file, amc_filename, scale);	
   if (code < 0)
     throw 1;
+
+  if (useCache)
+    WriteCache(cacheFilename.c_str(), hash);
 }
 
 Motion::~Motion()
 {
-  if (m_pPostures != NULL)
-    delete [] m_pPostures;
+  FreeChannels();
+}
+
+void Motion::FreeChannels()
+{
+  if (m_pCache != NULL)
+    delete m_pCache;
+  else if (m_pChannels != NULL)
+    delete [] m_pChannels;
+  m_pCache = NULL;
+  m_pChannels = NULL;
+}
+
+void Motion::DetachFromCache()
+{
+  size_t count = (size_t)m_NumChannels * m_NumFrames;
+  double * channels = new double[count];
+  memcpy(channels, m_pChannels, count * sizeof(double));
+  FreeChannels();
+  m_pChannels = channels;
+}
+
+void Motion::LayOutChannels()
+{
+  Bone * bone = pSkeleton->getRoot();
+  int numbones = pSkeleton->numBonesInSkel(bone[0]);
+
+  for (int j = 0; j < MAX_BONES_IN_ASF_FILE; j++)
+    for (int channel = 0; channel < NUMBER_POSTURE_CHANNELS; channel++)
+      m_ChannelIndex[j][channel] = -1;
+
+  // one channel per degree of freedom, in the order the AMC file lists them
+  m_NumChannels = 0;
+  for (int j = 0; j < numbones; j++)
+    for (int x = 0; x < bone[j].dof; x++)
+    {
+      int channel = bone[j].dofo[x] - 1;
+      if (channel >= 0 && channel < NUMBER_POSTURE_CHANNELS && m_ChannelIndex[j][channel] < 0)
+        m_ChannelIndex[j][channel] = m_NumChannels++;
+    }
+}
+
+void Motion::AllocateChannels()
+{
+  LayOutChannels();
+  FreeChannels();
+  m_pChannels = new double[(size_t)m_NumChannels * m_NumFrames];
+}
+
+void Motion::SetChannel(int frameIndex, int boneIndex, int channel, double value)
+{
+  int index = m_ChannelIndex[boneIndex][channel];
+  if (index >= 0 && m_pCache != NULL)
+    DetachFromCache();
+  if (index >= 0)
+    m_pChannels[(size_t)index * m_NumFrames + frameIndex] = value;
 }
 
 //Set all postures to default posture
 void Motion::SetPosturesToDefault()
 {
-  for (int frame = 0; frame<m_NumFrames; frame++)
-  {
-    //set root position to (0,0,0)
-    m_pPostures[frame].root_pos.setValue(0.0, 0.0, 0.0);
-    //set each bone orientation to (0,0,0)
-    for (int j = 0; j < MAX_BONES_IN_ASF_FILE; j++)
-      m_pPostures[frame].bone_rotation[j].setValue(0.0, 0.0, 0.0);
-
-  }
+  //root position at (0,0,0), each bone orientation at (0,0,0)
+  if (m_pCache != NULL)
+    DetachFromCache();
+  for (size_t i = 0; i < (size_t)m_NumChannels * m_NumFrames; i++)
+    m_pChannels[i] = 0.0;
 }
 
 //Set posture at spesified frame
-void Motion::SetPosture(int frameIndex, Posture InPosture)
+void Motion::SetPosture(int frameIndex, const PostureView & InPosture)
 {
-  m_pPostures[frameIndex] = InPosture; 	
+  for (int j = 0; j < MAX_BONES_IN_ASF_FILE; j++)
+    for (int channel = 0; channel < NUMBER_POSTURE_CHANNELS; channel++)
+      if (m_ChannelIndex[j][channel] >= 0)
+        SetChannel(frameIndex, j, channel, InPosture.GetChannel(j, (PostureChannel)channel));
 }
 
 void Motion::SetBoneRotation(int frameIndex, int boneIndex, bonevector vRot)
 {
-  m_pPostures[frameIndex].bone_rotation[boneIndex] = vRot;
+  SetChannel(frameIndex, boneIndex, CHANNEL_RX, vRot.p[0]);
+  SetChannel(frameIndex, boneIndex, CHANNEL_RY, vRot.p[1]);
+  SetChannel(frameIndex, boneIndex, CHANNEL_RZ, vRot.p[2]);
 }
 
 void Motion::SetRootPos(int frameIndex, bonevector vPos)
 {
-  m_pPostures[frameIndex].root_pos = vPos;
+  int root = Skeleton::getRootIndex();
+  SetChannel(frameIndex, root, CHANNEL_TX, vPos.p[0]);
+  SetChannel(frameIndex, root, CHANNEL_TY, vPos.p[1]);
+  SetChannel(frameIndex, root, CHANNEL_TZ, vPos.p[2]);
 }
 
-Posture * Motion::GetPosture(int frameIndex)
+PostureView Motion::GetPosture(int frameIndex) const
 {
   if (frameIndex < 0 || frameIndex >= m_NumFrames)
   {
@@ -82,167 +166,481 @@ Posture * Motion::GetPosture(int frameIndex)
     printf("m_NumFrames = %d\n", m_NumFrames);
     exit(0);
   }
-  return &(m_pPostures[frameIndex]);
+  return PostureView(this, frameIndex);
 }
 
-int Motion::readAMCfile(const char* name, double scale)
+PostureView::PostureView(const Motion * pMotion_, int frameIndex_)
 {
-  Bone *hroot, *bone;
-  bone = hroot = pSkeleton->getRoot();
+  pMotion = pMotion_;
+  frameIndex = frameIndex_;
+}
 
-  std::ifstream file( name, std::ios::in );
-  if( file.fail() ) 
-    return -1;
+double PostureView::GetChannel(int boneIndex, PostureChannel channel) const
+{
+  const double * values = pMotion->GetChannel(boneIndex, channel);
+  return (values == NULL) ? 0.0 : values[frameIndex];
+}
 
-  int n=0;
-  char str[2048];
+//The root position is the root bone's translation
+bonevector PostureView::GetRootPos() const
+{
+  return GetBoneTranslation(Skeleton::getRootIndex());
+}
 
-  // count the number of lines
-  while(!file.eof())  
-  {
-    file.getline(str, 2048);
-    if(file.eof()) break;
-    //We do not want to count empty lines
-    if (strcmp(str, "") != 0)
-      n++;
-  }
+bonevector PostureView::GetBoneRotation(int boneIndex) const
+{
+  return bonevector(GetChannel(boneIndex, CHANNEL_RX),
+                    GetChannel(boneIndex, CHANNEL_RY),
+                    GetChannel(boneIndex, CHANNEL_RZ));
+}
 
-  file.close();
+bonevector PostureView::GetBoneTranslation(int boneIndex) const
+{
+  return bonevector(GetChannel(boneIndex, CHANNEL_TX),
+                    GetChannel(boneIndex, CHANNEL_TY),
+                    GetChannel(boneIndex, CHANNEL_TZ));
+}
 
-  //Compute number of frames. 
-  //Subtract 3 to  ignore the header
-  //There are (NUM_BONES_IN_ASF_FILE - 2) moving bones and 2 dummy bones (lhipjoint and rhipjoint)
-  int numbones = pSkeleton->numBonesInSkel(bone[0]);
-  int movbones = pSkeleton->movBonesInSkel(bone[0]);
-  n = (n-3)/((movbones) + 1);   
+double PostureView::GetBoneLength(int boneIndex) const
+{
+  return GetChannel(boneIndex, CHANNEL_TL);
+}
 
-  m_NumFrames = n;
+// AMC tokens are separated by spaces, tabs and line breaks
+static inline bool isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
 
-  //Allocate memory for state bonevector
-  m_pPostures = new Posture[m_NumFrames]; 
+// find the next token at or after cursor and move cursor past it. returns
+// NULL at the end of the file
+static inline const char * nextToken(const char * & cursor, const char * end, int & length)
+{
+  while (cursor < end && isBlank(*cursor))
+    cursor++;
+  if (cursor == end)
+    return NULL;
+  const char * token = cursor;
+  while (cursor < end && !isBlank(*cursor))
+    cursor++;
+  length = (int)(cursor - token);
+  return token;
+}
 
-  //Set all postures to default posture
-  SetPosturesToDefault();
+// parse a decimal number such as "-12.5e-3" in place. short numbers, which
+// is all an AMC file has, are done exactly with one multiply or divide by
+// a power of ten (both operands fit a double exactly, so the result is
+// correctly rounded, the same as strtod's); anything longer goes to strtod
+static bool parseNumber(const char * token, int length, double & value)
+{
+  static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  const char * c = token;
+  const char * end = token + length;
+  bool negative = (c < end && *c == '-');
+  if (c < end && (*c == '-' || *c == '+'))
+    c++;
+
+  unsigned long long mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any = false;
+  for (; c < end && *c >= '0' && *c <= '9'; c++, any = true)
+    if (mantissa != 0 || *c != '0')
+    {
+      mantissa = mantissa * 10 + (*c - '0');
+      digits++;
+    }
+  if (c < end && *c == '.')
+    for (c++; c < end && *c >= '0' && *c <= '9'; c++, any = true)
+    {
+      if (mantissa != 0 || *c != '0')
+      {
+        mantissa = mantissa * 10 + (*c - '0');
+        digits++;
+      }
+      exponent--;
+    }
+  if (any && c < end && (*c == 'e' || *c == 'E'))
+  {
+    const char * e = c + 1;
+    bool negativeExponent = (e < end && *e == '-');
+    if (e < end && (*e == '-' || *e == '+'))
+      e++;
+    int power = 0;
+    bool anyExponent = false;
+    for (; e < end && *e >= '0' && *e <= '9' && power < 10000; e++, anyExponent = true)
+      power = power * 10 + (*e - '0');
+    if (anyExponent)
+    {
+      exponent += negativeExponent ? -power : power;
+      c = e;
+    }
+  }
 
-  file.open(name);
+  if (any && c == end && digits <= 15 && exponent >= -22 && exponent <= 22)
+  {
+    value = (double)mantissa;
+    value = (exponent < 0) ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+    if (negative)
+      value = -value;
+    return true;
+  }
 
-  // process the header (add rotational DOFs to skeleton if requested)
+  // too many digits, or not a plain number: let strtod sort it out
+  char buffer[128];
+  if (length >= (int)sizeof(buffer))
+    return false;
+  memcpy(buffer, token, length);
+  buffer[length] = 0;
+  char * parsed;
+  value = strtod(buffer, &parsed);
+  return parsed == buffer + length;
+}
+
+int Motion::ReadAMCHeader(const char * & cursor, const char * end, const char * name, Skeleton * pSkeleton, int & forceAllJointsBe3DOF)
+{
+  forceAllJointsBe3DOF = 0;
   while (1) 
   {
-    file >> str;
+    int length;
+    const char * token = nextToken(cursor, end, length);
+    if (token == NULL)
+    {
+      printf("Error in Motion::readAMCfile: no :DEGREES line in '%s'.\n", name);
+      return -1;
+    }
 
-    if(strcmp(str, ":FORCE-ALL-JOINTS-BE-3DOF") == 0) 
+    // skip comments to the end of their line
+    if (token[0] == '#')
+    {
+      while (cursor < end && *cursor != '\n')
+        cursor++;
+      continue;
+    }
+
+    if (length == 25 && strncmp(token, ":FORCE-ALL-JOINTS-BE-3DOF", length) == 0) 
+    {
       pSkeleton->enableAllRotationalDOFs();
+      forceAllJointsBe3DOF = 1;
+    }
 
-    if(strcmp(str, ":DEGREES") == 0) 
-      break;
+    if (length == 8 && strncmp(token, ":DEGREES", length) == 0) 
+      return 0;
   }
+}
 
-  for(int i=0; i<m_NumFrames; i++)
-  {
-    //read frame number
-    int frame_num;
-    file >> frame_num;
+int Motion::ReadAMCFrame(const char * & cursor, const char * end, const char * name, int frameIndex, double scale, double * values, size_t stride) const
+{
+  Bone * bone = pSkeleton->getRoot();
+  int numbones = pSkeleton->numBonesInSkel(bone[0]);
 
-    //There are (NUM_BONES_IN_ASF_FILE - 2) movable bones and 2 dummy bones (lhipjoint and rhipjoint)
-    for(int j=0; j<movbones; j++)
-    {
-      //read bone name
-      file >> str;
+  //a frame starts with its number
+  int length;
+  const char * token = nextToken(cursor, end, length);
+  if (token == NULL)
+    return 0;
+  if (token[0] < '0' || token[0] > '9')
+  {
+    printf("Error in Motion::readAMCfile: expected frame %d in '%s', found '%.*s'.\n", frameIndex + 1, name, length, token);
+    return -1;
+  }
 
-      //fine the bone index corresponding to the bone name
-      int bone_idx; 
-      for( bone_idx = 0; bone_idx < numbones; bone_idx++ )
-        if( strcmp( str, pSkeleton->idx2name(bone_idx) ) == 0 ) 
-          break;
+  //anything the frame doesn't mention stays at 0
+  for (int channel = 0; channel < m_NumChannels; channel++)
+    values[channel * stride] = 0.0;
 
-      //init rotation angles for this bone to (0, 0, 0)
-      m_pPostures[i].bone_rotation[bone_idx].setValue(0.0, 0.0, 0.0);
+  //then come the bone names, each followed by its values, up to the next
+  //frame number
+  while (1)
+  {
+    const char * next = cursor;
+    token = nextToken(next, end, length);
+    if (token == NULL || (token[0] >= '0' && token[0] <= '9'))
+      return 1;
+    cursor = next;
+
+    int bone_idx = pSkeleton->name2idx(token, length);
+    if (bone_idx < 0 || bone_idx >= numbones)
+    {
+      printf("Error in Motion::readAMCfile: unknown bone '%.*s' in '%s' at frame %d.\n", length, token, name, frameIndex + 1);
+      return -1;
+    }
 
-      for(int x = 0; x < bone[bone_idx].dof; x++)
+    for (int x = 0; x < bone[bone_idx].dof; x++)
+    {
+      double tmp;
+      token = nextToken(cursor, end, length);
+      if (token == NULL || !parseNumber(token, length, tmp))
       {
-        double tmp;
-        file >> tmp;
-        //	printf("%d %f\n",bone[bone_idx].dofo[x],tmp);
-        switch (bone[bone_idx].dofo[x]) 
-        {
-        case 0:
-          printf("FATAL ERROR in bone %d not found %d\n",bone_idx,x);
-          x = bone[bone_idx].dof;
-          break;
-        case 1:
-          m_pPostures[i].bone_rotation[bone_idx].p[0] = tmp;
-          break;
-        case 2:
-          m_pPostures[i].bone_rotation[bone_idx].p[1] = tmp;
-          break;
-        case 3:
-          m_pPostures[i].bone_rotation[bone_idx].p[2] = tmp;
-          break;
-        case 4:
-          m_pPostures[i].bone_translation[bone_idx].p[0] = tmp * scale;
-          break;
-        case 5:
-          m_pPostures[i].bone_translation[bone_idx].p[1] = tmp * scale;
-          break;
-        case 6:
-          m_pPostures[i].bone_translation[bone_idx].p[2] = tmp * scale;
-          break;
-        case 7:
-          m_pPostures[i].bone_length[bone_idx].p[0] = tmp;// * scale;
-          break;
-        }
+        printf("Error in Motion::readAMCfile: bad value for bone '%s' in '%s' at frame %d.\n", pSkeleton->idx2name(bone_idx), name, frameIndex + 1);
+        return -1;
       }
-      if( strcmp( str, "root" ) == 0 ) 
+
+      int channel = bone[bone_idx].dofo[x] - 1;
+      if (channel < 0)
       {
-        m_pPostures[i].root_pos.p[0] = m_pPostures[i].bone_translation[0].p[0];// * scale;
-        m_pPostures[i].root_pos.p[1] = m_pPostures[i].bone_translation[0].p[1];// * scale;
-        m_pPostures[i].root_pos.p[2] = m_pPostures[i].bone_translation[0].p[2];// * scale;
+        printf("FATAL ERROR in bone %d not found %d\n", bone_idx, x);
+        return -1;
       }
-
-      // read joint angles, including root orientation
+      // translations are scaled like the skeleton, lengths are not
+      if (channel == CHANNEL_TX || channel == CHANNEL_TY || channel == CHANNEL_TZ)
+        tmp *= scale;
+      int index = m_ChannelIndex[bone_idx][channel];
+      if (index >= 0)
+        values[index * stride] = tmp;
     }
   }
+}
+
+int Motion::readAMCfile(const MappedFile & file, const char* name, double scale)
+{
+  // the whole file is parsed in place, in a single pass
+  const char * cursor = file.begin();
+  const char * end = file.end();
+
+  // process the header (add rotational DOFs to skeleton if requested)
+  if (ReadAMCHeader(cursor, end, name, pSkeleton, m_ForceAllJointsBe3DOF) < 0)
+    return -1;
+
+  //Lay out the channels, now that the DOFs are settled
+  LayOutChannels();
+
+  //The number of frames is only known at the end, so the frames are read
+  //one after the other, and turned into channels afterwards
+  std::vector<double> frames;
+  int n = 0;
+  while (1)
+  {
+    frames.resize((size_t)(n + 1) * m_NumChannels);
+    int code = ReadAMCFrame(cursor, end, name, n, scale, frames.data() + (size_t)n * m_NumChannels, 1);
+    if (code < 0)
+      return -1;
+    if (code == 0)
+      break;
+    n++;
+  }
+
+  //Allocate memory for the channels and move the frames over
+  m_NumFrames = n;
+  AllocateChannels();
+  for (int channel = 0; channel < m_NumChannels; channel++)
+  {
+    double * values = m_pChannels + (size_t)channel * m_NumFrames;
+    for (int i = 0; i < m_NumFrames; i++)
+      values[i] = frames[(size_t)i * m_NumChannels + channel];
+  }
 
-  file.close();
   printf("%d samples in '%s' are read.\n", n, name);
   return n;
 }
 
+//The cache file is a MotionCacheHeader, the DOF order (dofo) of every bone,
+//then the channels one after the other from channelOffset on, which is a
+//multiple of 64. Everything is in the byte order of the machine that wrote
+//it, and the file is only used on one with the same
+static const char MOTION_CACHE_MAGIC[8] = { 'P', 'V', 'M', 'O', 'T', 'I', 'O', 'N' };
+static const unsigned int MOTION_CACHE_VERSION = 1;
+static const unsigned int MOTION_CACHE_BYTE_ORDER = 0x01020304;
+
+struct MotionCacheHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int byteOrder;
+  unsigned long long sourceHash;
+  int numFrames;
+  int numChannels;
+  int numBones;
+  int forceAllJointsBe3DOF;
+  unsigned long long channelOffset;
+};
+
+static const unsigned long long HASH_PRIME = 1099511628211ull;
+
+//FNV-1a style hash, but over eight bytes at a time and in four separate
+//streams, so that hashing a large AMC file costs next to nothing
+static unsigned long long hashBytes(unsigned long long hash, const void * data, size_t length)
+{
+  const unsigned char * bytes = (const unsigned char *)data;
+  unsigned long long streams[4] = { hash, hash ^ 1, hash ^ 2, hash ^ 3 };
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32)
+    for (int k = 0; k < 4; k++)
+    {
+      unsigned long long word;
+      memcpy(&word, bytes + i + 8 * k, 8);
+      streams[k] = (streams[k] ^ word) * HASH_PRIME;
+    }
+  for (; i < length; i++)
+    streams[0] = (streams[0] ^ bytes[i]) * HASH_PRIME;
+
+  hash ^= length;
+  for (int k = 0; k < 4; k++)
+  {
+    hash = (hash ^ streams[k]) * HASH_PRIME;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+unsigned long long Motion::SourceHash(const MappedFile & file, double scale)
+{
+  unsigned long long hash = hashBytes(14695981039346656037ull, file.begin(), file.size());
+  hash = hashBytes(hash, &scale, sizeof(scale));
+
+  Bone * bone = pSkeleton->getRoot();
+  int numbones = pSkeleton->numBonesInSkel(bone[0]);
+  for (int j = 0; j < numbones; j++)
+  {
+    hash = hashBytes(hash, bone[j].name, strlen(bone[j].name));
+    hash = hashBytes(hash, &bone[j].idx, sizeof(int));
+    hash = hashBytes(hash, &bone[j].dof, sizeof(int));
+    hash = hashBytes(hash, bone[j].dofo, bone[j].dof * sizeof(int));
+  }
+  return hash;
+}
+
+int Motion::ReadCache(const char * cacheFilename, unsigned long long sourceHash)
+{
+  MappedFile * cache = new MappedFile(cacheFilename);
+  const MotionCacheHeader * header = (const MotionCacheHeader *)cache->begin();
+  Bone * bone = pSkeleton->getRoot();
+  int numbones = pSkeleton->numBonesInSkel(bone[0]);
+
+  bool valid = cache->isOpen() && cache->size() >= sizeof(MotionCacheHeader) &&
+    memcmp(header->magic, MOTION_CACHE_MAGIC, sizeof(MOTION_CACHE_MAGIC)) == 0 &&
+    header->version == MOTION_CACHE_VERSION &&
+    header->byteOrder == MOTION_CACHE_BYTE_ORDER &&
+    header->sourceHash == sourceHash &&
+    header->numBones == numbones &&
+    header->numFrames >= 0 && header->numChannels >= 0 &&
+    header->channelOffset % 64 == 0 &&
+    header->channelOffset >= sizeof(MotionCacheHeader) + numbones * 8 * sizeof(int) &&
+    header->channelOffset <= cache->size() &&
+    (cache->size() - header->channelOffset) / sizeof(double) >= (size_t)header->numChannels * header->numFrames;
+  if (!valid)
+  {
+    delete cache;
+    return -1;
+  }
+
+  //the skeleton has to end up with the DOFs the cached channels were laid
+  //out for
+  if (header->forceAllJointsBe3DOF)
+    pSkeleton->enableAllRotationalDOFs();
+  m_ForceAllJointsBe3DOF = header->forceAllJointsBe3DOF;
+  LayOutChannels();
+
+  const int * dofo = (const int *)(header + 1);
+  valid = (m_NumChannels == header->numChannels);
+  for (int j = 0; valid && j < numbones; j++)
+    for (int x = 0; x < 8; x++)
+      valid = valid && (x >= bone[j].dof || dofo[8 * j + x] == bone[j].dofo[x]);
+  if (!valid)
+  {
+    printf("Motion cache '%s' doesn't match the skeleton; parsing instead.\n", cacheFilename);
+    delete cache;
+    return -1;
+  }
+
+  FreeChannels();
+  m_NumFrames = header->numFrames;
+  m_pChannels = (double *)(cache->begin() + header->channelOffset);
+  m_pCache = cache;
+  printf("%d samples in '%s' are mapped.\n", m_NumFrames, cacheFilename);
+  return 0;
+}
+
+int Motion::WriteCache(const char * cacheFilename, unsigned long long sourceHash)
+{
+  Bone * bone = pSkeleton->getRoot();
+  int numbones = pSkeleton->numBonesInSkel(bone[0]);
+
+  MotionCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MOTION_CACHE_MAGIC, sizeof(MOTION_CACHE_MAGIC));
+  header.version = MOTION_CACHE_VERSION;
+  header.byteOrder = MOTION_CACHE_BYTE_ORDER;
+  header.sourceHash = sourceHash;
+  header.numFrames = m_NumFrames;
+  header.numChannels = m_NumChannels;
+  header.numBones = numbones;
+  header.forceAllJointsBe3DOF = m_ForceAllJointsBe3DOF;
+  header.channelOffset = (sizeof(header) + numbones * 8 * sizeof(int) + 63) / 64 * 64;
+
+  std::vector<int> dofo(numbones * 8, 0);
+  for (int j = 0; j < numbones; j++)
+    for (int x = 0; x < bone[j].dof && x < 8; x++)
+      dofo[8 * j + x] = bone[j].dofo[x];
+
+  //write it under a temporary name, so that nobody maps half a file
+  std::string temporary = std::string(cacheFilename) + ".tmp";
+  FILE * file = fopen(temporary.c_str(), "wb");
+  if (file == NULL)
+  {
+    printf("Couldn't write the motion cache '%s'.\n", cacheFilename);
+    return -1;
+  }
+  size_t padding = header.channelOffset - sizeof(header) - dofo.size() * sizeof(int);
+  std::vector<char> zeros(padding, 0);
+  size_t count = (size_t)m_NumChannels * m_NumFrames;
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(&dofo[0], sizeof(int), dofo.size(), file) == dofo.size() &&
+    (padding == 0 || fwrite(&zeros[0], 1, padding, file) == padding) &&
+    (count == 0 || fwrite(m_pChannels, sizeof(double), count, file) == count);
+  written = (fclose(file) == 0) && written;
+  if (!written || rename(temporary.c_str(), cacheFilename) != 0)
+  {
+    printf("Couldn't write the motion cache '%s'.\n", cacheFilename);
+    remove(temporary.c_str());
+    return -1;
+  }
+  return 0;
+}
+
 int Motion::writeAMCfile(char * filename, double scale, int forceAllJointsBe3DOF)
 {
   Bone * bone = pSkeleton->getRoot();
 
-  std::ofstream os(filename);
+  // lines go out through a large buffer, and only get flushed at the end
+  std::vector<char> buffer(1 << 16);
+  std::ofstream os;
+  os.rdbuf()->pubsetbuf(&buffer[0], buffer.size());
+  os.open(filename);
   if(os.fail()) 
     return -1;
 
   // header lines
-  os << ":FULLY-SPECIFIED" << std::endl;
+  os << ":FULLY-SPECIFIED\n";
   if (forceAllJointsBe3DOF)
-    os << ":FORCE-ALL-JOINTS-BE-3DOF" << std::endl;
-  os << ":DEGREES" << std::endl;
+    os << ":FORCE-ALL-JOINTS-BE-3DOF\n";
+  os << ":DEGREES\n";
 
   int numbones = pSkeleton->numBonesInSkel(bone[0]);
 
   int root = Skeleton::getRootIndex();
   for(int f=0; f < m_NumFrames; f++)
   {
-    os << f+1 << std::endl;
+    PostureView posture = GetPosture(f);
+    bonevector rootPos = posture.GetRootPos();
+    bonevector rootRotation = posture.GetBoneRotation(root);
+    os << f+1 << "\n";
     os << "root " 
-       << m_pPostures[f].root_pos.p[0] / scale << " " 
-       << m_pPostures[f].root_pos.p[1] / scale << " " 
-       << m_pPostures[f].root_pos.p[2] / scale << " " 
-       << m_pPostures[f].bone_rotation[root].p[0] << " " 
-       << m_pPostures[f].bone_rotation[root].p[1] << " " 
-       << m_pPostures[f].bone_rotation[root].p[2] ;
+       << rootPos.p[0] / scale << " " 
+       << rootPos.p[1] / scale << " " 
+       << rootPos.p[2] / scale << " " 
+       << rootRotation.p[0] << " " 
+       << rootRotation.p[1] << " " 
+       << rootRotation.p[2] ;
 
     for(int j = 2; j < numbones; j++) 
     {
       //output bone name
       if(bone[j].dof != 0)
       {
-        os << std::endl << pSkeleton->idx2name(j);
+        os << "\n" << pSkeleton->idx2name(j);
 
         //output bone rotation angles
         for(int d=0; d<bone[j].dof; d++)
@@ -254,7 +652,7 @@ int Motion::writeAMCfile(char * filename, double scale, int forceAllJointsBe3DOF
           {
             // if enabled, output the DOF
             if(bone[j].dofrx == 1) 
-              os << " " << m_pPostures[f].bone_rotation[j].p[0];
+              os << " " << posture.GetChannel(j, CHANNEL_RX);
           }
 
           // is this DOF ry ?
@@ -262,7 +660,7 @@ int Motion::writeAMCfile(char * filename, double scale, int forceAllJointsBe3DOF
           {
             // if enabled, output the DOF
             if(bone[j].dofry == 1) 
-              os << " " << m_pPostures[f].bone_rotation[j].p[1];
+              os << " " << posture.GetChannel(j, CHANNEL_RY);
           }
 
           // is this DOF rz ?
@@ -270,12 +668,12 @@ int Motion::writeAMCfile(char * filename, double scale, int forceAllJointsBe3DOF
           {
             // if enabled, output the DOF
             if(bone[j].dofrz == 1) 
-              os << " " << m_pPostures[f].bone_rotation[j].p[2];
+              os << " " << posture.GetChannel(j, CHANNEL_RZ);
           }
         }
       }
     }
-    os << std::endl;
+    os << "\n";
   }
 
   os.close();
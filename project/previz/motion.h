@@ -22,13 +22,21 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb 2012
 #include "posture.h"
 #include "skeleton.h"
 
+class MappedFile;
+
 class Motion 
 {
+  //MotionStream reads frames with the same parser
+  friend class MotionStream;
+
   //function members
 public:
 
   // parse AMC file (default scale=0.06)
-  Motion(const char *amc_filename, double scale, Skeleton * pSkeleton);
+  // The parsed motion is also saved to amc_filename + ".cache", and later loads
+  // map that file instead of parsing again, for as long as the AMC file, the
+  // skeleton and the scale stay the same. useCache=false always parses
+  Motion(const char *amc_filename, double scale, Skeleton * pSkeleton, bool useCache = true);
 
   //Use to create default motion with specified number of frames
   Motion(int numFrames, Skeleton * pSkeleton);
@@ -46,26 +54,91 @@ public:
   void SetPosturesToDefault();
 
   //Set the entire posture at specified frame (posture = root position and all bone rotations)
-  void SetPosture(int frameIndex, Posture InPosture);
+  //The posture can come from any motion of the same skeleton
+  void SetPosture(int frameIndex, const PostureView & InPosture);
 
   //Set root position at specified frame
   void SetRootPos(int frameIndex, bonevector vPos);
   //Set specified bone rotation at specified frame
   void SetBoneRotation(int frameIndex, int boneIndex, bonevector vRot);
 
-  int GetNumFrames() { return m_NumFrames; }
-  Posture * GetPosture(int frameIndex);
+  int GetNumFrames() const { return m_NumFrames; }
+  PostureView GetPosture(int frameIndex) const;
+
+  //All the frames of one channel of a bone, one after the other, or NULL
+  //if the skeleton does not have that degree of freedom
+  const double * GetChannel(int boneIndex, PostureChannel channel) const
+  {
+    int index = m_ChannelIndex[boneIndex][channel];
+    return (index < 0) ? NULL : m_pChannels + (size_t)index * m_NumFrames;
+  }
+
+  //Number of channels stored per frame, one per degree of freedom of the skeleton
+  int GetNumChannels() const { return m_NumChannels; }
+
+  //Whether the channels are read straight out of a mapped cache file
+  bool IsCached() const { return m_pCache != NULL; }
 
-  Skeleton * GetSkeleton() { return pSkeleton; }
+  Skeleton * GetSkeleton() const { return pSkeleton; }
+
+  //Set one channel of a bone, if the motion stores it
+  void SetChannel(int frameIndex, int boneIndex, int channel, double value);
 
 protected:
   int m_NumFrames; //number of frames in the motion 
   Skeleton * pSkeleton;
-  //Root position and all bone rotation angles for each frame (as read from AMC file)
-  Posture * m_pPostures; 
+
+  //Root position and all bone rotation angles for each frame (as read from AMC file),
+  //stored channel by channel: only the degrees of freedom the skeleton has, and
+  //each one as a single array over all the frames
+  int m_NumChannels;
+  int m_ChannelIndex[MAX_BONES_IN_ASF_FILE][NUMBER_POSTURE_CHANNELS]; // -1 if not stored
+  double * m_pChannels;
+
+  //The mapped cache file m_pChannels points into, or NULL if the channels
+  //are on the heap. The mapping is read-only, so the channels are copied to
+  //the heap before the first change
+  MappedFile * m_pCache;
+
+  //Whether the AMC file had :FORCE-ALL-JOINTS-BE-3DOF
+  int m_ForceAllJointsBe3DOF;
+
+  //Lay out a channel for every degree of freedom of the skeleton
+  void LayOutChannels();
+
+  //Lay out the channels and allocate them for m_NumFrames frames
+  void AllocateChannels();
+
+  //Release the channels, wherever they are
+  void FreeChannels();
+
+  //Copy the channels out of the cache file, so they can be changed
+  void DetachFromCache();
 
   // The default value is 0.06
-  int readAMCfile(const char* name, double scale);
+  int readAMCfile(const MappedFile & file, const char* name, double scale);
+
+  //Skip the header of an AMC file, which starts at cursor, enabling all the
+  //rotational DOFs of the skeleton if it asks for that
+  static int ReadAMCHeader(const char * & cursor, const char * end, const char * name,
+                           Skeleton * pSkeleton, int & forceAllJointsBe3DOF);
+
+  //Read the frame that starts at cursor (with its frame number), laid out
+  //like this motion's channels: channel c goes to values[c * stride].
+  //returns 1 for a frame, 0 at the end of the file and -1 on errors
+  int ReadAMCFrame(const char * & cursor, const char * end, const char * name, int frameIndex,
+                   double scale, double * values, size_t stride) const;
+
+  //Hash of everything the parsed motion depends on: the AMC file, the bones
+  //and DOFs of the skeleton, and the scale
+  unsigned long long SourceHash(const MappedFile & file, double scale);
+
+  //Map the channels from a cache file with the given source hash. returns
+  //-1 if there is no such file or it doesn't match
+  int ReadCache(const char * cacheFilename, unsigned long long sourceHash);
+
+  //Save the parsed channels to a cache file
+  int WriteCache(const char * cacheFilename, unsigned long long sourceHash);
 };
 
 #endif
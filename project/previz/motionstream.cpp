@@ -0,0 +1,148 @@
+#include "motionstream.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+MotionStream::MotionStream(const char* amcFilename, double scale,
+                           Skeleton* skeleton, int window)
+    : filename(amcFilename),
+      scale(scale),
+      file(amcFilename),
+      totalSlots(std::max(window, 1)),
+      slotFrames(totalSlots, -1),
+      slotReaders(totalSlots, 0),
+      nextFrame(0),
+      furthestRequest(0),
+      rewindTo(-1),
+      endFrame(-1),
+      stopping(false) {
+    if (!file.isOpen()) {
+        throw 1;
+    }
+
+    // the header can change the DOFs, so it goes before the ring is laid out
+    cursor = file.begin();
+    int forceAllJointsBe3DOF;
+    if (Motion::ReadAMCHeader(cursor, file.end(), filename.c_str(), skeleton,
+                              forceAllJointsBe3DOF) < 0) {
+        throw 1;
+    }
+    ring.reset(new Motion(totalSlots, skeleton));
+    checkpoints.push_back(cursor - file.begin());
+
+    decoder = thread(&MotionStream::decode, this);
+}
+
+MotionStream::~MotionStream() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    decoder.join();
+}
+
+int MotionStream::framesDecoded() {
+    lock_guard<mutex> guard(lock);
+    return nextFrame;
+}
+
+int MotionStream::totalFrames() {
+    lock_guard<mutex> guard(lock);
+    return endFrame;
+}
+
+int MotionStream::setPosture(Skeleton* target, int frameIndex) {
+    unique_lock<mutex> guard(lock);
+    if (frameIndex > furthestRequest) {
+        furthestRequest = frameIndex;
+        changed.notify_all();
+    }
+
+    int slot;
+    while (true) {
+        if (endFrame >= 0 && frameIndex >= endFrame) {
+            if (endFrame == 0) {
+                return -1;
+            }
+            frameIndex = endFrame - 1;
+        }
+        slot = frameIndex % totalSlots;
+        if (slotFrames[slot] == frameIndex) {
+            break;
+        }
+
+        // it was decoded once, but something newer has taken its slot
+        if (frameIndex < nextFrame) {
+            rewindTo = (rewindTo < 0) ? frameIndex : std::min(rewindTo, frameIndex);
+            changed.notify_all();
+        }
+        changed.wait(guard);
+    }
+
+    // the decoder leaves the slot alone while it's being read
+    slotReaders[slot]++;
+    guard.unlock();
+    target->setPosture(ring->GetPosture(slot));
+    guard.lock();
+    slotReaders[slot]--;
+    changed.notify_all();
+    return frameIndex;
+}
+
+void MotionStream::decode() {
+    unique_lock<mutex> guard(lock);
+    while (!stopping) {
+        if (rewindTo >= 0) {
+            int checkpoint = std::min(rewindTo / CHECKPOINT_INTERVAL,
+                                      (int)checkpoints.size() - 1);
+            nextFrame = checkpoint * CHECKPOINT_INTERVAL;
+            cursor = file.begin() + checkpoints[checkpoint];
+            rewindTo = -1;
+        }
+
+        // far enough ahead, at the end, or about to overwrite a frame
+        // that's being read: wait for the readers
+        int slot = nextFrame % totalSlots;
+        bool done = (endFrame >= 0 && nextFrame >= endFrame) ||
+                    nextFrame > furthestRequest + totalSlots / 2;
+        if (done || slotReaders[slot] > 0) {
+            changed.wait(guard);
+            continue;
+        }
+
+        // nobody can see the slot while it's being filled, so the parsing
+        // itself happens outside the lock
+        int frame = nextFrame;
+        const char* at = cursor;
+        slotFrames[slot] = -1;
+        guard.unlock();
+        int code = ring->ReadAMCFrame(at, file.end(), filename.c_str(), frame,
+                                      scale, ring->m_pChannels + slot,
+                                      totalSlots);
+        guard.lock();
+
+        // the end of the file, or a frame that doesn't parse, which ends
+        // the motion there too
+        if (code <= 0) {
+            if (endFrame < 0) {
+                printf("%d samples in '%s' are streamed.\n", frame,
+                       filename.c_str());
+            }
+            endFrame = frame;
+            changed.notify_all();
+            continue;
+        }
+
+        slotFrames[slot] = frame;
+        nextFrame = frame + 1;
+        cursor = at;
+        if (nextFrame % CHECKPOINT_INTERVAL == 0 &&
+            nextFrame / CHECKPOINT_INTERVAL == (int)checkpoints.size()) {
+            checkpoints.push_back(cursor - file.begin());
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mappedfile.hpp"
+#include "motion.h"
+#include "skeleton.h"
+
+using namespace std;
+
+// an AMC file read a frame at a time, for captures too long to load into a
+// Motion up front. a thread decodes frames into a ring of window() frames,
+// staying up to half a window ahead of the furthest frame asked for, so
+// memory doesn't grow with the length of the capture and the first frames
+// can be posed before the rest of the file has been read. a frame that has
+// already dropped out of the ring is decoded again from the last
+// checkpoint before it, so going backwards works, just slowly
+class MotionStream {
+   public:
+    // reads the header and starts decoding. the channels are laid out for
+    // the given skeleton, whose DOFs change if the file forces all joints
+    // to be 3 DOF, and which has to outlive the stream. throws 1 if the file
+    // can't be read, the same as Motion
+    MotionStream(const char* amcFilename, double scale, Skeleton* skeleton,
+                 int window = DEFAULT_WINDOW);
+    ~MotionStream();
+
+    // pose a skeleton (the one above, or another with the same DOFs) in the
+    // given frame, waiting for the frame to be decoded if it hasn't been
+    // yet. past the end of the motion it gets the last frame. returns the
+    // frame it got, or -1 if the motion has no frames at all. safe to call
+    // from several threads at once, for different skeletons
+    int setPosture(Skeleton* target, int frameIndex);
+
+    // frames in the ring
+    int window() const { return totalSlots; }
+
+    // frames decoded so far, and the length of the motion once the
+    // decoder has reached the end of the file (-1 before that)
+    int framesDecoded();
+    int totalFrames();
+
+    static const int DEFAULT_WINDOW = 256;
+
+    // frames between the places in the file decoding can restart from
+    static const int CHECKPOINT_INTERVAL = 256;
+
+   protected:
+    string filename;
+    double scale;
+    MappedFile file;
+
+    // the ring is a Motion of window() frames, which frame f of the file
+    // goes into as frame f % window()
+    unique_ptr<Motion> ring;
+    int totalSlots;
+
+    // the file frame in every slot (-1 while it is being decoded), and how
+    // many setPosture() calls are reading it
+    vector<int> slotFrames;
+    vector<int> slotReaders;
+
+    // where the decoder is, and the file offsets of every
+    // CHECKPOINT_INTERVAL-th frame it has seen
+    const char* cursor;
+    int nextFrame;
+    vector<size_t> checkpoints;
+
+    // what the readers want: the furthest frame so far, and the earliest
+    // frame that has to be decoded again (-1 for none)
+    int furthestRequest;
+    int rewindTo;
+
+    // -1 until the end of the file
+    int endFrame;
+    bool stopping;
+
+    mutex lock;
+    condition_variable changed;
+    thread decoder;
+
+    // the decoder thread
+    void decode();
+};
@@ -0,0 +1,174 @@
+#include "packet.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACKET_X86 1
+#endif
+
+using namespace std;
+
+#ifdef PACKET_X86
+
+//////////////////////////////////////////////////////////////////////////////////
+// The same kernels are compiled three times, once per instruction set. Each
+// namespace wraps the intrinsics it needs in the same small set of v*
+// functions, and only the AVX2 and AVX-512 versions get compiled for those
+// targets, so the binary still runs on plain SSE2 machines.
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace sse {
+static const int LANES = 4;
+typedef __m128 vfloat;
+typedef __m128 vbool;
+
+static inline vfloat vset(float a) { return _mm_set1_ps(a); }
+static inline vfloat vload(const float* a) { return _mm_loadu_ps(a); }
+static inline void vstore(float* a, vfloat b) { _mm_storeu_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+static inline vbool vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vbool vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+static inline vbool vgt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+static inline vbool vge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+static inline vbool vand(vbool a, vbool b) { return _mm_and_ps(a, b); }
+static inline int vbits(vbool a) { return _mm_movemask_ps(a); }
+static inline vfloat vselect(vbool mask, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+#include "packet_kernel.inl"
+}  // namespace sse
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+static const int LANES = 8;
+typedef __m256 vfloat;
+typedef __m256 vbool;
+
+static inline vfloat vset(float a) { return _mm256_set1_ps(a); }
+static inline vfloat vload(const float* a) { return _mm256_loadu_ps(a); }
+static inline void vstore(float* a, vfloat b) { _mm256_storeu_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+static inline vbool vlt(vfloat a, vfloat b) {
+    return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+static inline vbool vle(vfloat a, vfloat b) {
+    return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+static inline vbool vgt(vfloat a, vfloat b) {
+    return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+static inline vbool vge(vfloat a, vfloat b) {
+    return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+static inline vbool vand(vbool a, vbool b) { return _mm256_and_ps(a, b); }
+static inline int vbits(vbool a) { return _mm256_movemask_ps(a); }
+static inline vfloat vselect(vbool mask, vfloat a, vfloat b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+#include "packet_kernel.inl"
+}  // namespace avx2
+#pragma GCC pop_options
+
+// gcc's avx512 headers start some intrinsics from _mm512_undefined_ps(),
+// which sets off -Wuninitialized once they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace avx512 {
+static const int LANES = 16;
+typedef __m512 vfloat;
+typedef __mmask16 vbool;
+
+static inline vfloat vset(float a) { return _mm512_set1_ps(a); }
+static inline vfloat vload(const float* a) { return _mm512_loadu_ps(a); }
+static inline void vstore(float* a, vfloat b) { _mm512_storeu_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm512_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm512_max_ps(a, b); }
+static inline vfloat vsqrt(vfloat a) { return _mm512_sqrt_ps(a); }
+static inline vbool vlt(vfloat a, vfloat b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+}
+static inline vbool vle(vfloat a, vfloat b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ);
+}
+static inline vbool vgt(vfloat a, vfloat b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+}
+static inline vbool vge(vfloat a, vfloat b) {
+    return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ);
+}
+static inline vbool vand(vbool a, vbool b) { return a & b; }
+static inline int vbits(vbool a) { return a; }
+static inline vfloat vselect(vbool mask, vfloat a, vfloat b) {
+    return _mm512_mask_blend_ps(mask, b, a);
+}
+
+#include "packet_kernel.inl"
+}  // namespace avx512
+#pragma GCC pop_options
+#pragma GCC diagnostic pop
+
+#endif
+
+bool packetWidthSupported(int width) {
+#ifdef PACKET_X86
+    __builtin_cpu_init();
+    if (width == 4) {
+        return __builtin_cpu_supports("sse2");
+    }
+    if (width == 8) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    if (width == 16) {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return false;
+}
+
+int widestPacketWidth() {
+    for (int width = 16; width >= 4; width /= 2) {
+        if (packetWidthSupported(width)) {
+            return width;
+        }
+    }
+    return 0;
+}
+
+void intersectPacket(SceneBVH& scene, const Ray* rays, int count, int width,
+                     IntersectResult* results) {
+    if (count <= 0) {
+        return;
+    }
+#ifdef PACKET_X86
+    static const bool hasSSE = packetWidthSupported(4);
+    static const bool hasAVX2 = packetWidthSupported(8);
+    static const bool hasAVX512 = packetWidthSupported(16);
+    if (width == 4 && count <= 4 && hasSSE) {
+        sse::tracePacket(scene, rays, count, results);
+        return;
+    }
+    if (width == 8 && count <= 8 && hasAVX2) {
+        avx2::tracePacket(scene, rays, count, results);
+        return;
+    }
+    if (width == 16 && count <= 16 && hasAVX512) {
+        avx512::tracePacket(scene, rays, count, results);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) {
+        results[i] = scene.intersect(rays[i], 0.0);
+    }
+}
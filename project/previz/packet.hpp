@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "bvh.hpp"
+#include "tracer.hpp"
+
+using namespace std;
+
+// SIMD ray packets for coherent rays (in practice: primary rays from a
+// small block of neighbouring pixels). a packet walks the BVH together and
+// tests each node and each sphere or triangle against all of its lanes at
+// once, 4 wide with SSE, 8 wide with AVX2 or 16 wide with AVX-512. lanes
+// that stop agreeing with the rest of the packet, and shapes without a
+// packet kernel, drop back to the scalar code
+
+// true if this CPU can run packets of the given width (4, 8 or 16)
+bool packetWidthSupported(int width);
+
+// the widest packet this CPU supports, or 0 if there is no packet support
+int widestPacketWidth();
+
+// find the closest hit for each of the first count rays (count <= width),
+// same as scene.intersect(rays[i], 0.0) up to single precision ties. a
+// width this CPU doesn't support just runs the scalar code
+void intersectPacket(SceneBVH& scene, const Ray* rays, int count, int width,
+                     IntersectResult* results);
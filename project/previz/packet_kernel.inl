@@ -0,0 +1,284 @@
+// packet traversal and intersection kernels. packet.cpp includes this once
+// per instruction set, inside a namespace that provides LANES, the vfloat
+// and vbool types and the v* operations on them
+
+// SoA bundle of up to LANES rays, in single precision
+class RayPacket {
+   public:
+    vfloat originX, originY, originZ;
+    vfloat directionX, directionY, directionZ;
+    vfloat inverseX, inverseY, inverseZ;
+
+    // closest hit so far, per lane. empty lanes start at -1 so they never
+    // hit anything
+    float tMax[LANES];
+    Shape* hit[LANES];
+
+    const Ray* rays;
+    int count;
+};
+
+// nodes of the BVH are stored in double precision, round them outwards so
+// the float test can't miss a shape that touches the box
+static inline float roundDown(Real value) {
+    float rounded = (float)value;
+    return ((Real)rounded > value) ? nextafterf(rounded, -INFINITY) : rounded;
+}
+
+static inline float roundUp(Real value) {
+    float rounded = (float)value;
+    return ((Real)rounded < value) ? nextafterf(rounded, INFINITY) : rounded;
+}
+
+static inline vbool packetHitsBox(const RayPacket& packet, const AABB& box) {
+    vfloat t0 = (vset(roundDown(box.min[0])) - packet.originX) *
+                packet.inverseX;
+    vfloat t1 = (vset(roundUp(box.max[0])) - packet.originX) * packet.inverseX;
+    vfloat tEnter = vmin(t0, t1);
+    vfloat tExit = vmax(t0, t1);
+
+    t0 = (vset(roundDown(box.min[1])) - packet.originY) * packet.inverseY;
+    t1 = (vset(roundUp(box.max[1])) - packet.originY) * packet.inverseY;
+    tEnter = vmax(tEnter, vmin(t0, t1));
+    tExit = vmin(tExit, vmax(t0, t1));
+
+    t0 = (vset(roundDown(box.min[2])) - packet.originZ) * packet.inverseZ;
+    t1 = (vset(roundUp(box.max[2])) - packet.originZ) * packet.inverseZ;
+    tEnter = vmax(tEnter, vmin(t0, t1));
+    tExit = vmin(tExit, vmax(t0, t1));
+
+    // pad the exit distance by a few ulps to cover the rounding above
+    tEnter = vmax(tEnter, vset(0.0f));
+    tExit = vmin(tExit * vset(1.0f + 1e-5f), vload(packet.tMax));
+    return vle(tEnter, tExit);
+}
+
+// keep the lanes of t that are closer than what each lane already has
+static inline void acceptHits(RayPacket& packet, vbool valid, vfloat t,
+                              Shape* shape) {
+    vfloat tMax = vload(packet.tMax);
+    valid = vand(valid, vand(vge(t, vset(0.0f)), vlt(t, tMax)));
+    int bits = vbits(valid);
+    if (bits == 0) {
+        return;
+    }
+    vstore(packet.tMax, vselect(valid, t, tMax));
+    for (int i = 0; i < LANES; i++) {
+        if (bits & (1 << i)) {
+            packet.hit[i] = shape;
+        }
+    }
+}
+
+// same roots as Sphere::intersect, but the discriminant is computed from
+// the distance between the center and the ray, which holds up much better
+// in single precision for small, far away spheres
+static inline void intersectSpheres(RayPacket& packet,
+                                    const PacketPrimitive& primitive,
+                                    Shape* shape) {
+    vfloat ocX = packet.originX - vset(primitive.data[0]);
+    vfloat ocY = packet.originY - vset(primitive.data[1]);
+    vfloat ocZ = packet.originZ - vset(primitive.data[2]);
+    vfloat radius = vset(primitive.data[3]);
+
+    vfloat A = packet.directionX * packet.directionX +
+               packet.directionY * packet.directionY +
+               packet.directionZ * packet.directionZ;
+    vfloat b = (packet.directionX * ocX + packet.directionY * ocY +
+                packet.directionZ * ocZ) /
+               A;
+    vfloat fX = ocX - b * packet.directionX;
+    vfloat fY = ocY - b * packet.directionY;
+    vfloat fZ = ocZ - b * packet.directionZ;
+    vfloat discriminant =
+        radius * radius - (fX * fX + fY * fY + fZ * fZ);
+
+    vbool valid = vge(discriminant, vset(0.0f));
+    vfloat root = vsqrt(vmax(discriminant, vset(0.0f)) / A);
+    vfloat t2 = vset(0.0f) - b - root;
+    vfloat t1 = vset(0.0f) - b + root;
+    vfloat t = vselect(vlt(t2, vset(0.0f)), t1, t2);
+    acceptHits(packet, valid, t, shape);
+}
+
+// Moller-Trumbore, as in Triangle::intersect. the barycentric tests get a
+// little slack so that rays down a shared edge can't slip between two
+// triangles in single precision; hits are re-checked in double afterwards
+static inline void intersectTriangles(RayPacket& packet,
+                                      const PacketPrimitive& primitive,
+                                      Shape* shape) {
+    const float* data = primitive.data;
+    vfloat edge1X = vset(data[3]), edge1Y = vset(data[4]),
+           edge1Z = vset(data[5]);
+    vfloat edge2X = vset(data[6]), edge2Y = vset(data[7]),
+           edge2Z = vset(data[8]);
+
+    // h = direction x edge2
+    vfloat hX = packet.directionY * edge2Z - packet.directionZ * edge2Y;
+    vfloat hY = packet.directionZ * edge2X - packet.directionX * edge2Z;
+    vfloat hZ = packet.directionX * edge2Y - packet.directionY * edge2X;
+    vfloat a = edge1X * hX + edge1Y * hY + edge1Z * hZ;
+    vbool valid = vgt(vmax(a, vset(0.0f) - a), vset(1e-12f));
+
+    vfloat f = vset(1.0f) / a;
+    vfloat sX = packet.originX - vset(data[0]);
+    vfloat sY = packet.originY - vset(data[1]);
+    vfloat sZ = packet.originZ - vset(data[2]);
+    vfloat u = f * (sX * hX + sY * hY + sZ * hZ);
+
+    // q = s x edge1
+    vfloat qX = sY * edge1Z - sZ * edge1Y;
+    vfloat qY = sZ * edge1X - sX * edge1Z;
+    vfloat qZ = sX * edge1Y - sY * edge1X;
+    vfloat v = f * (packet.directionX * qX + packet.directionY * qY +
+                    packet.directionZ * qZ);
+
+    vfloat slack = vset(1e-5f);
+    valid = vand(valid, vge(u, vset(0.0f) - slack));
+    valid = vand(valid, vge(v, vset(0.0f) - slack));
+    valid = vand(valid, vle(u + v, vset(1.0f) + slack));
+
+    vfloat t = f * (edge2X * qX + edge2Y * qY + edge2Z * qZ);
+    acceptHits(packet, valid, t, shape);
+}
+
+// shapes without a packet kernel, one lane at a time
+static inline void intersectLanes(RayPacket& packet, int bits, Shape* shape) {
+    for (int i = 0; i < LANES; i++) {
+        if ((bits & (1 << i)) == 0) {
+            continue;
+        }
+        IntersectResult result = shape->intersect(packet.rays[i]);
+        if (result.doesIntersect && result.t >= 0.0 &&
+            result.t < packet.tMax[i]) {
+            packet.tMax[i] = result.t;
+            packet.hit[i] = shape;
+        }
+    }
+}
+
+static void traceBVH(BVH& bvh, RayPacket& packet) {
+    const vector<BVHNode>& nodes = bvh.getNodes();
+    const vector<PacketPrimitive>& primitives = bvh.getPacketPrimitives();
+    if (bvh.totalShapes() == 0) {
+        return;
+    }
+
+    // below this many live lanes a packet costs more than separate rays
+    const int divergentLanes = std::max(1, LANES / 4);
+
+    // the first ray steers the traversal order for the whole packet
+    const VEC3& leaderDirection = packet.rays[0].direction;
+
+    // at most one pending sibling per level of the tree
+    int stack[64 + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const BVHNode& node = nodes[nodeIndex];
+        int bits = vbits(packetHitsBox(packet, node.bounds));
+        if (bits == 0) {
+            continue;
+        }
+
+        // the packet has come apart, finish the stragglers one by one
+        if (__builtin_popcount(bits) <= divergentLanes) {
+            for (int i = 0; i < LANES; i++) {
+                if ((bits & (1 << i)) == 0) {
+                    continue;
+                }
+                IntersectResult result = bvh.intersectSubtree(
+                    nodeIndex, packet.rays[i], 0.0, packet.tMax[i]);
+                if (result.doesIntersect) {
+                    packet.tMax[i] = result.t;
+                    packet.hit[i] = result.intersectingShape;
+                }
+            }
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.count; i++) {
+                int index = node.leftOrFirst + i;
+                Shape* shape = bvh.leafShape(index);
+                const PacketPrimitive& primitive = primitives[index];
+                if (primitive.type == PACKET_SPHERE) {
+                    intersectSpheres(packet, primitive, shape);
+                } else if (primitive.type == PACKET_TRIANGLE) {
+                    intersectTriangles(packet, primitive, shape);
+                } else {
+                    intersectLanes(packet, bits, shape);
+                }
+            }
+            continue;
+        }
+
+        // order the children along the axis that separates them most
+        int left = node.leftOrFirst;
+        int right = left + 1;
+        VEC3 offset = nodes[right].bounds.centroid() -
+                      nodes[left].bounds.centroid();
+        int axis = 0;
+        for (int i = 1; i < 3; i++) {
+            if (fabs(offset[i]) > fabs(offset[axis])) {
+                axis = i;
+            }
+        }
+        if (offset[axis] * leaderDirection[axis] >= 0.0) {
+            stack[stackSize++] = right;
+            stack[stackSize++] = left;
+        } else {
+            stack[stackSize++] = left;
+            stack[stackSize++] = right;
+        }
+    }
+}
+
+static void tracePacket(SceneBVH& scene, const Ray* rays, int count,
+                        IntersectResult* results) {
+    float originX[LANES], originY[LANES], originZ[LANES];
+    float directionX[LANES], directionY[LANES], directionZ[LANES];
+    RayPacket packet;
+    for (int i = 0; i < LANES; i++) {
+        // pad the packet out by repeating the last ray
+        const Ray& ray = rays[std::min(i, count - 1)];
+        originX[i] = ray.origin[0];
+        originY[i] = ray.origin[1];
+        originZ[i] = ray.origin[2];
+        directionX[i] = ray.direction[0];
+        directionY[i] = ray.direction[1];
+        directionZ[i] = ray.direction[2];
+        packet.tMax[i] = (i < count) ? INFINITY : -1.0f;
+        packet.hit[i] = NULL;
+    }
+    packet.originX = vload(originX);
+    packet.originY = vload(originY);
+    packet.originZ = vload(originZ);
+    packet.directionX = vload(directionX);
+    packet.directionY = vload(directionY);
+    packet.directionZ = vload(directionZ);
+    packet.inverseX = vset(1.0f) / packet.directionX;
+    packet.inverseY = vset(1.0f) / packet.directionY;
+    packet.inverseZ = vset(1.0f) / packet.directionZ;
+    packet.rays = rays;
+    packet.count = count;
+
+    // bones only count if they're in front of the set, like SceneBVH
+    traceBVH(scene.staticBVH, packet);
+    traceBVH(scene.dynamicBVH, packet);
+
+    // redo the winning hit in double precision for the exact point and
+    // normal. if the slack in the float kernels picked a shape that the
+    // double test misses, trace that ray on its own
+    for (int i = 0; i < count; i++) {
+        if (packet.hit[i] == NULL) {
+            results[i] = IntersectResult();
+            continue;
+        }
+        results[i] = packet.hit[i]->intersect(rays[i]);
+        if (!results[i].doesIntersect || results[i].t < 0.0) {
+            results[i] = scene.intersect(rays[i], 0.0);
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#include "pcamotion.hpp"
+
+#include <cmath>
+
+#include "compressedmotion.hpp"
+
+using namespace std;
+
+MotionBasis::MotionBasis(const vector<Motion*>& takes, Real errorBudget)
+    : error(0.0) {
+    if (takes.empty()) {
+        return;
+    }
+
+    // every channel the first take has, bar the root's, with rotations in
+    // degrees and positions scaled up to match
+    Skeleton* skeleton = takes[0]->GetSkeleton();
+    int totalBones = skeleton->numBonesInSkel(*skeleton->getRoot());
+    vector<float> channelWeights;
+    for (int bone = 0; bone < totalBones; bone++) {
+        if (bone == Skeleton::getRootIndex()) {
+            continue;
+        }
+        for (int channel = 0; channel < NUMBER_POSTURE_CHANNELS; channel++) {
+            if (takes[0]->GetChannel(bone, (PostureChannel)channel) == NULL) {
+                continue;
+            }
+            Channel entry = {bone, channel};
+            channels.push_back(entry);
+            bool rotational = (channel == CHANNEL_RX || channel == CHANNEL_RY ||
+                               channel == CHANNEL_RZ);
+            channelWeights.push_back(
+                rotational ? 1.0
+                           : MOTION_ANGLE_TOLERANCE / MOTION_POSITION_TOLERANCE);
+        }
+    }
+    const int rows = channels.size();
+    weights = Map<VECTORF>(&channelWeights[0], rows);
+
+    // the weighted postures of every frame of every take, side by side
+    int totalFrames = 0;
+    for (unsigned int i = 0; i < takes.size(); i++) {
+        totalFrames += takes[i]->GetNumFrames();
+    }
+    MATRIX postures(rows, totalFrames);
+    int column = 0;
+    for (unsigned int i = 0; i < takes.size(); i++) {
+        const int frames = takes[i]->GetNumFrames();
+        for (int row = 0; row < rows; row++) {
+            const double* values = takes[i]->GetChannel(
+                channels[row].bone, (PostureChannel)channels[row].channel);
+            for (int frame = 0; frame < frames; frame++) {
+                postures(row, column + frame) =
+                    (values == NULL) ? 0.0 : values[frame] * weights[row];
+            }
+        }
+        column += frames;
+    }
+    VECTOR weightedMean = postures.rowwise().mean();
+    postures.colwise() -= weightedMean;
+
+    // the squared error of a frame after keeping k directions is its
+    // squared length less its squared projections on those k. keep adding
+    // directions, largest first, until the worst frame fits the budget
+    JacobiSVD<MATRIX> svd(postures, ComputeThinU);
+    MATRIX projections = svd.matrixU().transpose() * postures;
+    VECTOR remaining = postures.colwise().squaredNorm().transpose();
+    const Real allowed = errorBudget * errorBudget * rows;
+    int kept = 0;
+    while (kept < projections.rows() && totalFrames > 0 &&
+           remaining.maxCoeff() > allowed) {
+        remaining -=
+            projections.row(kept).transpose().cwiseAbs2();
+        kept++;
+    }
+    error = (totalFrames > 0)
+                ? sqrt(std::max<Real>(remaining.maxCoeff(), 0.0) / rows)
+                : 0.0;
+
+    directions = svd.matrixU().leftCols(kept).cast<float>();
+    components = weights.cwiseInverse().asDiagonal() * directions;
+    mean = (weightedMean.cast<float>().array() / weights.array()).matrix();
+}
+
+MATRIXF MotionBasis::encode(Motion& motion, int first, int count) const {
+    const int rows = channels.size();
+    MATRIXF postures(rows, count);
+    for (int row = 0; row < rows; row++) {
+        const double* values = motion.GetChannel(
+            channels[row].bone, (PostureChannel)channels[row].channel);
+        for (int frame = 0; frame < count; frame++) {
+            postures(row, frame) =
+                ((values == NULL) ? 0.0f : (float)values[first + frame]) -
+                mean[row];
+        }
+    }
+    return directions.transpose() * (weights.asDiagonal() * postures);
+}
+
+void MotionBasis::decode(const MATRIXF& coefficients, Motion& out,
+                         int outFrame) const {
+    MATRIXF postures = components * coefficients;
+    postures.colwise() += mean;
+    for (int frame = 0; frame < postures.cols(); frame++)
+        for (int row = 0; row < postures.rows(); row++) {
+            out.SetChannel(outFrame + frame, channels[row].bone,
+                           channels[row].channel, postures(row, frame));
+        }
+}
+
+size_t MotionBasis::bytes() const {
+    return (mean.size() + weights.size() + directions.size() +
+            components.size()) *
+               sizeof(float) +
+           channels.size() * sizeof(Channel);
+}
+
+PCAMotion::PCAMotion(const MotionBasis& basis, Motion& motion)
+    : basis(basis),
+      coefficients(basis.encode(motion, 0, motion.GetNumFrames())) {
+    const int frames = motion.GetNumFrames();
+    const int rootIndex = Skeleton::getRootIndex();
+    for (int channel = 0; channel < NUMBER_POSTURE_CHANNELS; channel++) {
+        if (motion.GetChannel(rootIndex, (PostureChannel)channel) != NULL) {
+            rootChannels.push_back(channel);
+        }
+    }
+    root.resize(rootChannels.size(), frames);
+    for (unsigned int row = 0; row < rootChannels.size(); row++) {
+        const double* values =
+            motion.GetChannel(rootIndex, (PostureChannel)rootChannels[row]);
+        for (int frame = 0; frame < frames; frame++) {
+            root(row, frame) = values[frame];
+        }
+    }
+}
+
+void PCAMotion::decodeRoot(int first, int count, Motion& out,
+                           int outFrame) const {
+    for (int frame = 0; frame < count; frame++)
+        for (unsigned int row = 0; row < rootChannels.size(); row++) {
+            out.SetChannel(outFrame + frame, Skeleton::getRootIndex(),
+                           rootChannels[row], root(row, first + frame));
+        }
+}
+
+void PCAMotion::sample(int frame, Motion& out, int outFrame) const {
+    basis.decode(coefficients.col(frame), out, outFrame);
+    decodeRoot(frame, 1, out, outFrame);
+}
+
+void PCAMotion::reconstruct(int first, int count, Motion& out,
+                            int outFrame) const {
+    basis.decode(coefficients.middleCols(first, count), out, outFrame);
+    decodeRoot(first, count, out, outFrame);
+}
+
+PostureView PCAMotion::getPosture(int frame, Motion& scratch,
+                                  int scratchFrame) const {
+    sample(frame, scratch, scratchFrame);
+    return scratch.GetPosture(scratchFrame);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+
+#include "SETTINGS.h"
+#include "motion.h"
+#include "skeleton.h"
+
+using namespace std;
+
+// default reconstruction error budget for a MotionBasis: the RMS error over
+// the channels of a frame, in the worst frame. rotations are in degrees,
+// and positions count at the same exchange rate as CompressedMotion's
+// tolerances (a millimetre weighs as much as a quarter of a degree). on
+// 88_02.amc this keeps every joint within about 5 mm; twice the budget
+// lets the worst one drift by over 2 cm
+const Real PCA_ERROR_BUDGET = 0.5;
+
+typedef Matrix<float, Dynamic, Dynamic> MATRIXF;
+typedef Matrix<float, Dynamic, 1> VECTORF;
+
+// principal components of the postures in a set of takes of the same
+// skeleton. a posture is the vector of the channels of every bone but the
+// root in a frame; the root's position and heading wander off wherever the
+// take goes, which no basis captures, so PCAMotion keeps them as they are.
+// the basis keeps the mean posture and the fewest directions that get
+// every frame of the takes back within the error budget. similar takes
+// share one basis, and each take only needs its coefficients
+class MotionBasis {
+   public:
+    MotionBasis(const vector<Motion*>& takes,
+                Real errorBudget = PCA_ERROR_BUDGET);
+
+    int totalChannels() const { return channels.size(); }
+    int totalComponents() const { return components.cols(); }
+
+    // the RMS error of the worst frame of the takes the basis was built from
+    Real rmsError() const { return error; }
+
+    // coefficients of frames [first, first + count) of a motion, one column
+    // per frame
+    MATRIXF encode(Motion& motion, int first, int count) const;
+
+    // postures from coefficients, one column per frame, into consecutive
+    // frames of a motion from outFrame on. all of them come out of a single
+    // matrix product
+    void decode(const MATRIXF& coefficients, Motion& out, int outFrame) const;
+
+    // bytes of the mean, the weights and the components
+    size_t bytes() const;
+
+   protected:
+    // which channel of which bone every row of a posture vector is
+    struct Channel {
+        int bone;
+        int channel;
+    };
+    vector<Channel> channels;
+
+    // posture = mean + components * coefficients. encoding goes through
+    // the weighted, orthonormal directions, decoding through the same with
+    // the weights divided back out
+    VECTORF mean;
+    VECTORF weights;
+    MATRIXF directions;
+    MATRIXF components;
+    Real error;
+};
+
+// a take stored as coefficients on a shared MotionBasis, a float per
+// component per frame, plus the root's channels as floats
+class PCAMotion {
+   public:
+    // the basis has to outlive this
+    PCAMotion(const MotionBasis& basis, Motion& motion);
+
+    int totalFrames() const { return coefficients.cols(); }
+
+    // one frame, into a frame of another motion of the same skeleton: one
+    // small matrix-vector product
+    void sample(int frame, Motion& out, int outFrame) const;
+
+    // frames [first, first + count) into consecutive frames of out, from
+    // outFrame on, as one matrix-matrix product
+    void reconstruct(int first, int count, Motion& out, int outFrame) const;
+
+    // the same as sample(), handed back as a view for Skeleton::setPosture()
+    PostureView getPosture(int frame, Motion& scratch,
+                           int scratchFrame = 0) const;
+
+    // bytes of the coefficients and the root; the basis is counted once per
+    // library
+    size_t bytes() const {
+        return (coefficients.size() + root.size()) * sizeof(float);
+    }
+
+   protected:
+    const MotionBasis& basis;
+    MATRIXF coefficients;
+
+    // the root's channels, one row each, and which channel every row is
+    vector<int> rootChannels;
+    MATRIXF root;
+
+    void decodeRoot(int first, int count, Motion& out, int outFrame) const;
+};
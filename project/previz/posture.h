@@ -9,25 +9,48 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 #include "bonevector.h"
 #include "types.h"
 
-//Root position and all bone rotation angles (including root) 
-struct Posture
+class Motion;
+
+// The values a bone can have in a frame, numbered like the dofo codes of
+// the ASF file (rx = 1, ..., tl = 7), but counting from 0
+enum PostureChannel
+{
+  CHANNEL_RX, CHANNEL_RY, CHANNEL_RZ,   // Euler angles, in degrees
+  CHANNEL_TX, CHANNEL_TY, CHANNEL_TZ,   // translation (rarely used, except by the root)
+  CHANNEL_TL,                           // length (rarely used)
+  NUMBER_POSTURE_CHANNELS
+};
+
+//Root position and all bone rotation angles (including root) at one frame
+//of a Motion. The values are read in place from the motion, so a view is
+//cheap to make and pass around, but only good as long as the motion is.
+class PostureView
 {
 public:
-  //Root position (x, y, z)		
-  bonevector root_pos;								
-
-  //Euler angles (thetax, thetay, thetaz) of all bones in their local coordinate system.
-  //If a particular bone does not have a certain degree of freedom, 
-  //the corresponding rotation is set to 0.
-  //The order of the bones in the array corresponds to their ids in .ASf file: root, lhipjoint, lfemur, ...
-  bonevector bone_rotation[MAX_BONES_IN_ASF_FILE];
-  
+  PostureView(const Motion * pMotion, int frameIndex);
+
+  //Value of one channel of a bone. If the bone does not have that degree of
+  //freedom, the value is 0.
+  double GetChannel(int boneIndex, PostureChannel channel) const;
+
+  //Root position (x, y, z)
+  bonevector GetRootPos() const;
+
+  //Euler angles (thetax, thetay, thetaz) of a bone in its local coordinate system.
+  //The bones are numbered by their ids in the .ASF file: root, lhipjoint, lfemur, ...
+  bonevector GetBoneRotation(int boneIndex) const;
+
   // bones that are translated relative to parents (resulting in gaps) (rarely used)
-  bonevector bone_translation[MAX_BONES_IN_ASF_FILE];
+  bonevector GetBoneTranslation(int boneIndex) const;
 
   // bones that change length during the motion (rarely used)
-  bonevector bone_length[MAX_BONES_IN_ASF_FILE];
+  double GetBoneLength(int boneIndex) const;
+
+  int GetFrameIndex() const { return frameIndex; }
+
+protected:
+  const Motion * pMotion;
+  int frameIndex;
 };
 
 #endif
-
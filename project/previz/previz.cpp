@@ -1,25 +1,47 @@
 #include <float.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <mutex>
 
 #include "SETTINGS.h"
+#include "bvh.hpp"
+#include "compiledscene.hpp"
+#include "compressedmotion.hpp"
+#include "crowd.hpp"
 #include "displaySkeleton.h"
+#include "framesink.hpp"
+#include "image.hpp"
 #include "motion.h"
+#include "motionstream.hpp"
+#include "packet.hpp"
 #include "shapes.hpp"
 #include "skeleton.h"
 #include "textures.hpp"
+#include "threadpool.hpp"
 #include "tracer.hpp"
 #include "utilities.hpp"
 
 using namespace std;
 
-// Stick-man classes
-DisplaySkeleton displayer;
-Skeleton* skeleton;
+// Stick-man classes. the motion is only read, so every frame in flight
+// shares it. with --stream it's decoded as the frames go instead
 Motion* motion;
+MotionStream* motionStream = NULL;
+
+// with --compress the frames come from a compressed copy of the motion,
+// which can be sampled between the captured frames too
+CompressedMotion* compressedMotion = NULL;
+
+// the capture runs at 120 frames a second, and the animation at 15 unless
+// --fps says otherwise
+const Real MOCAP_FRAME_RATE = 120.0;
+const Real DEFAULT_FRAME_RATE = 15.0;
+Real frameRate = DEFAULT_FRAME_RATE;
 
 int windowWidth = 640;
 int windowHeight = 480;
@@ -30,10 +52,53 @@ VEC3 up(0, 1, 0);
 Real distanceToNearPlane = 1.0;
 Real fovy = 65;
 
-// scene geometry
+// the static set dressing, built once and shared by every frame, and the
+// textures it uses. destroyScene() frees both
 vector<Shape*> scene;
+vector<Texture*> textures;
+
+// trace against a flat structure-of-arrays copy of the shapes instead of
+// the BVH, in double or single precision
+bool useCompiledScene = false;
+bool useSinglePrecision = false;
+
+// everything that changes from one frame to the next. a frame in flight
+// owns one of these, so several frames can be posed and traced at once
+// without stepping on each other
+class FrameState {
+   public:
+    DisplaySkeleton displayer;
+    Skeleton* skeleton;
+
+    // the bone cylinders, updated in place every frame
+    vector<Shape*> bones;
+
+    // the static shapes plus this frame's bones, and the compiled copies
+    // of the same, with whichever of these the tracer should use
+    SceneBVH sceneBVH;
+    CompiledScene compiledScene;
+    CompiledSceneFloat compiledSceneFloat;
+    Accelerator* accelerator;
+
+    // one frame for the compressed motion to be sampled into
+    unique_ptr<Motion> sampled;
+
+    // with --crowd, the other characters, posed at the same frame
+    unique_ptr<Crowd> crowd;
+
+    FrameState(const string& skeletonFilename);
+    ~FrameState();
+};
+
+// serializes the progress messages of frames rendered at the same time
+mutex outputLock;
 
 void destroyScene();
+bool updateBones(FrameState& state);
+void updateDynamicScene(FrameState& state);
+template <class Compiled>
+void updateCompiledScene(Compiled& compiled,
+                         const vector<Shape*>& dynamicShapes);
 void buildFloor();
 void buildPlatform();
 void buildEdifice();
@@ -42,10 +107,159 @@ VEC3 RED = VEC3(1, 0, 0);
 VEC3 GREEN = VEC3(0, 1, 0);
 VEC3 BLUE = VEC3(0, 0, 1);
 
-void renderImage(int& xRes, int& yRes, const string& filename, Camera cam,
-                 vector<Light*> lights) {
-    //  allocate the image
-    float* ppmOut = allocatePPM(cam.xRes, cam.yRes);
+// tiles are small enough that a tile's worth of pixels stays in cache, and
+// they line up with the blocks of the tile-major framebuffer
+const int TILE_SIZE = IMAGE_TILE_SIZE;
+
+// how the framebuffer stores a pixel. 8 bits a channel, quantized as each
+// pixel is traced, so writing a frame out is only a copy; a float
+// framebuffer rounds to the very same bytes, later and more slowly.
+// "--half" keeps half floats instead
+Image::Format framebufferFormat = Image::UINT8;
+
+// trace primary rays in SIMD packets of this many rays, 0 for one at a time
+int packetWidth = 0;
+
+// where the finished frames go: PPM files in ./frames unless --movie, --y4m
+// or --rgb say otherwise
+FrameSink* frameSink = NULL;
+
+// render each frame in passes on ever finer grids, writing it out after
+// each one. the first pass traces one pixel in 16 and each pass after that
+// fills in the rest of the grid half its step, so no pixel is traced twice
+bool progressive = false;
+const int PROGRESSIVE_STEPS[] = {4, 2, 1};
+const int TOTAL_PROGRESSIVE_PASSES = 3;
+
+// interleave the bits of x and y, so that sorting tiles by the result
+// walks them along a Z-order curve and neighbouring tiles stay close
+unsigned int mortonCode(unsigned int x, unsigned int y) {
+    unsigned int code = 0;
+    for (int bit = 0; bit < 16; bit++) {
+        code |= ((x >> bit) & 1) << (2 * bit);
+        code |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return code;
+}
+
+// cut the frame into tiles, listed in Morton order. each tile is stored as
+// its top left pixel
+void buildTiles(int xRes, int yRes, vector<pair<int, int> >& tiles) {
+    vector<pair<unsigned int, pair<int, int> > > sorted;
+    for (int y = 0; y < yRes; y += TILE_SIZE)
+        for (int x = 0; x < xRes; x += TILE_SIZE) {
+            unsigned int code = mortonCode(x / TILE_SIZE, y / TILE_SIZE);
+            sorted.push_back(make_pair(code, make_pair(x, y)));
+        }
+    sort(sorted.begin(), sorted.end());
+
+    tiles.clear();
+    for (unsigned int i = 0; i < sorted.size(); i++) {
+        tiles.push_back(sorted[i].second);
+    }
+}
+
+// is (x, y) traced by the pass on a grid step pixels apart? coarserStep is
+// the step of the pass before it, whose pixels are already done, or 0 if
+// this is the first pass
+bool inPass(int x, int y, int step, int coarserStep) {
+    if (x % step != 0 || y % step != 0) {
+        return false;
+    }
+    return coarserStep == 0 || x % coarserStep != 0 || y % coarserStep != 0;
+}
+
+// a pixel traced in a pass with the given step stands in for the whole
+// step x step square it's the corner of, until a finer pass gets there
+void fillPixels(int x, int y, int step, Camera& cam, VEC3 color,
+                Image& image) {
+    int xEnd = std::min(x + step, cam.xRes);
+    int yEnd = std::min(y + step, cam.yRes);
+    for (int fillY = y; fillY < yEnd; fillY++)
+        for (int fillX = x; fillX < xEnd; fillX++) {
+            image.setPixel(fillX, fillY, color);
+        }
+}
+
+// same as renderTile, but the primary rays go out in packets covering
+// small square-ish blocks of the pass's pixels, so the rays in a packet
+// stay coherent
+void renderTilePackets(int tileX, int tileY, Camera& cam,
+                       SceneBVH& sceneBVH, const RenderContext& context,
+                       int step, int coarserStep, Image& image) {
+    int blockWidth = ((packetWidth == 4) ? 2 : 4) * step;
+    int blockHeight = packetWidth * step * step / blockWidth;
+    int xEnd = std::min(tileX + TILE_SIZE, cam.xRes);
+    int yEnd = std::min(tileY + TILE_SIZE, cam.yRes);
+
+    // the pass's pixels in the tile, block by block
+    vector<pair<int, int> > pixels;
+    for (int blockY = tileY; blockY < yEnd; blockY += blockHeight)
+        for (int blockX = tileX; blockX < xEnd; blockX += blockWidth)
+            for (int y = blockY; y < std::min(blockY + blockHeight, yEnd);
+                 y += step)
+                for (int x = blockX; x < std::min(blockX + blockWidth, xEnd);
+                     x += step) {
+                    if (inPass(x, y, step, coarserStep)) {
+                        pixels.push_back(make_pair(x, y));
+                    }
+                }
+
+    vector<Ray> rays;
+    IntersectResult hits[16];
+    for (unsigned int start = 0; start < pixels.size(); start += packetWidth) {
+        int count = std::min((int)(pixels.size() - start), packetWidth);
+        rays.clear();
+        for (int i = 0; i < count; i++) {
+            rays.push_back(rayGenerationAlt(pixels[start + i].first,
+                                            pixels[start + i].second, cam));
+        }
+
+        intersectPacket(sceneBVH, &rays[0], count, packetWidth, hits);
+
+        // everything after the primary hit is traced as before
+        for (int i = 0; i < count; i++) {
+            VEC3 color = shadeIntersection<PREVIZ_RENDER_SETTINGS>(
+                context, hits[i], rays[i]);
+            fillPixels(pixels[start + i].first, pixels[start + i].second,
+                       step, cam, color, image);
+        }
+    }
+}
+
+// trace the pixels of one pass (see inPass) that fall in a tile. a full
+// frame in one go is the pass with step 1 and no coarser pass
+void renderTile(int tileX, int tileY, Camera& cam, SceneBVH& sceneBVH,
+                const RenderContext& context, int step, int coarserStep,
+                Image& image) {
+    if (packetWidth > 0) {
+        renderTilePackets(tileX, tileY, cam, sceneBVH, context, step,
+                          coarserStep, image);
+        return;
+    }
+    int xEnd = std::min(tileX + TILE_SIZE, cam.xRes);
+    int yEnd = std::min(tileY + TILE_SIZE, cam.yRes);
+    for (int y = tileY; y < yEnd; y += step)
+        for (int x = tileX; x < xEnd; x += step) {
+            if (!inPass(x, y, step, coarserStep)) {
+                continue;
+            }
+            // generate the ray, making x-axis go left to right
+            Ray ray = rayGenerationAlt(x, y, cam);
+
+            // get the color
+            VEC3 color = rayColor<PREVIZ_RENDER_SETTINGS>(context, ray);
+
+            // set, in final image
+            fillPixels(x, y, step, cam, color, image);
+        }
+}
+
+void renderImage(int frame, Camera cam, vector<Light*> lights,
+                 FrameState& state, Real frameCount, ThreadPool& pool) {
+    // allocate the image, tile by tile so that the threads filling
+    // neighbouring tiles don't share cache lines
+    Image image(cam.xRes, cam.yRes, framebufferFormat, Image::TILES);
 
     // TODO: this seems to be ray generation stuff using camera
     // compute image plane
@@ -55,53 +269,93 @@ void renderImage(int& xRes, int& yRes, const string& filename, Camera cam,
     // up.cross(cameraZ).normalized(); const VEC3 cameraY =
     // cameraZ.cross(cameraX).normalized();
 
-    for (int x = 0; x < xRes; x++)
-        for (int y = 0; y < yRes; y++) {
-            // generate the ray, making x-axis go left to right
-            Ray ray = rayGenerationAlt(x, y, cam);
-
-            // get the color
-            VEC3 color = rayColor(scene, ray, lights, 10.0, true, true, false,
-                                  true, true, 0, true, true, false);
+    // hand the tiles out to the pool. tiles that hit the glass and mirror
+    // take far longer than background, so the workers steal from each
+    // other instead of getting a fixed share
+    vector<pair<int, int> > tiles;
+    buildTiles(cam.xRes, cam.yRes, tiles);
+    OccluderCache occluders(pool.size(), lights.size());
+    RenderContext context(*state.accelerator, lights, 10.0, frameCount,
+                          &occluders);
+    if (!progressive) {
+        pool.parallelFor(tiles.size(), [&](int i) {
+            renderTile(tiles[i].first, tiles[i].second, cam, state.sceneBVH,
+                       context, 1, 0, image);
+        });
+        frameSink->addFrame(frame, image);
+        return;
+    }
 
-            // set, in final image
-            int index = indexIntoPPM(x, y, cam.xRes, cam.yRes, false);
-            ppmOut[index] = color[0] * 255.0;
-            ppmOut[index + 1] = color[1] * 255.0;
-            ppmOut[index + 2] = color[2] * 255.0;
+    // a rough frame after the first pass, then better and better ones
+    int coarserStep = 0;
+    for (int pass = 0; pass < TOTAL_PROGRESSIVE_PASSES; pass++) {
+        int step = PROGRESSIVE_STEPS[pass];
+        pool.parallelFor(tiles.size(), [&](int i) {
+            renderTile(tiles[i].first, tiles[i].second, cam, state.sceneBVH,
+                       context, step, coarserStep, image);
+        });
+        if (pass + 1 < TOTAL_PROGRESSIVE_PASSES) {
+            frameSink->previewFrame(frame, image);
+        } else {
+            frameSink->addFrame(frame, image);
         }
-    writePPM(filename, xRes, yRes, ppmOut);
-
-    delete[] ppmOut;
+        lock_guard<mutex> guard(outputLock);
+        cout << " pass " << pass + 1 << " of " << TOTAL_PROGRESSIVE_PASSES
+             << " of frame " << frame << " written" << endl;
+        coarserStep = step;
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////////
 // Load up a new motion captured frame
 //////////////////////////////////////////////////////////////////////////////////
-void setSkeletonsToSpecifiedFrame(int frameIndex) {
-    if (frameIndex < 0) {
+void setSkeletonsToSpecifiedFrame(FrameState& state, Real frameTime) {
+    if (frameTime < 0) {
         printf(
-            "Error in SetSkeletonsToSpecifiedFrame: frameIndex %d is "
+            "Error in SetSkeletonsToSpecifiedFrame: frame time %g is "
             "illegal.\n",
-            frameIndex);
+            frameTime);
         exit(0);
     }
-    if (displayer.GetSkeletonMotion(0) != NULL) {
+
+    // only the compressed motion can be posed between frames, the others
+    // take the nearest one
+    if (compressedMotion != NULL) {
+        if (frameTime > compressedMotion->totalFrames() - 1) {
+            lock_guard<mutex> guard(outputLock);
+            cout << " We hit the last frame! You might want to pick a "
+                    "different sequence. "
+                 << endl;
+        }
+        state.skeleton->setPosture(
+            compressedMotion->getPosture(frameTime, *state.sampled));
+        return;
+    }
+    int frameIndex = (int)floor(frameTime + 0.5);
+    if (motionStream != NULL) {
+        if (motionStream->setPosture(state.skeleton, frameIndex) !=
+            frameIndex) {
+            lock_guard<mutex> guard(outputLock);
+            cout << " We hit the last frame! You might want to pick a "
+                    "different sequence. "
+                 << endl;
+        }
+    } else if (motion != NULL) {
         int postureID;
-        if (frameIndex >= displayer.GetSkeletonMotion(0)->GetNumFrames()) {
+        if (frameIndex >= motion->GetNumFrames()) {
+            lock_guard<mutex> guard(outputLock);
             cout << " We hit the last frame! You might want to pick a "
                     "different sequence. "
                  << endl;
-            postureID = displayer.GetSkeletonMotion(0)->GetNumFrames() - 1;
+            postureID = motion->GetNumFrames() - 1;
         } else
             postureID = frameIndex;
-        displayer.GetSkeleton(0)->setPosture(
-            *(displayer.GetSkeletonMotion(0)->GetPosture(postureID)));
+        state.skeleton->setPosture(motion->GetPosture(postureID));
     }
 }
 
 //////////////////////////////////////////////////////////////////////////////////
-// Build a list of spheres in the scene
+// Build the static part of the scene
 //////////////////////////////////////////////////////////////////////////////////
 void buildScene() {
     // sphereCenters.clear();
@@ -111,7 +365,39 @@ void buildScene() {
     buildFloor();
     buildPlatform();
     buildEdifice();
+}
+
+FrameState::FrameState(const string& skeletonFilename) {
+    // the skeleton holds pointers into itself, so every frame state parses
+    // its own rather than copying one
+    skeleton = new Skeleton(skeletonFilename.c_str(), MOCAP_SCALE);
+    skeleton->setBasePosture();
+    displayer.LoadSkeleton(skeleton);
+    sampled.reset(new Motion(1, skeleton));
+
+    sceneBVH.buildStatic(scene);
+    accelerator = &sceneBVH;
+    if (useSinglePrecision) {
+        accelerator = &compiledSceneFloat;
+    } else if (useCompiledScene) {
+        accelerator = &compiledScene;
+    }
+}
 
+// the displayer deletes the skeleton
+FrameState::~FrameState() {
+    for (unsigned int i = 0; i < bones.size(); i++) {
+        delete bones[i];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Move the bone cylinders to the current skeleton pose, creating them the
+// first time through. returns false if none of them moved
+//////////////////////////////////////////////////////////////////////////////////
+bool updateBones(FrameState& state) {
+    DisplaySkeleton& displayer = state.displayer;
+    vector<Shape*>& bones = state.bones;
     displayer.ComputeBonePositions(DisplaySkeleton::BONES_AND_LOCAL_FRAMES);
 
     // retrieve all the bones of the skeleton
@@ -120,9 +406,9 @@ void buildScene() {
     vector<VEC4>& translations = displayer.translations();
     vector<float>& lengths = displayer.lengths();
 
-    // build a sphere list, but skip the first bone,
-    // it's just the origin
+    // skip the first bone, it's just the origin
     int totalBones = rotations.size();
+    int moved = 0;
     for (int x = 1; x < totalBones; x++) {
         MATRIX4& rotation = rotations[x];
         MATRIX4& scaling = scalings[x];
@@ -135,51 +421,85 @@ void buildScene() {
         leftVertex = rotation * scaling * leftVertex + translation;
         rightVertex = rotation * scaling * rightVertex + translation;
 
-        // get the direction vector
-        VEC3 direction = (rightVertex - leftVertex).head<3>();
-        const float magnitude = direction.norm();
-        direction *= 1.0 / magnitude;
-
-        // construct a cylinder
+        // construct a cylinder, or move the one from the last frame if
+        // this bone went anywhere since
         MATRIX4 rotationCopy = rotations[x];
         MATRIX4 scalingCopy = scalings[x];
         VEC4 translationCopy = translations[x];
         Real lengthCopy = lengths[x];
-        Cylinder* cylinder = new Cylinder(
-            leftVertex.head<3>(), rightVertex.head<3>(), 0.25, translationCopy,
-            rotationCopy, scalingCopy, lengthCopy, RED, OPAQUE, 0.0, NULL);
-
-        scene.push_back(cylinder);
-
-        // how many spheres?
-        const float sphereRadius = 0.05;
-        const int totalSpheres = magnitude / (2.0 * sphereRadius);
-        const float rayIncrement = magnitude / (float)totalSpheres;
-
-        // store the spheres
-        Sphere* sphereLeft = new Sphere(0.05, leftVertex.head<3>(),
-                                        VEC3(1, 0, 0), OPAQUE, 0.0, NULL);
-        // scene.push_back(sphereLeft);
-
-        Sphere* sphereRight = new Sphere(0.05, rightVertex.head<3>(),
-                                         VEC3(1, 0, 0), OPAQUE, 0.0, NULL);
-        // scene.push_back(sphereRight);
-
-        for (int y = 0; y < totalSpheres; y++) {
-            VEC3 center = ((float)y + 0.5) * rayIncrement * direction +
-                          leftVertex.head<3>();
-            Sphere* sphereCenter =
-                new Sphere(0.05, center, VEC3(1, 0, 0), OPAQUE, 0.0, NULL);
-            // scene.push_back(sphereCenter);
+        if (x - 1 < (int)bones.size()) {
+            Cylinder* cylinder = (Cylinder*)bones[x - 1];
+            if (cylinder->translation == translationCopy &&
+                cylinder->rotation == rotationCopy &&
+                cylinder->scaling == scalingCopy &&
+                cylinder->length == lengthCopy) {
+                continue;
+            }
+            cylinder->setTransform(leftVertex.head<3>(), rightVertex.head<3>(),
+                                   translationCopy, rotationCopy, scalingCopy,
+                                   lengthCopy);
+            moved++;
+        } else {
+            Cylinder* cylinder = new Cylinder(
+                leftVertex.head<3>(), rightVertex.head<3>(), 0.25,
+                translationCopy, rotationCopy, scalingCopy, lengthCopy, RED,
+                OPAQUE, 0.0, NULL);
+            bones.push_back(cylinder);
+            moved++;
         }
     }
+
+    return moved > 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Bring everything built over the bones and the crowd up to date after they
+// moved
+//////////////////////////////////////////////////////////////////////////////////
+void updateDynamicScene(FrameState& state) {
+    vector<Shape*> dynamicShapes = state.bones;
+    if (state.crowd) {
+        dynamicShapes.push_back(state.crowd->shape());
+    }
+
+    // only the bones moved, so refit their BVH rather than rebuilding
+    SceneBVH& sceneBVH = state.sceneBVH;
+    if (sceneBVH.dynamicBVH.totalShapes() != (int)dynamicShapes.size()) {
+        sceneBVH.buildDynamic(dynamicShapes);
+    } else {
+        sceneBVH.refitDynamic();
+    }
+
+    if (useCompiledScene && useSinglePrecision) {
+        updateCompiledScene(state.compiledSceneFloat, dynamicShapes);
+    } else if (useCompiledScene) {
+        updateCompiledScene(state.compiledScene, dynamicShapes);
+    }
+}
+
+// the compiled scene has its own copy of the geometry to bring up to date
+template <class Compiled>
+void updateCompiledScene(Compiled& compiled,
+                         const vector<Shape*>& dynamicShapes) {
+    if (compiled.totalShapes() != (int)(scene.size() + dynamicShapes.size())) {
+        vector<Shape*> everything = scene;
+        everything.insert(everything.end(), dynamicShapes.begin(),
+                          dynamicShapes.end());
+        compiled.build(everything);
+    } else {
+        compiled.update();
+    }
 }
 
 void destroyScene() {
-    for (int i = 0; i < scene.size(); i++) {
+    for (unsigned int i = 0; i < scene.size(); i++) {
         delete scene[i];
     }
     scene.clear();
+    for (unsigned int i = 0; i < textures.size(); i++) {
+        delete textures[i];
+    }
+    textures.clear();
 }
 
 void buildFloor() {
@@ -237,26 +557,220 @@ void buildPlatform() {
 void buildEdifice() {
     VEC3 center = VEC3(0, 0, -0.7);
     Texture* perlinTexture = new TexturePerlin(10.0);
+    textures.push_back(perlinTexture);
     Sphere* a = new Sphere(0.5, center, VEC3(0.0, 0.0, 0.0), OPAQUE, 1.0,
                            perlinTexture);
     scene.push_back(a);
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Pose, trace and write out one frame of the animation
+//////////////////////////////////////////////////////////////////////////////////
+void renderFrame(FrameState& state, int frame, vector<Light*>& lights,
+                 ThreadPool& pool) {
+    // update the skeleton motion. at the default 15 frames a second that's
+    // 8 mocap frames at a time, otherwise the animation is really slow
+    Real frameTime = frame * MOCAP_FRAME_RATE / frameRate;
+    setSkeletonsToSpecifiedFrame(state, frameTime);
+    // move the bones and the crowd to match. a held pose (e.g. past the end
+    // of the motion) leaves everything that depends on them as it was
+    bool moved = updateBones(state);
+    if (state.crowd) {
+        moved = state.crowd->setFrame((int)floor(frameTime + 0.5)) || moved;
+    }
+    if (moved) {
+        updateDynamicScene(state);
+    }
+    // make the camera position follow the skeleton's pelvis
+    vector<VEC4>& translations = state.displayer.translations();
+    VEC4 pelvisTranslation = translations[1];
+    VEC3 cameraPos = truncate(pelvisTranslation);
+    Camera cam = Camera(eye, cameraPos, up, windowWidth, windowHeight,
+                        distanceToNearPlane, fovy);
+    // render the frame and hand it to the sink, with the textures animated
+    // by frame number (at the default frame rate, so they move at the same
+    // speed at any)
+    renderImage(frame, cam, lights, state,
+                frame * DEFAULT_FRAME_RATE / frameRate, pool);
+    lock_guard<mutex> guard(outputLock);
+    cout << "Rendered frame " + to_string(frame) << endl;
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv) {
     string skeletonFilename("88.asf");
     string motionFilename("88_02.amc");
 
-    // load up skeleton stuff
-    skeleton = new Skeleton(skeletonFilename.c_str(), MOCAP_SCALE);
-    skeleton->setBasePosture();
-    displayer.LoadSkeleton(skeleton);
+    // "--threads N" picks the number of render threads, the default is
+    // one per core. "--packets N" traces primary rays in SIMD packets of
+    // 4, 8 or 16, or "--packets auto" for the widest this CPU supports.
+    // "--compiled" traces against the flat CompiledScene instead of the BVH,
+    // and "--float" does the same with the compiled scene in single precision.
+    // "--progressive" writes each frame after every refinement pass.
+    // "--frames N" renders N frames at a time, the default is one per
+    // thread, up to 4. "--stream" decodes the motion while rendering
+    // instead of loading all of it first. "--compress" plays the motion
+    // from a compressed copy, and "--fps N" renders N frames per second of
+    // motion instead of 15. "--crowd N" adds N more characters playing the
+    // same motion from other places and other points in the clip.
+    // "--movie FILE" writes a QuickTime movie instead of PPM files, and
+    // "--y4m" or "--rgb" write the frames to stdout as YUV4MPEG2 or bare
+    // RGB, to pipe into an encoder. "--half" keeps the framebuffer in half
+    // floats
+    int totalThreads = 0;
+    int framesInFlight = 0;
+    bool streamMotion = false;
+    bool compressMotion = false;
+    int crowdSize = 0;
+    string movieFilename;
+    bool y4mStream = false;
+    bool rgbStream = false;
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--threads" && i + 1 < argc) {
+            totalThreads = atoi(argv[++i]);
+        } else if (arg == "--packets" && i + 1 < argc) {
+            string width(argv[++i]);
+            packetWidth =
+                (width == "auto") ? widestPacketWidth() : atoi(width.c_str());
+        } else if (arg == "--compiled") {
+            useCompiledScene = true;
+        } else if (arg == "--float") {
+            useCompiledScene = true;
+            useSinglePrecision = true;
+        } else if (arg == "--progressive") {
+            progressive = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            framesInFlight = atoi(argv[++i]);
+        } else if (arg == "--stream") {
+            streamMotion = true;
+        } else if (arg == "--compress") {
+            compressMotion = true;
+        } else if (arg == "--fps" && i + 1 < argc) {
+            frameRate = atof(argv[++i]);
+        } else if (arg == "--crowd" && i + 1 < argc) {
+            crowdSize = atoi(argv[++i]);
+        } else if (arg == "--movie" && i + 1 < argc) {
+            movieFilename = argv[++i];
+        } else if (arg == "--y4m") {
+            y4mStream = true;
+        } else if (arg == "--rgb") {
+            rgbStream = true;
+        } else if (arg == "--half") {
+            framebufferFormat = Image::HALF;
+        }
+    }
 
-    // load up the motion
-    motion = new Motion(motionFilename.c_str(), MOCAP_SCALE, skeleton);
-    displayer.LoadMotion(motion);
-    skeleton->setPosture(*(displayer.GetSkeletonMotion(0)->GetPosture(0)));
+    if (frameRate <= 0.0) {
+        frameRate = DEFAULT_FRAME_RATE;
+    }
+
+    // pick the sink before printing anything: a stream on stdout sends
+    // everything else that gets printed to stderr from here on
+    if (y4mStream || rgbStream) {
+        frameSink = new StdoutSink(
+            y4mStream ? StdoutSink::Y4M : StdoutSink::RGB, frameRate);
+    } else if (!movieFilename.empty()) {
+        frameSink = new MovieSink(movieFilename, frameRate);
+    } else {
+        frameSink = new PPMSequenceSink("./frames/frame.%04i.ppm");
+    }
+    if (progressive && frameSink->usesStdout()) {
+        cout << " Only the last pass of each frame goes to stdout" << endl;
+    }
+    if (useCompiledScene && packetWidth != 0) {
+        cout << " Packets need the BVH, tracing the compiled scene one ray "
+                "at a time"
+             << endl;
+        packetWidth = 0;
+    }
+    if (streamMotion && compressMotion) {
+        cout << " A streamed motion can't be compressed, playing it as is"
+             << endl;
+        compressMotion = false;
+    }
+    if (streamMotion && crowdSize > 0) {
+        cout << " A crowd needs the whole motion, so it can't be streamed"
+             << endl;
+        crowdSize = 0;
+    }
+    if (packetWidth != 0 && !packetWidthSupported(packetWidth)) {
+        cout << " Packets of " << packetWidth
+             << " rays aren't supported here, using "
+             << widestPacketWidth() << endl;
+        packetWidth = widestPacketWidth();
+    }
+    ThreadPool pool(totalThreads);
+    if (framesInFlight <= 0) {
+        framesInFlight = std::min(pool.size(), 4);
+    }
+    cout << " Rendering " << framesInFlight << " frames at a time with "
+         << pool.size() << " threads";
+    if (packetWidth > 0) {
+        cout << ", " << packetWidth << "-ray packets";
+    }
+    if (useCompiledScene) {
+        cout << (useSinglePrecision ? ", compiled scene in float"
+                                    : ", compiled scene");
+    }
+    if (progressive) {
+        cout << ", progressive";
+    }
+    if (framebufferFormat == Image::HALF) {
+        cout << ", half float framebuffer";
+    }
+    if (streamMotion) {
+        cout << ", streaming the motion";
+    }
+    if (compressMotion) {
+        cout << ", compressed motion";
+    }
+    if (frameRate != DEFAULT_FRAME_RATE) {
+        cout << ", " << frameRate << " fps";
+    }
+    if (crowdSize > 0) {
+        cout << ", a crowd of " << crowdSize;
+    }
+    if (y4mStream || rgbStream) {
+        cout << (y4mStream ? ", Y4M" : ", RGB") << " on stdout";
+    } else if (!movieFilename.empty()) {
+        cout << ", into " << movieFilename;
+    }
+    cout << endl;
+
+    // the set dressing doesn't move, so only build it once
+    buildScene();
+
+    // load up skeleton stuff, one copy per frame in flight
+    vector<unique_ptr<FrameState> > states;
+    for (int i = 0; i < framesInFlight; i++) {
+        states.push_back(
+            unique_ptr<FrameState>(new FrameState(skeletonFilename)));
+    }
+
+    // load up the motion, or start streaming it
+    if (streamMotion) {
+        motionStream = new MotionStream(motionFilename.c_str(), MOCAP_SCALE,
+                                        states[0]->skeleton);
+        motion = NULL;
+    } else {
+        motion = new Motion(motionFilename.c_str(), MOCAP_SCALE,
+                            states[0]->skeleton);
+    }
+    if (compressMotion) {
+        compressedMotion = new CompressedMotion(*motion);
+        printf("%d samples compressed from %zu to %zu bytes.\n",
+               compressedMotion->totalFrames(),
+               compressedMotion->originalBytes(),
+               compressedMotion->compressedBytes());
+    }
+
+    // every frame in flight poses its own copy of the crowd
+    for (int i = 0; crowdSize > 0 && i < framesInFlight; i++) {
+        states[i]->crowd.reset(
+            new Crowd(states[i]->skeleton, motion, crowdSize, BLUE));
+    }
 
     // create lights
     Light one = Light(VEC3(10.0, 10.0, 5.0), VEC3(1.0, 1.0, 1.0));
@@ -267,27 +781,34 @@ int main(int argc, char** argv) {
     lights.push_back(&two);
     lights.push_back(&three);
 
-    // Note we're going 8 frames at a time, otherwise the animation
-    // is really slow.
-    for (int x = 0; x < 2400; x += 8) {
-        // update the skeleton motion
-        setSkeletonsToSpecifiedFrame(x);
-        // empty the scene
-        destroyScene();
-        // rebuild it
-        buildScene();
-        // make the camera position follow the skeleton's pelvis
-        vector<VEC4>& translations = displayer.translations();
-        VEC4 pelvisTranslation = translations[1];
-        VEC3 cameraPos = truncate(pelvisTranslation);
-        Camera cam = Camera(eye, cameraPos, up, windowWidth, windowHeight,
-                            distanceToNearPlane, fovy);
-        // write the frame to image
-        char buffer[256];
-        sprintf(buffer, "./frames/frame.%04i.ppm", x / 8);
-        renderImage(windowWidth, windowHeight, buffer, cam, lights);
-        cout << "Rendered " + to_string(x / 8) + " frames" << endl;
+    // every frame state takes the next frame nobody has started yet, and
+    // goes back for another once it's done. the tiles of all the frames in
+    // flight share the pool, so a frame that's mostly background doesn't
+    // leave threads idle while another one is still in the mirrors
+    const int totalFrames = (int)(2400 / MOCAP_FRAME_RATE * frameRate);
+    atomic<int> nextFrame(0);
+    TaskGroup frames;
+    function<void(FrameState*)> renderFrames = [&](FrameState* state) {
+        int frame = nextFrame++;
+        if (frame >= totalFrames) {
+            return;
+        }
+        renderFrame(*state, frame, lights, pool);
+        pool.submit(frames, [&renderFrames, state]() { renderFrames(state); });
+    };
+    for (unsigned int i = 0; i < states.size(); i++) {
+        FrameState* state = states[i].get();
+        pool.submit(frames, [&renderFrames, state]() { renderFrames(state); });
     }
+    pool.wait(frames);
+    frameSink->finish();
+
+    states.clear();
+    delete frameSink;
+    delete compressedMotion;
+    delete motion;
+    delete motionStream;
+    destroyScene();
 
     return 0;
 }
@@ -5,14 +5,26 @@ using namespace std;
 Real REFRACT_GLASS = 1.5;
 Real REFRACT_AIR = 1.0;
 
-// SHAPE
+// MATERIAL
 
-Shape::Shape(VEC3 color, Material type, Real refractiveIndex, Texture* texture)
+MaterialInfo::MaterialInfo(VEC3 color, Material type, Real refractiveIndex,
+                           Texture* texture)
     : color(color),
       type(type),
       refractiveIndex(refractiveIndex),
       texture(texture) {}
 
+bool MaterialInfo::operator==(const MaterialInfo& other) const {
+    return color == other.color && type == other.type &&
+           refractiveIndex == other.refractiveIndex &&
+           texture == other.texture;
+}
+
+// SHAPE
+
+Shape::Shape(VEC3 color, Material type, Real refractiveIndex, Texture* texture)
+    : material(color, type, refractiveIndex, texture) {}
+
 // SPHERE
 
 Sphere::Sphere(Real radius, VEC3 center, VEC3 color, Material type,
@@ -48,6 +60,11 @@ IntersectResult Sphere::intersect(Ray ray) {
     }
 }
 
+AABB Sphere::bounds() {
+    VEC3 r = VEC3(radius, radius, radius);
+    return AABB(center - r, center + r);
+}
+
 Sphere::~Sphere() {}
 
 // TRIANGLE
@@ -94,6 +111,16 @@ IntersectResult Triangle::intersect(Ray ray) {
     return IntersectResult(t, true, normal, intersectionPoint, this);
 }
 
+AABB Triangle::bounds() {
+    AABB box;
+    box.expand(a);
+    box.expand(b);
+    box.expand(c);
+    // pad so axis-aligned triangles don't get a zero-width box
+    VEC3 pad = VEC3(CUSTOM_EPSILON, CUSTOM_EPSILON, CUSTOM_EPSILON);
+    return AABB(box.min - pad, box.max + pad);
+}
+
 Triangle::~Triangle() {}
 
 // Cylinder
@@ -107,13 +134,29 @@ Cylinder::Cylinder(VEC3 top, VEC3 bottom, Real radius, VEC4 translation,
       translation(translation),
       rotation(rotation),
       scaling(scaling),
-      length(length) {}
+      length(length) {
+    updateTransforms();
+}
+
+void Cylinder::setTransform(VEC3 top_, VEC3 bottom_, VEC4 translation_,
+                            MATRIX4 rotation_, MATRIX4 scaling_,
+                            Real length_) {
+    top = top_;
+    bottom = bottom_;
+    translation = translation_;
+    rotation = rotation_;
+    scaling = scaling_;
+    length = length_;
+    updateTransforms();
+}
+
+void Cylinder::updateTransforms() {
+    localToWorld = scaling * rotation;
+    worldToLocal = scaling.inverse() * rotation.inverse();
+}
 
 IntersectResult Cylinder::intersect(Ray ray) {
-    // rotation MATRIX4
-    // r.transpose
-    // trnaspose and inverse are trhe same
-    MATRIX4 modelTransform = scaling.inverse() * rotation.inverse();
+    const MATRIX4& modelTransform = worldToLocal;
 
     //    length of sphere (displayer / length )
     // if z is greater than the lenght, then it is past the cylinder
@@ -159,11 +202,72 @@ IntersectResult Cylinder::intersect(Ray ray) {
     normal /= normal.norm();
 
     // convert back from local frame/object space to world space
-    intersectionPoint = truncate(
-        (scaling * rotation * extend(intersectionPoint)) + translation);
-    normal = truncate(scaling * rotation * extend(normal));
+    intersectionPoint =
+        truncate((localToWorld * extend(intersectionPoint)) + translation);
+    normal = truncate(localToWorld * extend(normal));
 
     return IntersectResult(closestT, true, normal, intersectionPoint, this);
 }
 
-Cylinder::~Cylinder() {}
\ No newline at end of file
+AABB Cylinder::bounds() {
+    // intersect() tests the canonical cylinder x^2 + y^2 <= r^2, 0 <= z <=
+    // length after applying (rotation * scaling)^-1, so bound the corners of
+    // the canonical box pushed through rotation * scaling
+    MATRIX3 toWorld = (rotation * scaling).block<3, 3>(0, 0);
+    VEC3 offset = translation.head<3>();
+    AABB box;
+    for (int i = 0; i < 8; i++) {
+        VEC3 corner = VEC3((i & 1) ? radius : -radius,
+                           (i & 2) ? radius : -radius, (i & 4) ? length : 0.0);
+        box.expand(toWorld * corner + offset);
+    }
+    return box;
+}
+
+Cylinder::~Cylinder() {}
+
+// INSTANCE
+
+Instance::Instance(Shape* base, const MATRIX4& objectToWorld)
+    : Shape(base->material.color, base->material.type,
+            base->material.refractiveIndex, base->material.texture),
+      base(base) {
+    id = base->id;
+    setTransform(objectToWorld);
+}
+
+void Instance::setTransform(const MATRIX4& objectToWorld) {
+    toWorld = objectToWorld.block<3, 3>(0, 0);
+    offset = objectToWorld.block<3, 1>(0, 3);
+    toObject = toWorld.inverse();
+    normalToWorld = toObject.transpose();
+    updateBounds();
+}
+
+void Instance::updateBounds() {
+    AABB baseBounds = base->bounds();
+    worldBounds = AABB();
+    for (int i = 0; i < 8; i++) {
+        VEC3 corner = VEC3((i & 1) ? baseBounds.max[0] : baseBounds.min[0],
+                           (i & 2) ? baseBounds.max[1] : baseBounds.min[1],
+                           (i & 4) ? baseBounds.max[2] : baseBounds.min[2]);
+        worldBounds.expand(toWorld * corner + offset);
+    }
+}
+
+IntersectResult Instance::intersect(Ray ray) {
+    Ray local(toObject * (ray.origin - offset), toObject * ray.direction);
+    IntersectResult result = base->intersect(local);
+    if (!result.doesIntersect) {
+        return result;
+    }
+
+    VEC3 intersectionPoint = toWorld * result.intersectionPoint + offset;
+    VEC3 normal = normalToWorld * result.normal;
+    normal /= normal.norm();
+    return IntersectResult(result.t, true, normal, intersectionPoint, this);
+}
+
+AABB Instance::bounds() { return worldBounds; }
+
+Instance::~Instance() {}
@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "SETTINGS.h"
+#include "aabb.hpp"
 #include "textures.hpp"
 #include "tracer.hpp"
 #include "utilities.hpp"
@@ -21,18 +22,36 @@ extern Real REFRACT_AIR;
 
 enum Material { OPAQUE, MIRROR, DIELECTRIC };
 
+// everything a hit needs for shading. every shape has one, and a compiled
+// scene shares one between all the primitives that look the same
+class MaterialInfo {
+   public:
+    VEC3 color;
+    Material type;
+    Real refractiveIndex;
+    Texture* texture;
+
+    MaterialInfo(VEC3 color, Material type, Real refractiveIndex,
+                 Texture* texture);
+
+    bool operator==(const MaterialInfo& other) const;
+};
+
 // forward declarations from tracer to prevent circular dependency
-class Ray;
-class IntersectResult;
+template <class Scalar>
+class RayT;
+template <class Scalar>
+class IntersectResultT;
+typedef RayT<Real> Ray;
+typedef IntersectResultT<Real> IntersectResult;
 
 class Shape {
    public:
     virtual IntersectResult intersect(Ray ray) = 0;
-    VEC3 color;
-    Material type;
-    Real refractiveIndex;
+    // world space bounding box, used to build the BVH
+    virtual AABB bounds() = 0;
+    MaterialInfo material;
     string id;
-    Texture* texture;
 
     // base constructor
     Shape(VEC3 color, Material type, Real refractiveIndex, Texture* texture);
@@ -51,6 +70,7 @@ class Sphere : public Shape {
            Real refractiveIndex, Texture* texture);
 
     IntersectResult intersect(Ray ray);
+    AABB bounds();
 
     ~Sphere();
 };
@@ -68,6 +88,7 @@ class Triangle : public Shape {
     // Attribution
     // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
     IntersectResult intersect(Ray ray);
+    AABB bounds();
 
     ~Triangle();
 };
@@ -88,7 +109,62 @@ class Cylinder : public Shape {
              MATRIX4 rotation, MATRIX4 scaling, Real length, VEC3 color,
              Material type, Real refractiveIndex, Texture* texture);
 
+    // worldToLocal is (rotation * scaling)^-1, and localToWorld takes the
+    // hit point and normal back out. localToWorld is scaling * rotation,
+    // not the inverse of worldToLocal: that's what intersect() always used,
+    // and keeping it leaves the rendered bones unchanged. both are kept up
+    // to date by the constructor and setTransform() so intersect() doesn't
+    // invert anything per ray
+    MATRIX4 localToWorld;
+    MATRIX4 worldToLocal;
+
+    // move an existing bone, e.g. to the next frame's pose
+    void setTransform(VEC3 top, VEC3 bottom, VEC4 translation,
+                      MATRIX4 rotation, MATRIX4 scaling, Real length);
+
     IntersectResult intersect(Ray ray);
+    AABB bounds();
 
     ~Cylinder();
+
+   protected:
+    void updateTransforms();
+};
+
+// a base shape placed in the world by an affine transform. any number of
+// instances can share one base, so repeated props only store their
+// transform. the base is traced in its own object space and isn't owned by
+// the instance; the instance starts out with the base's material, which can
+// then be changed per instance
+class Instance : public Shape {
+   public:
+    Shape* base;
+
+    // object to world, and the inverses, split into the linear part and
+    // the translation. normalToWorld is the inverse transpose
+    MATRIX3 toWorld;
+    VEC3 offset;
+    MATRIX3 toObject;
+    MATRIX3 normalToWorld;
+
+    Instance(Shape* base, const MATRIX4& objectToWorld);
+
+    // move the instance, e.g. to the next frame's pose
+    void setTransform(const MATRIX4& objectToWorld);
+
+    // recompute the world bounds after the base shape itself has changed
+    void updateBounds();
+
+    // the ray direction is transformed but not renormalized, so t means
+    // the same in both spaces
+    IntersectResult intersect(Ray ray);
+
+    // the base bounds pushed through the transform, computed by
+    // setTransform() and updateBounds()
+    AABB bounds();
+
+    ~Instance();
+
+   protected:
+    AABB worldBounds;
 };
@@ -6,11 +6,11 @@ Revision 3 - Jernej Barbic and Yili Zhao, Feb, 2012
 
 */
 #include "SETTINGS.h"
-#include <fstream>
 #include <cstdio>
 #include <cstring>
 #include <cmath>
 #include "skeleton.h"
+#include "mappedfile.hpp"
 
 #ifdef WIN32
   #pragma warning(disable : 4996)
@@ -71,10 +71,28 @@ int Skeleton::numBonesInSkel(Bone bone)
     return numBones + 1;
 }
 
-void Skeleton::removeCR(char * str)
+// copy the next line of a mapped file into str, without its CR/LF. returns
+// false at the end of the file
+static bool readLine(const char * & cursor, const char * end, char * str, int size)
 {
-  if (str[strlen(str) - 1] == '\r')
-    str[strlen(str) - 1] = 0;    
+  str[0] = 0;
+  if (cursor >= end)
+    return false;
+
+  const char * lineEnd = (const char *)memchr(cursor, '\n', end - cursor);
+  if (lineEnd == NULL)
+    lineEnd = end;
+  const char * next = (lineEnd == end) ? end : lineEnd + 1;
+  if (lineEnd > cursor && lineEnd[-1] == '\r')
+    lineEnd--;
+
+  int length = (int)(lineEnd - cursor);
+  if (length > size - 1)
+    length = size - 1;
+  memcpy(str, cursor, length);
+  str[length] = 0;
+  cursor = next;
+  return true;
 }
 
 int Skeleton::movBonesInSkel(Bone bone)
@@ -99,27 +117,71 @@ int Skeleton::movBonesInSkel(Bone bone)
     return numBones;
 }
 
+// FNV-1a over the characters of a bone name
+static unsigned int hashBoneName(const char * name, int length)
+{
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+  return hash;
+}
+
+// index the bone names read so far, so that name2idx and idx2name don't
+// have to search the bone list
+void Skeleton::BuildNameTable()
+{
+  for (int slot = 0; slot < BONE_NAME_TABLE_SIZE; slot++)
+    m_NameTable[slot] = -1;
+  for (int idx = 0; idx < MAX_BONES_IN_ASF_FILE; idx++)
+    m_BonePosition[idx] = -1;
+
+  for (int i = 0; i < NUM_BONES_IN_ASF_FILE; i++)
+  {
+    const char * name = m_pBoneList[i].name;
+    unsigned int slot = hashBoneName(name, strlen(name)) & (BONE_NAME_TABLE_SIZE - 1);
+    while (m_NameTable[slot] >= 0)
+      slot = (slot + 1) & (BONE_NAME_TABLE_SIZE - 1);
+    m_NameTable[slot] = i;
+
+    int idx = m_pBoneList[i].idx;
+    if (idx >= 0 && idx < MAX_BONES_IN_ASF_FILE)
+      m_BonePosition[idx] = i;
+  }
+}
+
 // helper function to convert ASF part name into bone index
-int Skeleton::name2idx(char *name)
+int Skeleton::name2idx(const char *name)
 {
-  int i=0;
-  while(strcmp(m_pBoneList[i].name, name) != 0 && i++ < NUM_BONES_IN_ASF_FILE);
-  return m_pBoneList[i].idx;
+  return name2idx(name, strlen(name));
+}
+
+int Skeleton::name2idx(const char *name, int length)
+{
+  unsigned int slot = hashBoneName(name, length) & (BONE_NAME_TABLE_SIZE - 1);
+  while (m_NameTable[slot] >= 0)
+  {
+    const Bone & bone = m_pBoneList[m_NameTable[slot]];
+    if (strncmp(bone.name, name, length) == 0 && bone.name[length] == 0)
+      return bone.idx;
+    slot = (slot + 1) & (BONE_NAME_TABLE_SIZE - 1);
+  }
+  return -1;
 }
 
 char * Skeleton::idx2name(int idx)
 {
-  int i=0;
-  while(m_pBoneList[i].idx != idx && i++ < NUM_BONES_IN_ASF_FILE);
-  return m_pBoneList[i].name;
+  if (idx < 0 || idx >= MAX_BONES_IN_ASF_FILE || m_BonePosition[idx] < 0)
+    return NULL;
+  return m_pBoneList[m_BonePosition[idx]].name;
 }
 
 int Skeleton::readASFfile(const char* asf_filename, double scale)
 {
   //open file
-  std::ifstream is(asf_filename, std::ios::in);
-  if (is.fail()) 
+  MappedFile file(asf_filename);
+  if (!file.isOpen()) 
     return -1;
+  const char * cursor = file.begin();
 
   //
   // ignore header information
@@ -127,8 +189,8 @@ int Skeleton::readASFfile(const char* asf_filename, double scale)
   char str[2048], keyword[256];
   while (1)
   {
-    is.getline(str, 2048);	
-    removeCR(str);
+    if (!readLine(cursor, file.end(), str, 2048))
+      return -1;
     sscanf(str, "%s", keyword);
     if (strcmp(keyword, ":bonedata") == 0)	
       break;
@@ -137,8 +199,7 @@ int Skeleton::readASFfile(const char* asf_filename, double scale)
   //
   // read bone information: global orientation and translation, DOF.
   //
-  is.getline(str, 2048);
-  removeCR(str);
+  readLine(cursor, file.end(), str, 2048);
   char	part[256], *token;
   double length;
 
@@ -155,8 +216,8 @@ int Skeleton::readASFfile(const char* asf_filename, double scale)
     MOV_BONES_IN_ASF_FILE++;
     while(1)
     {
-      is.getline(str, 2048);	
-      removeCR(str);
+      if (!readLine(cursor, file.end(), str, 2048))
+        return -1;
       sscanf(str, "%s", keyword);
 
       if(strcmp(keyword, "end") == 0) 
@@ -233,6 +294,7 @@ int Skeleton::readASFfile(const char* asf_filename, double scale)
     m_pBoneList[i].length = length * scale;
   }
   printf("READ %d\n",NUM_BONES_IN_ASF_FILE);
+  BuildNameTable();
 
   //
   //read and build the hierarchy of the skeleton
@@ -249,15 +311,14 @@ int Skeleton::readASFfile(const char* asf_filename, double scale)
   } */
 
   //skip "begin" line
-  is.getline(str, 2048);
-  removeCR(str);
+  readLine(cursor, file.end(), str, 2048);
 
   //Assign parent/child relationship to the bones
   while(1)
   {
     //read next line
-    is.getline(str, 2048);	
-    removeCR(str);
+    if (!readLine(cursor, file.end(), str, 2048))
+      return -1;
 
     sscanf(str, "%s", keyword);
 
@@ -271,18 +332,22 @@ int Skeleton::readASFfile(const char* asf_filename, double scale)
       j=0;
       while(part_name != NULL)
       {
+        int idx = name2idx(part_name);
+        if (idx < 0 || m_BonePosition[idx] < 0)
+        {
+          printf("Error in Skeleton::readASFfile: unknown bone '%s' in the hierarchy.\n", part_name);
+          return -1;
+        }
         if(j==0) 
-          parent=name2idx(part_name);
+          parent=idx;
         else 
-          setChildrenAndSibling(parent, &m_pBoneList[name2idx(part_name)]);
+          setChildrenAndSibling(parent, &m_pBoneList[m_BonePosition[idx]]);
         part_name=strtok(NULL, " ");
         j++;
       }
     }
   }
 
-  is.close();
-
   return 0;
 }
 
@@ -515,37 +580,38 @@ void Skeleton::enableAllRotationalDOFs()
 }
 
 // set the skeleton's pose based on the given posture
-void Skeleton::setPosture(Posture posture) 
+void Skeleton::setPosture(const PostureView & posture) 
 {
-  m_RootPos[0] = posture.root_pos.p[0];
-  m_RootPos[1] = posture.root_pos.p[1];
-  m_RootPos[2] = posture.root_pos.p[2];
+  bonevector rootPos = posture.GetRootPos();
+  m_RootPos[0] = rootPos.p[0];
+  m_RootPos[1] = rootPos.p[1];
+  m_RootPos[2] = rootPos.p[2];
 
   for(int j=0;j<NUM_BONES_IN_ASF_FILE;j++)
   {
     // if the bone has rotational degree of freedom in x direction
     if(m_pBoneList[j].dofrx) 
-      m_pBoneList[j].rx = posture.bone_rotation[j].p[0];  
+      m_pBoneList[j].rx = posture.GetChannel(j, CHANNEL_RX);
 
     if(m_pBoneList[j].doftx)
-      m_pBoneList[j].tx = posture.bone_translation[j].p[0];
+      m_pBoneList[j].tx = posture.GetChannel(j, CHANNEL_TX);
 
     // if the bone has rotational degree of freedom in y direction
     if(m_pBoneList[j].dofry) 
-      m_pBoneList[j].ry = posture.bone_rotation[j].p[1];    
+      m_pBoneList[j].ry = posture.GetChannel(j, CHANNEL_RY);
 
     if(m_pBoneList[j].dofty)
-      m_pBoneList[j].ty = posture.bone_translation[j].p[1];
+      m_pBoneList[j].ty = posture.GetChannel(j, CHANNEL_TY);
 
     // if the bone has rotational degree of freedom in z direction
     if(m_pBoneList[j].dofrz) 
-      m_pBoneList[j].rz = posture.bone_rotation[j].p[2];  
+      m_pBoneList[j].rz = posture.GetChannel(j, CHANNEL_RZ);
 
     if(m_pBoneList[j].doftz)
-      m_pBoneList[j].tz= posture.bone_translation[j].p[2];
+      m_pBoneList[j].tz = posture.GetChannel(j, CHANNEL_TZ);
 
     if(m_pBoneList[j].doftl)
-      m_pBoneList[j].tl = posture.bone_length[j].p[0];
+      m_pBoneList[j].tl = posture.GetChannel(j, CHANNEL_TL);
   }
 }
 
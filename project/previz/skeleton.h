@@ -67,7 +67,7 @@ public:
   static int getRootIndex() { return 0; }
 
   //Set the skeleton's pose based on the given posture    
-  void setPosture(Posture posture);        
+  void setPosture(const PostureView & posture);        
 
   //Initial posture Root at (0,0,0)
   //All bone rotations are set to 0
@@ -76,7 +76,11 @@ public:
   // marks previously unavailable rotational DOFs as available, and sets them to 0
   void enableAllRotationalDOFs();
 
-  int name2idx(char *);
+  //Bone index of a bone name (which need not be null-terminated when a
+  //length is given), or -1 if the skeleton has no such bone
+  int name2idx(const char * name);
+  int name2idx(const char * name, int length);
+  //Name of a bone index, or NULL if there is no such bone
   char * idx2name(int);
   void GetRootPosGlobal(double rootPosGlobal[3]);
   void GetTranslation(double translation[3]);
@@ -128,7 +132,12 @@ protected:
   Bone *m_pRootBone;  // Pointer to the root bone, m_RootBone = &bone[0]
   Bone  m_pBoneList[MAX_BONES_IN_ASF_FILE];   // Array with all skeleton bones
 
-  void removeCR(char * str); // removes CR at the end of line
+  //Open-addressed hash table of the bone names, holding positions in
+  //m_pBoneList (-1 for empty slots), and the position of every bone index
+  enum { BONE_NAME_TABLE_SIZE = 2 * MAX_BONES_IN_ASF_FILE };
+  int m_NameTable[BONE_NAME_TABLE_SIZE];
+  int m_BonePosition[MAX_BONES_IN_ASF_FILE];
+  void BuildNameTable();
 };
 
 #endif
@@ -0,0 +1,141 @@
+#include "threadpool.hpp"
+
+using namespace std;
+
+// which pool (if any) the current thread works for, and its queue index
+static thread_local ThreadPool* currentPool = NULL;
+static thread_local int currentWorker = -1;
+
+TaskGroup::TaskGroup() : pending(0) {}
+
+ThreadPool::ThreadPool(int threads)
+    : queuedTasks(0), nextQueue(0), stopping(false) {
+    if (threads <= 0) {
+        threads = thread::hardware_concurrency();
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        queues.push_back(new WorkQueue());
+    }
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    for (unsigned int i = 0; i < queues.size(); i++) {
+        delete queues[i];
+    }
+}
+
+int ThreadPool::workerIndex() { return currentWorker; }
+
+void ThreadPool::submit(TaskGroup& group, const function<void()>& task) {
+    int index = currentWorker;
+    if (currentPool != this) {
+        index = nextQueue++ % queues.size();
+    }
+
+    group.pending++;
+    Task queued;
+    queued.run = task;
+    queued.group = &group;
+    {
+        lock_guard<mutex> guard(queues[index]->lock);
+        queues[index]->tasks.push_back(queued);
+    }
+    queuedTasks++;
+
+    // taking the lock orders this against a worker that is about to sleep
+    { lock_guard<mutex> guard(sleepLock); }
+    wakeUp.notify_one();
+}
+
+bool ThreadPool::popOwn(int index, Task& task) {
+    WorkQueue* queue = queues[index];
+    lock_guard<mutex> guard(queue->lock);
+    if (queue->tasks.empty()) {
+        return false;
+    }
+    task = queue->tasks.back();
+    queue->tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(int thief, Task& task) {
+    int total = queues.size();
+    int start = (thief < 0) ? 0 : thief + 1;
+    for (int i = 0; i < total; i++) {
+        WorkQueue* queue = queues[(start + i) % total];
+        lock_guard<mutex> guard(queue->lock);
+        if (!queue->tasks.empty()) {
+            task = queue->tasks.front();
+            queue->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runOne(int index) {
+    Task task;
+    bool found = (index >= 0 && popOwn(index, task)) || steal(index, task);
+    if (!found) {
+        return false;
+    }
+    queuedTasks--;
+    task.run();
+
+    // last one out wakes up whoever is waiting on the group
+    if (--task.group->pending == 0) {
+        { lock_guard<mutex> guard(sleepLock); }
+        wakeUp.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop(int index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        if (runOne(index)) {
+            continue;
+        }
+        unique_lock<mutex> guard(sleepLock);
+        wakeUp.wait(guard, [this] { return stopping || queuedTasks > 0; });
+        if (stopping && queuedTasks <= 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    int index = (currentPool == this) ? currentWorker : -1;
+    while (group.pending > 0) {
+        if (runOne(index)) {
+            continue;
+        }
+        unique_lock<mutex> guard(sleepLock);
+        wakeUp.wait(guard, [this, &group] {
+            return group.pending <= 0 || queuedTasks > 0;
+        });
+    }
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& body) {
+    TaskGroup group;
+    for (int i = 0; i < count; i++) {
+        submit(group, [&body, i] { body(i); });
+    }
+    wait(group);
+}
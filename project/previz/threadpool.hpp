@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// a batch of tasks that someone is waiting on
+class TaskGroup {
+   public:
+    TaskGroup();
+
+    atomic<int> pending;
+};
+
+// work-stealing thread pool. every worker owns a deque: it pops its own
+// newest task first (good locality for tasks it spawned itself), and when
+// it runs dry it steals the oldest task from someone else's deque. this
+// keeps cores busy when tasks take wildly different amounts of time, e.g.
+// tiles full of glass and mirror bounces next to empty background tiles
+class ThreadPool {
+   public:
+    // threads <= 0 means one thread per hardware core
+    ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    int size() const { return workers.size(); }
+
+    // which worker of its pool the calling thread is, or -1 if it isn't
+    // one
+    static int workerIndex();
+
+    // queue a task. from inside a worker it goes on that worker's own
+    // deque, otherwise the tasks are dealt round robin
+    void submit(TaskGroup& group, const function<void()>& task);
+
+    // block until every task in the group is done. the calling thread
+    // runs queued tasks while it waits, so tasks can wait on other tasks
+    void wait(TaskGroup& group);
+
+    // run body(0) ... body(count - 1) across the pool, and wait for them
+    void parallelFor(int count, const function<void(int)>& body);
+
+   protected:
+    class Task {
+       public:
+        function<void()> run;
+        TaskGroup* group;
+    };
+
+    class WorkQueue {
+       public:
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<thread> workers;
+    vector<WorkQueue*> queues;
+
+    // sleeping threads wait here for new tasks or finished groups
+    mutex sleepLock;
+    condition_variable wakeUp;
+    atomic<int> queuedTasks;
+    atomic<unsigned int> nextQueue;
+    bool stopping;
+
+    void workerLoop(int index);
+    bool popOwn(int index, Task& task);
+    bool steal(int thief, Task& task);
+    bool runOne(int index);
+};
@@ -4,8 +4,6 @@ using namespace std;
 
 int MAX_RECURSION_DEPTH = 10;
 
-Real frameCount = 0;
-
 Camera::Camera(VEC3 eye, VEC3 lookAt, VEC3 up, int xRes, int yRes,
                Real distanceToPlane, Real fovy)
     : eye(eye),
@@ -19,25 +17,74 @@ Camera::Camera(VEC3 eye, VEC3 lookAt, VEC3 up, int xRes, int yRes,
 
 Light::Light(VEC3 position, VEC3 color) : position(position), color(color) {}
 
-Ray::Ray(VEC3 origin, VEC3 direction) : origin(origin), direction(direction) {}
+template <class Scalar>
+RayT<Scalar>::RayT(Vector origin, Vector direction)
+    : origin(origin), direction(direction) {}
 
 // default constructor
-IntersectResult::IntersectResult()
+template <class Scalar>
+IntersectResultT<Scalar>::IntersectResultT()
     : t(0.0),
       doesIntersect(false),
-      normal(VEC3(0.0, 0.0, 0.0)),
-      intersectionPoint(VEC3(0.0, 0.0, 0.0)),
-      intersectingShape(NULL) {}
+      normal(Vector::Zero()),
+      intersectionPoint(Vector::Zero()),
+      intersectingShape(NULL),
+      material(NULL) {}
 
 // named constructor
-IntersectResult::IntersectResult(Real t, bool doesIntersect, VEC3 normal,
-                                 VEC3 intersectionPoint,
-                                 Shape* intersectingShape)
+template <class Scalar>
+IntersectResultT<Scalar>::IntersectResultT(Scalar t, bool doesIntersect,
+                                           Vector normal,
+                                           Vector intersectionPoint,
+                                           Shape* intersectingShape)
     : t(t),
       doesIntersect(doesIntersect),
       normal(normal),
       intersectionPoint(intersectionPoint),
-      intersectingShape(intersectingShape) {}
+      intersectingShape(intersectingShape),
+      material(intersectingShape == NULL ? NULL
+                                         : &intersectingShape->material) {}
+
+template class RayT<double>;
+template class IntersectResultT<double>;
+
+bool Accelerator::occluded(Ray ray, Real tMax, Shape*& occluder) {
+    IntersectResult result = intersect(ray, 0.0);
+    if (result.doesIntersect && result.t < tMax) {
+        occluder = result.intersectingShape;
+        return true;
+    }
+    return false;
+}
+
+// a cache line's worth of pointers
+static const int OCCLUDER_PADDING = 64 / sizeof(Shape*);
+
+OccluderCache::OccluderCache(int poolThreads, int totalLights)
+    : stride(totalLights + OCCLUDER_PADDING),
+      shapes((poolThreads + 1) * stride, NULL) {}
+
+bool shadowRayOccluded(const RenderContext& context, Ray shadowRay, Real tMax,
+                       int lightIndex) {
+    Shape* occluder = NULL;
+    if (context.occluders == NULL) {
+        return context.scene.occluded(shadowRay, tMax, occluder);
+    }
+
+    Shape*& last = context.occluders->lastOccluder(lightIndex);
+    if (last != NULL) {
+        IntersectResult result = last->intersect(shadowRay);
+        if (result.doesIntersect && result.t >= 0.0 && result.t < tMax) {
+            return true;
+        }
+    }
+
+    if (context.scene.occluded(shadowRay, tMax, occluder)) {
+        last = occluder;
+        return true;
+    }
+    return false;
+}
 
 Ray rayGenerationAlt(int pixel_i, int pixel_j, Camera cam) {
     // compute image plane
@@ -133,14 +180,28 @@ IntersectResult intersectScene(vector<Shape*> scene, Ray ray, Real tLow) {
     return closestValidIntersection;
 }
 
-VEC3 rayColor(vector<Shape*> scene, Ray ray, vector<Light*> lights,
-              Real phongExponent, bool useLights, bool useMultipleLights,
-              bool useSpecular, bool useShadows, bool useMirror,
-              int reflectionRecursionCounter, bool useRefraction,
-              bool useFresnel, bool softShadows) {
+RenderContext::RenderContext(Accelerator& scene, const vector<Light*>& lights,
+                             Real phongExponent, Real frameCount,
+                             OccluderCache* occluders)
+    : scene(scene),
+      lights(lights),
+      phongExponent(phongExponent),
+      frameCount(frameCount),
+      occluders(occluders) {}
+
+template <RenderSettings Settings>
+VEC3 rayColor(const RenderContext& context, const Ray& ray, int depth) {
     // do an intersection with the scene
-    IntersectResult intersection = intersectScene(scene, ray, 0.0);
+    IntersectResult intersection = context.scene.intersect(ray, 0.0);
+    return shadeIntersection<Settings>(context, intersection, ray, depth);
+}
 
+// every test on Settings below is a compile-time constant, so each
+// instantiation only keeps the code for its own effects
+template <RenderSettings Settings>
+VEC3 shadeIntersection(const RenderContext& context,
+                       const IntersectResult& intersection, const Ray& ray,
+                       int depth) {
     // no intersection (return black)
     if (intersection.intersectingShape == NULL) {
         return VEC3(1.0, 1.0, 1.0);  // white background
@@ -148,124 +209,129 @@ VEC3 rayColor(vector<Shape*> scene, Ray ray, vector<Light*> lights,
 
     // initialize with ambient
     VEC3 color = VEC3(0.0, 0.0, 0.0);
+    const MaterialInfo* material = intersection.material;
 
     // else if there is an intersection, do shading with lights
-    if (useLights) {
-        // for each light
-        for (int i = 0; i < lights.size(); i++) {
-            // shoot shadow ray
-            if (useShadows) {
+    if (Settings & RENDER_LIGHTS) {
+        const vector<Light*>& lights = context.lights;
+        // for each light, or only the first one
+        int totalLights = lights.size();
+        if (!(Settings & RENDER_MULTIPLE_LIGHTS)) {
+            totalLights = std::min(totalLights, 1);
+        }
+        for (int i = 0; i < totalLights; i++) {
+            // shoot shadow ray. only blockers between the point and the
+            // light count
+            if (Settings & RENDER_SHADOWS) {
                 Ray shadowRay =
-                    createShadowRay(intersection, ray, lights[i], softShadows);
-                IntersectResult shadowIntersect =
-                    intersectScene(scene, shadowRay, 0.0);
-                if (!shadowIntersect.doesIntersect) {
-                    color += lightingEquation(lights[i], intersection,
-                                              phongExponent, ray, useSpecular);
+                    createShadowRay(intersection, ray, lights[i],
+                                    (Settings & RENDER_SOFT_SHADOWS) != 0);
+                Real lightDistance =
+                    (lights[i]->position - shadowRay.origin).norm();
+                if (shadowRayOccluded(context, shadowRay, lightDistance, i)) {
+                    continue;
                 }
             }
-            // only use the first light if flag not set
-            if (!useMultipleLights) {
-                break;
-            }
+            color += lightingEquation(lights[i], intersection,
+                                      context.phongExponent, ray,
+                                      (Settings & RENDER_SPECULAR) != 0);
         }
     } else {
-        color += intersection.intersectingShape->color;
+        color += material->color;
     }
 
-    if (useMirror) {
-        if (intersection.intersectingShape->type == MIRROR &&
-            reflectionRecursionCounter != MAX_RECURSION_DEPTH) {
+    if (Settings & RENDER_MIRROR) {
+        if (material->type == MIRROR && depth != MAX_RECURSION_DEPTH) {
             Ray reflectionRay = createReflectionRay(intersection, ray);
             // call the reflection recursively
-            VEC3 reflectionColor =
-                rayColor(scene, reflectionRay, lights, phongExponent, useLights,
-                         useMultipleLights, useSpecular, useShadows, useMirror,
-                         reflectionRecursionCounter + 1, useRefraction,
-                         useFresnel, softShadows);
-            color += reflectionColor;
+            color += rayColor<Settings>(context, reflectionRay, depth + 1);
         }
     }
 
-    if (useRefraction) {
-        if (intersection.intersectingShape->type == DIELECTRIC &&
-            reflectionRecursionCounter != MAX_RECURSION_DEPTH) {
-            if (useFresnel) {
+    if (Settings & RENDER_REFRACTION) {
+        if (material->type == DIELECTRIC && depth != MAX_RECURSION_DEPTH) {
+            if (Settings & RENDER_FRESNEL) {
                 // get fresnel coefficients
                 Real kReflectance = fresnel(intersection, ray);
                 Real kRefraction = 1.0 - kReflectance;
                 Ray refractionRay = createRefractionRay(intersection, ray);
                 Ray reflectionRay = createReflectionRay(intersection, ray);
-                VEC3 reflectionColor = rayColor(
-                    scene, reflectionRay, lights, phongExponent, useLights,
-                    useMultipleLights, useSpecular, useShadows, useMirror,
-                    reflectionRecursionCounter + 1, useRefraction, useFresnel,
-                    softShadows);
-                VEC3 refractionColor = rayColor(
-                    scene, refractionRay, lights, phongExponent, useLights,
-                    useMultipleLights, useSpecular, useShadows, useMirror,
-                    reflectionRecursionCounter + 1, useRefraction, useFresnel,
-                    softShadows);
+                VEC3 reflectionColor =
+                    rayColor<Settings>(context, reflectionRay, depth + 1);
+                VEC3 refractionColor =
+                    rayColor<Settings>(context, refractionRay, depth + 1);
                 color += (kReflectance * reflectionColor) +
                          (kRefraction * refractionColor);
 
             } else {
                 // if entering dielectric
                 Ray refractionRay = createRefractionRay(intersection, ray);
-                VEC3 refractionColor = rayColor(
-                    scene, refractionRay, lights, phongExponent, useLights,
-                    useMultipleLights, useSpecular, useShadows, useMirror,
-                    reflectionRecursionCounter + 1, useRefraction, useFresnel,
-                    softShadows);
-                color += refractionColor;
+                color += rayColor<Settings>(context, refractionRay, depth + 1);
             }
         }
     }
 
     // do texturing
-    if (intersection.intersectingShape->texture != NULL) {
+    if (material->texture != NULL) {
         // texture lookup (fun: use time to make it animated)
+        // (0.005 per frame is about what the hit count used to advance by)
         VEC3 lookup =
             VEC3(intersection.intersectionPoint[0],
-                 intersection.intersectionPoint[1], frameCount * 0.000001);
-        color += intersection.intersectingShape->texture->getColor(lookup);
-        frameCount += 1.0;
+                 intersection.intersectionPoint[1],
+                 context.frameCount * 0.005);
+        color += material->texture->getColor(lookup);
     }
 
     // prevent weird PPM problems by clamping color
     return clampVec3(color, 0.0, 1.0);
 }
 
-VEC3 lightingEquation(Light* light, IntersectResult intersection,
-                      Real phongExponent, Ray ray, bool useSpecular) {
+// the settings in use. a new combination needs a line here
+template VEC3 rayColor<PREVIZ_RENDER_SETTINGS>(const RenderContext& context,
+                                               const Ray& ray, int depth);
+template VEC3 shadeIntersection<PREVIZ_RENDER_SETTINGS>(
+    const RenderContext& context, const IntersectResult& intersection,
+    const Ray& ray, int depth);
+
+template <class Scalar>
+typename TracerTypes<Scalar>::Vector lightingEquation(
+    Light* light, const IntersectResultT<Scalar>& intersection,
+    Scalar phongExponent, const RayT<Scalar>& ray, bool useSpecular) {
+    typedef TracerTypes<Scalar> Types;
+    typedef typename Types::Vector Vector;
+    const Vector lightPosition = Types::fromVEC3(light->position);
+    const Vector lightColor = Types::fromVEC3(light->color);
+    const Vector shapeColor = Types::fromVEC3(intersection.material->color);
+    const Scalar zero = 0.0;
+
     // * calculate the three vectors
     // calculate L vec from the intersectionPoint and the light position
-    VEC3 L = (light->position - intersection.intersectionPoint);
+    Vector L = (lightPosition - intersection.intersectionPoint);
     L /= L.norm();
     // calculate V from the intersectionPoint and eye position
-    VEC3 V = (ray.origin - intersection.intersectionPoint);
+    Vector V = (ray.origin - intersection.intersectionPoint);
     V /= V.norm();
     // calculate the r vector from the dot product of L and normal
-    VEC3 R = -L + (2 * L.dot(intersection.normal) * intersection.normal);
+    Vector R = -L + (2 * L.dot(intersection.normal) * intersection.normal);
     R /= R.norm();
 
     // * calculate the three components
     // ambient
-    VEC3 ambientColor = VEC3(0.0, 0.0, 0.0);
-    Real ambientIntensity = 1.0;
-    VEC3 ambientComponent = ambientColor * ambientIntensity;
+    Vector ambientColor = Types::make(0.0, 0.0, 0.0);
+    Scalar ambientIntensity = 1.0;
+    Vector ambientComponent = ambientColor * ambientIntensity;
     // diffuse
-    VEC3 diffuseComponent = intersection.intersectingShape->color.cwiseProduct(
-        light->color * std::max(0.0, intersection.normal.dot(L)));
+    Vector diffuseComponent = shapeColor.cwiseProduct(
+        lightColor * std::max(zero, intersection.normal.dot(L)));
     // diffuseComponent = clampVec3(diffuseComponent, 0.0, 1.0);
 
     // specular
-    VEC3 specularComponent = intersection.intersectingShape->color.cwiseProduct(
-        light->color * pow(std::max(0.0, R.dot(V)), phongExponent));
+    Vector specularComponent = shapeColor.cwiseProduct(
+        lightColor * pow(std::max(zero, R.dot(V)), phongExponent));
     // specularComponent = clampVec3(specularComponent, 0.0, 1.0);
 
     // * assemble the final color
-    VEC3 finalColor;
+    Vector finalColor;
     if (useSpecular) {
         // full shading for part 5.png
         finalColor = ambientComponent + diffuseComponent + specularComponent;
@@ -276,83 +342,101 @@ VEC3 lightingEquation(Light* light, IntersectResult intersection,
     return clampVec3(finalColor, 0.0, 1.0);
 }
 
-Ray createShadowRay(IntersectResult intersection, Ray ray, Light* light,
-                    bool softShadows) {
+template <class Scalar>
+RayT<Scalar> createShadowRay(const IntersectResultT<Scalar>& intersection,
+                             const RayT<Scalar>& ray, Light* light,
+                             bool softShadows) {
+    typedef TracerTypes<Scalar> Types;
+    typedef typename Types::Vector Vector;
+    const Scalar epsilon = CUSTOM_EPSILON;
+    const Vector lightPosition = Types::fromVEC3(light->position);
+
     // adjust to avoid shadow acne problem
-    VEC3 adjustedIntersectionPoint =
-        intersection.intersectionPoint + (CUSTOM_EPSILON * intersection.normal);
+    Vector adjustedIntersectionPoint =
+        intersection.intersectionPoint + (epsilon * intersection.normal);
     // generate shadow ray towards the light
-    VEC3 shadowDirection = (light->position - adjustedIntersectionPoint);
+    Vector shadowDirection = (lightPosition - adjustedIntersectionPoint);
     // if softShadows, do Monte Carlo sampling and return a randomized ray
     if (softShadows) {
         // * calculate some vectors in the plane
         // normal is flipped because ur hitting the light
-        VEC3 n = -intersection.normal;
-        VEC3 p = light->position;  // p is the point light source
+        Vector n = -intersection.normal;
+        Vector p = lightPosition;  // p is the point light source
         // find two points
-        VEC3 p1 =
-            VEC3(0.0, 0.0, (((n[0] * p[0]) + (n[1] * p[1])) / n[2]) + p[2]);
-        VEC3 p2 =
-            VEC3((((n[1] * p[1]) + (n[2] * p[2])) / n[0]) + p[0], 0.0, 0.0);
+        Vector p1 = Types::make(
+            0.0, 0.0, (((n[0] * p[0]) + (n[1] * p[1])) / n[2]) + p[2]);
+        Vector p2 = Types::make(
+            (((n[1] * p[1]) + (n[2] * p[2])) / n[0]) + p[0], 0.0, 0.0);
         // create two vecs
-        VEC3 u1 = p1 - p;
+        Vector u1 = p1 - p;
         u1 /= u1.norm();
-        VEC3 u2 = p2 - p;
+        Vector u2 = p2 - p;
         u2 /= u2.norm();
         // generate combination
-        u1 = (rand() % 1) * u1 * 0.5;
-        u2 = (rand() % 1) * u2 * 0.5;
+        u1 = Scalar(rand() % 1) * u1 * Scalar(0.5);
+        u2 = Scalar(rand() % 1) * u2 * Scalar(0.5);
         // translate p point
         p = p + u1 + u2;
         // make direction
         shadowDirection = p - adjustedIntersectionPoint;
         shadowDirection /= shadowDirection.norm();
-        Ray shadowRay(adjustedIntersectionPoint, shadowDirection);
+        RayT<Scalar> shadowRay(adjustedIntersectionPoint, shadowDirection);
         return shadowRay;
     }
     shadowDirection /= shadowDirection.norm();
-    Ray shadowRay(adjustedIntersectionPoint, shadowDirection);
+    RayT<Scalar> shadowRay(adjustedIntersectionPoint, shadowDirection);
     return shadowRay;
 }
 
-Ray createReflectionRay(IntersectResult intersection, Ray ray) {
+template <class Scalar>
+RayT<Scalar> createReflectionRay(
+    const IntersectResultT<Scalar>& intersection, const RayT<Scalar>& ray) {
+    typedef typename TracerTypes<Scalar>::Vector Vector;
+    const Scalar epsilon = CUSTOM_EPSILON;
+
     // adjust to avoid shadow acne problem
-    VEC3 adjustedIntersectionPoint =
-        intersection.intersectionPoint + (CUSTOM_EPSILON * intersection.normal);
+    Vector adjustedIntersectionPoint =
+        intersection.intersectionPoint + (epsilon * intersection.normal);
     // find the vector from intersection towards eye
-    VEC3 V = (ray.origin - adjustedIntersectionPoint);
+    Vector V = (ray.origin - adjustedIntersectionPoint);
     V /= V.norm();
     // get the reflection direction
-    VEC3 R = -V + (2.0 * V.dot(intersection.normal) * intersection.normal);
+    Vector R = -V + (Scalar(2.0) * V.dot(intersection.normal) *
+                     intersection.normal);
     R /= R.norm();
     // generate ray
-    Ray reflectionRay(adjustedIntersectionPoint, R);
+    RayT<Scalar> reflectionRay(adjustedIntersectionPoint, R);
     return reflectionRay;
 }
 
 // Attribution
 // https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
-Ray createRefractionRay(IntersectResult intersection, Ray ray) {
+template <class Scalar>
+RayT<Scalar> createRefractionRay(
+    const IntersectResultT<Scalar>& intersection, const RayT<Scalar>& ray) {
+    typedef typename TracerTypes<Scalar>::Vector Vector;
+    const Scalar epsilon = CUSTOM_EPSILON;
+
     // normal
-    VEC3 N = intersection.normal;
+    Vector N = intersection.normal;
 
     // incidence
-    VEC3 I = (intersection.intersectionPoint - ray.origin);
+    Vector I = (intersection.intersectionPoint - ray.origin);
     I /= I.norm();
 
     // reflection
-    VEC3 R = -I + (2.0 * I.dot(N) * N);
+    Vector R = -I + (Scalar(2.0) * I.dot(N) * N);
     R /= R.norm();
 
     // this gives direction of entry
-    Real cosi = clamp(-1.0, 1.0, I.dot(N));
+    Scalar cosi = clamp(-1.0, 1.0, I.dot(N));
 
     // incoming and outgoing ior
-    Real etai = REFRACT_AIR;
-    Real etat = intersection.intersectingShape->refractiveIndex;
+    Scalar etai = REFRACT_AIR;
+    Scalar etat = intersection.material->refractiveIndex;
 
     // if going inside to outside, flip normal and swap ior
-    VEC3 n = N;
+    Vector n = N;
     if (cosi < 0) {
         cosi = -cosi;
     } else {
@@ -361,63 +445,81 @@ Ray createRefractionRay(IntersectResult intersection, Ray ray) {
     }
 
     // calculate ratio of ior
-    Real eta = etai / etat;
+    Scalar eta = etai / etat;
 
     // test for total internal reflection
-    Real k = 1.0 - eta * eta * (1.0 - cosi * cosi);
+    Scalar k = Scalar(1.0) - eta * eta * (Scalar(1.0) - cosi * cosi);
 
     // avoid refraction acne
-    VEC3 adjustedPoint = intersection.intersectionPoint - (n * CUSTOM_EPSILON);
+    Vector adjustedPoint = intersection.intersectionPoint - (n * epsilon);
 
     if (k < 0.0) {
-        Ray reflectedRay = Ray(adjustedPoint, R);
+        RayT<Scalar> reflectedRay = RayT<Scalar>(adjustedPoint, R);
         return reflectedRay;
     } else {
-        VEC3 T = eta * I + (eta * cosi - sqrt(k)) * n;
-        Ray refractedRay = Ray(adjustedPoint, T);
+        Vector T = eta * I + (eta * cosi - sqrt(k)) * n;
+        RayT<Scalar> refractedRay = RayT<Scalar>(adjustedPoint, T);
         return refractedRay;
     }
 }
 
 // Attribution
 // https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel
-Real fresnel(IntersectResult intersection, Ray ray) {
-    Real kReflectance;
+template <class Scalar>
+Scalar fresnel(const IntersectResultT<Scalar>& intersection,
+               const RayT<Scalar>& ray) {
+    typedef typename TracerTypes<Scalar>::Vector Vector;
+    const Scalar zero = 0.0;
+    const Scalar one = 1.0;
+    Scalar kReflectance;
 
-    VEC3 N = intersection.normal;
+    Vector N = intersection.normal;
 
     // incidence
-    VEC3 I = (intersection.intersectionPoint - ray.origin);
+    Vector I = (intersection.intersectionPoint - ray.origin);
     I /= I.norm();
 
     // same side or separate
-    Real cosi = clamp(-1.0, 1.0, I.dot(N));
+    Scalar cosi = clamp(-1.0, 1.0, I.dot(N));
 
     // the two indices of refraction
-    Real etai = 1.0;
-    Real etat = intersection.intersectingShape->refractiveIndex;
+    Scalar etai = 1.0;
+    Scalar etat = intersection.material->refractiveIndex;
 
     // check direction
     if (cosi > 0.0) {
         std::swap(etai, etat);
     }
-    Real iorRatio = etai / etat;
+    Scalar iorRatio = etai / etat;
 
     // total internal reflection test
-    Real sint = iorRatio * sqrt(std::max(0.0, 1.0 - cosi * cosi));
+    Scalar sint = iorRatio * sqrt(std::max(zero, one - cosi * cosi));
 
     // Total internal reflection
     if (sint >= 1.0) {
         kReflectance = 1.0;
     } else {
-        Real cost = sqrt(std::max(0.0, 1.0 - sint * sint));
+        Scalar cost = sqrt(std::max(zero, one - sint * sint));
         cosi = fabs(cosi);
-        Real Rs =
+        Scalar Rs =
             ((etat * cosi) - (etai * cost)) / ((etat * cosi) + (etai * cost));
-        Real Rp =
+        Scalar Rp =
             ((etai * cosi) - (etat * cost)) / ((etai * cosi) + (etat * cost));
-        kReflectance = (Rs * Rs + Rp * Rp) / 2.0;
+        kReflectance = (Rs * Rs + Rp * Rp) / Scalar(2.0);
     }
 
     return kReflectance;
 }
+
+// the shading helpers, in double
+template VEC3 lightingEquation(Light* light,
+                               const IntersectResult& intersection,
+                               double phongExponent, const Ray& ray,
+                               bool useSpecular);
+template Ray createShadowRay(const IntersectResult& intersection,
+                            const Ray& ray, Light* light, bool softShadows);
+template Ray createReflectionRay(const IntersectResult& intersection,
+                                const Ray& ray);
+template Ray createRefractionRay(const IntersectResult& intersection,
+                                const Ray& ray);
+template double fresnel(const IntersectResult& intersection, const Ray& ray);
@@ -10,12 +10,14 @@
 
 #include "SETTINGS.h"
 #include "shapes.hpp"
+#include "threadpool.hpp"
 #include "utilities.hpp"
 
 using namespace std;
 
 // forward declarations from shapes to prevent circular dependency
 class Shape;
+class MaterialInfo;
 
 // primitives
 class Camera {
@@ -41,45 +43,175 @@ class Light {
     Light(VEC3 position, VEC3 color);
 };
 
-class Ray {
+// the vectors the tracer works in for a given scalar type. the shapes,
+// scenes and shading all work in double, where that's a plain VEC3, and
+// CompiledSceneFloat keeps its single precision to the scan
+template <class Scalar>
+class TracerTypes {
    public:
-    VEC3 origin;
-    VEC3 direction;
+    typedef Matrix<Scalar, 3, 1> Vector;
 
-    Ray(VEC3 origin, VEC3 direction);
+    static Vector make(Scalar x, Scalar y, Scalar z) {
+        return Vector(x, y, z);
+    }
+    static Vector fromVEC3(const VEC3& v) { return v.cast<Scalar>(); }
+    static VEC3 toVEC3(const Vector& v) { return v.template cast<Real>(); }
 };
 
-class IntersectResult {
+template <class Scalar>
+class RayT {
    public:
-    Real t;
+    typedef typename TracerTypes<Scalar>::Vector Vector;
+
+    Vector origin;
+    Vector direction;
+
+    RayT(Vector origin, Vector direction);
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+template <class Scalar>
+class IntersectResultT {
+   public:
+    typedef typename TracerTypes<Scalar>::Vector Vector;
+
+    Scalar t;
     bool doesIntersect;
-    VEC3 normal;
-    VEC3 intersectionPoint;
+    Vector normal;
+    Vector intersectionPoint;
     Shape* intersectingShape;
 
+    // what to shade the hit with. the named constructor points it at the
+    // shape's own material, and a compiled scene at its material table
+    const MaterialInfo* material;
+
     // default constructor
-    IntersectResult();
+    IntersectResultT();
 
     // named constructor
-    IntersectResult(Real t, bool doesIntersect, VEC3 normal,
-                    VEC3 intersectionPoint, Shape* intersectingShape);
+    IntersectResultT(Scalar t, bool doesIntersect, Vector normal,
+                     Vector intersectionPoint, Shape* intersectingShape);
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef RayT<Real> Ray;
+typedef IntersectResultT<Real> IntersectResult;
+
+// anything that can find the closest hit along a ray (see bvh.hpp)
+class Accelerator {
+   public:
+    virtual IntersectResult intersect(Ray ray, Real tLow) = 0;
+
+    // any-hit query for shadow rays: is anything hit in [0, tMax)? stops at
+    // the first blocker it finds, and hands it back through occluder. the
+    // default just runs the closest-hit query
+    virtual bool occluded(Ray ray, Real tMax, Shape*& occluder);
+
+    // virtual destructor
+    virtual ~Accelerator(){};
+};
+
+// the shape that last blocked each light, for every thread rendering a
+// frame. neighbouring pixels tend to be shadowed by the same thing, so
+// testing it first often skips the traversal altogether. a frame keeps one
+// for as long as it renders, so the shapes in it can't go stale
+class OccluderCache {
+   public:
+    // slots for the threads of a pool of poolThreads, plus one for threads
+    // outside the pool (only one of those may render at a time)
+    OccluderCache(int poolThreads, int totalLights);
+
+    // the calling thread's slot for a light
+    Shape*& lastOccluder(int light) {
+        return shapes[(ThreadPool::workerIndex() + 1) * stride + light];
+    }
+
+   protected:
+    // each thread's slots are followed by a cache line of padding, so no
+    // two threads ever write to the same line
+    int stride;
+    vector<Shape*> shapes;
 };
 
 // basic tracer code
 Ray rayGeneration(int pixel_i, int pixel_j, Camera cam);
 Ray rayGenerationAlt(int pixel_i, int pixel_j, Camera cam);
 IntersectResult intersectScene(vector<Shape*> scene, Ray ray, Real tLow);
-VEC3 rayColor(vector<Shape*> scene, Ray ray, vector<Light*> lights,
-              Real phongExponent, bool useLights, bool useMultipleLights,
-              bool useSpecular, bool useShadows, bool useMirror,
-              int reflectionRecursionCounter, bool useRefraction,
-              bool useFresnel, bool softShadows);
+
+// effects the tracer can compute, as bits of a RenderSettings mask. the
+// mask is a template argument, so every combination gets its own kernel
+// with the branches for the unused effects compiled out
+typedef unsigned int RenderSettings;
+const RenderSettings RENDER_LIGHTS = 1 << 0;
+const RenderSettings RENDER_MULTIPLE_LIGHTS = 1 << 1;
+const RenderSettings RENDER_SPECULAR = 1 << 2;
+const RenderSettings RENDER_SHADOWS = 1 << 3;
+const RenderSettings RENDER_MIRROR = 1 << 4;
+const RenderSettings RENDER_REFRACTION = 1 << 5;
+const RenderSettings RENDER_FRESNEL = 1 << 6;
+const RenderSettings RENDER_SOFT_SHADOWS = 1 << 7;
+
+// what the animation renders with: every light, shadows, mirrors and glass
+// with fresnel, but no specular highlights
+const RenderSettings PREVIZ_RENDER_SETTINGS =
+    RENDER_LIGHTS | RENDER_MULTIPLE_LIGHTS | RENDER_SHADOWS | RENDER_MIRROR |
+    RENDER_REFRACTION | RENDER_FRESNEL;
+
+// everything a ray needs that stays the same for the whole frame, handed
+// down the recursion by reference instead of copied at every bounce
+class RenderContext {
+   public:
+    Accelerator& scene;
+    const vector<Light*>& lights;
+    Real phongExponent;
+
+    // animation time for the textures. several frames can be in flight at
+    // once, so it belongs to the frame rather than to the process
+    Real frameCount;
+
+    // the frame's last occluders, or NULL to always ask the scene
+    OccluderCache* occluders;
+
+    RenderContext(Accelerator& scene, const vector<Light*>& lights,
+                  Real phongExponent, Real frameCount,
+                  OccluderCache* occluders = NULL);
+};
+
+// color seen along a ray. depth counts the mirror and glass bounces so far.
+// tracer.cpp instantiates the settings that are in use
+template <RenderSettings Settings>
+VEC3 rayColor(const RenderContext& context, const Ray& ray, int depth = 0);
+
+// the part of rayColor after the closest hit is known, for callers that
+// find their primary hits some other way (e.g. ray packets)
+template <RenderSettings Settings>
+VEC3 shadeIntersection(const RenderContext& context,
+                       const IntersectResult& intersection, const Ray& ray,
+                       int depth = 0);
+
+// shadow ray test for the light at lightIndex. tries the shape that last
+// blocked that light on this thread first, if the context has an occluder
+// cache, then falls back to scene.occluded()
+bool shadowRayOccluded(const RenderContext& context, Ray shadowRay, Real tMax,
+                       int lightIndex);
 
 // advanced tracer effects
-VEC3 lightingEquation(Light* light, IntersectResult intersection,
-                      Real phongExponent, Ray ray, bool useSpecular);
-Ray createShadowRay(IntersectResult intersection, Ray ray, Light* light,
-                    bool softShadows);
-Ray createReflectionRay(IntersectResult intersection, Ray ray);
-Ray createRefractionRay(IntersectResult intersection, Ray ray);
-Real fresnel(IntersectResult intersection, Ray ray);
+template <class Scalar>
+typename TracerTypes<Scalar>::Vector lightingEquation(
+    Light* light, const IntersectResultT<Scalar>& intersection,
+    Scalar phongExponent, const RayT<Scalar>& ray, bool useSpecular);
+template <class Scalar>
+RayT<Scalar> createShadowRay(const IntersectResultT<Scalar>& intersection,
+                             const RayT<Scalar>& ray, Light* light,
+                             bool softShadows);
+template <class Scalar>
+RayT<Scalar> createReflectionRay(
+    const IntersectResultT<Scalar>& intersection, const RayT<Scalar>& ray);
+template <class Scalar>
+RayT<Scalar> createRefractionRay(
+    const IntersectResultT<Scalar>& intersection, const RayT<Scalar>& ray);
+template <class Scalar>
+Scalar fresnel(const IntersectResultT<Scalar>& intersection,
+               const RayT<Scalar>& ray);